@@ -0,0 +1,76 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+
+/*
+server和client公共的消息帧格式
+| length(4字节) | msgid(2字节) | flags(2字节) | payload(length字节) |
+头部字段都是网络字节序，length只表示payload的长度
+*/
+
+// 帧头部长度
+const size_t kFrameHeaderLen = 8;
+// 允许的最大payload长度，超过认为是非法数据
+const uint32_t kMaxFrameLen = 4 * 1024 * 1024;
+
+// payload的编码方式
+enum EnFrameFlag
+{
+    FRAME_FLAG_JSON = 0,   // payload是json字符串
+    FRAME_FLAG_BINARY = 1, // payload是wireformat.hpp中定义的二进制格式
+};
+
+// 帧头部
+struct FrameHeader
+{
+    uint32_t length;
+    uint16_t msgid;
+    uint16_t flags;
+};
+
+// 把帧头部写入out指向的kFrameHeaderLen字节
+inline void encodeFrameHeader(char *out, const FrameHeader &header)
+{
+    uint32_t length = htonl(header.length);
+    uint16_t msgid = htons(header.msgid);
+    uint16_t flags = htons(header.flags);
+    memcpy(out, &length, sizeof length);
+    memcpy(out + 4, &msgid, sizeof msgid);
+    memcpy(out + 6, &flags, sizeof flags);
+}
+
+// 从data指向的kFrameHeaderLen字节中解析帧头部
+inline FrameHeader decodeFrameHeader(const char *data)
+{
+    uint32_t length;
+    uint16_t msgid;
+    uint16_t flags;
+    memcpy(&length, data, sizeof length);
+    memcpy(&msgid, data + 4, sizeof msgid);
+    memcpy(&flags, data + 6, sizeof flags);
+    return FrameHeader{ntohl(length), ntohs(msgid), ntohs(flags)};
+}
+
+// 把一条消息编码成完整的帧
+inline std::string encodeFrame(int msgid, const std::string &payload,
+                               uint16_t flags = FRAME_FLAG_JSON)
+{
+    std::string frame(kFrameHeaderLen, '\0');
+    encodeFrameHeader(&frame[0], FrameHeader{static_cast<uint32_t>(payload.size()),
+                                             static_cast<uint16_t>(msgid), flags});
+    frame += payload;
+    return frame;
+}
+
+// 判断数据是否为旧版本的json+'\0'格式
+// json对象总是以'{'开头，而帧头在最大帧长度的限制下第一个字节总是0
+inline bool isLegacyFormat(const char *data)
+{
+    return data[0] == '{';
+}
+
+#endif
@@ -18,6 +18,13 @@ enum EnMsgType
     ADD_GROUP_MSG,    // 加入群组
     GROUP_CHAT_MSG,   // 群聊天
 
+    OFFLINE_MSG_PAGE, // 分页推送的离线消息
+    OFFLINE_MSG_ACK,  // 客户端确认已经收到的离线消息
+
+    QUERY_GROUP_USERS_MSG,     // 查询群组成员
+    QUERY_GROUP_USERS_MSG_ACK, // 查询群组成员响应消息
+
+    MSG_TYPE_MAX, // 消息类型的数量，新的消息类型加在它前面
 };
 
 #endif
\ No newline at end of file
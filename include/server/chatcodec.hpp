@@ -0,0 +1,88 @@
+#ifndef CHATCODEC_H
+#define CHATCODEC_H
+
+#include <functional>
+#include <string>
+#include <memory>
+#include <muduo/net/TcpConnection.h>
+#include <muduo/net/Buffer.h>
+
+#include <mutex>
+
+#include "codec.hpp"
+#include "json.hpp"
+
+// 已经编码好的消息，群聊转发时编码一次，由所有接收者共享
+class EncodedMessage
+{
+public:
+    EncodedMessage(int msgid, std::string payload);
+    // 从json对象编码json格式的消息帧，二进制格式的消息帧在第一次使用时再编码
+    EncodedMessage(int msgid, const nlohmann::json &js);
+    // 同上，保留json对象，二进制格式的消息帧直接从它编码，不再解析json内容
+    EncodedMessage(int msgid, nlohmann::json &&js);
+
+    int msgid() const { return _msgid; }
+    // json格式的消息内容，用于旧格式的连接、redis发布和离线消息存储
+    const std::string &payload() const { return _payload; }
+    // 带帧头部的完整消息帧
+    const std::string &frame() const { return _frame; }
+    // 二进制格式的完整消息帧，用于二进制格式的连接
+    // 第一次使用时从保留的json对象编码，没有保留时解析json内容再编码，消息类型没有schema时返回json格式的帧
+    const std::string &binaryFrame() const;
+
+private:
+    int _msgid;
+    std::string _payload;
+    std::string _frame;
+    mutable nlohmann::json _json; // 编码二进制格式之前保留的json对象，编码后释放
+    mutable std::once_flag _binaryOnce;
+    mutable std::string _binaryFrame;
+};
+
+using EncodedMessagePtr = std::shared_ptr<const EncodedMessage>;
+
+// 消息帧的编解码器
+// 只从muduo的Buffer中取出完整的消息帧，一次可读事件中的多条消息逐条上报，不完整的数据留在Buffer中等待后续数据
+// 同时兼容旧版本客户端的json+'\0'格式，回复时使用和该连接最近一条消息相同的格式
+// 客户端发送二进制格式的消息帧之后，服务器发给该连接的消息也使用二进制格式
+class ChatCodec
+{
+public:
+    // 收到一条完整消息的回调，data指向Buffer内部，只在回调期间有效
+    // 旧格式的消息msgid为0，需要从payload中获取，flags表示payload的编码方式
+    using FrameCallback = std::function<void(const muduo::net::TcpConnectionPtr &,
+                                             int msgid, uint16_t flags,
+                                             const char *data, size_t len,
+                                             muduo::Timestamp)>;
+
+    explicit ChatCodec(const FrameCallback &cb);
+
+    // 从Buffer中解析出所有完整的消息帧
+    void onMessage(const muduo::net::TcpConnectionPtr &conn,
+                   muduo::net::Buffer *buffer,
+                   muduo::Timestamp time);
+
+    // 编码一条消息，返回的对象可以发送给多个连接
+    static EncodedMessagePtr encode(int msgid, std::string payload);
+    static EncodedMessagePtr encode(int msgid, const nlohmann::json &js);
+    // 业务处理转发收到的json对象时移入，二进制格式的接收者不需要再解析json内容
+    static EncodedMessagePtr encode(int msgid, nlohmann::json &&js);
+
+    // 按照连接使用的格式发送一条消息，msgid为0表示消息类型以payload为准
+    static void send(const muduo::net::TcpConnectionPtr &conn,
+                     int msgid, std::string payload);
+
+    // 按照连接使用的格式编码并发送一条消息，只生成该连接需要的格式
+    static void send(const muduo::net::TcpConnectionPtr &conn,
+                     int msgid, const nlohmann::json &js);
+
+    // 发送已经编码好的消息，在连接所属的I/O线程中直接发送共享的数据，不再拷贝
+    static void send(const muduo::net::TcpConnectionPtr &conn,
+                     const EncodedMessagePtr &message);
+
+private:
+    FrameCallback _frameCallback;
+};
+
+#endif
@@ -4,6 +4,10 @@
 #include <muduo/net/TcpServer.h>
 #include <muduo/net/EventLoop.h>
 
+#include "workerpool.hpp"
+#include "chatcodec.hpp"
+#include "metrics.hpp"
+
 // 聊天服务器的主类
 class ChatServer
 {
@@ -12,8 +16,12 @@ public:
     ChatServer(muduo::net::EventLoop *loop,
                const muduo::net::InetAddress &listenAddr,
                const std::string &nameArg);
+    // 设置业务线程的数量，必须在start之前调用
+    void setWorkerThreadNum(int numThreads);
     // 启动服务
     void start();
+    // 停止服务，事件循环退出之后调用，依次停止验证线程池、业务线程池，然后重置业务状态
+    void stop();
 
 private:
     // 上报连接相关信息的回调函数
@@ -22,9 +30,28 @@ private:
     void onMessage(const muduo::net::TcpConnectionPtr &,
                    muduo::net::Buffer *,
                    muduo::Timestamp);
+    // 编解码器上报一条完整消息的回调函数
+    void onFrame(const muduo::net::TcpConnectionPtr &,
+                 int msgid, uint16_t flags,
+                 const char *data, size_t len,
+                 muduo::Timestamp);
+    // 在连接所属的业务线程中执行任务，和该连接的消息串行
+    void runInConnThread(const muduo::net::TcpConnectionPtr &conn, WorkerPool::Task task);
+    // 注册服务器和业务线程池的指标
+    void registerMetrics();
 
     muduo::net::TcpServer _server; // 组合的muduo库，实现服务器功能的类对象
     muduo::net::EventLoop *_loop;  // 指向事件循环对象的指针
+    ChatCodec _codec;              // 消息帧的编解码器
+    WorkerPool _workerPool;        // 执行业务处理的线程池
+    int _workerThreadNum;          // 业务线程的数量
+
+    Gauge *_connections;          // 当前的连接数
+    Counter *_acceptedConnections; // 累计建立的连接数
+    Counter *_frames[3];           // 按格式统计收到的消息数: json帧、二进制帧、旧格式
+    Counter *_receivedBytes;       // 收到的消息内容字节数
+    Counter *_decodeErrors;        // 解析失败的消息数
+    Histogram *_onMessageLatency;  // onMessage中拆帧和解析的耗时
 };
 
 #endif
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 #include "usermodel.hpp"
 #include "offlinemessagemodel.hpp"
+#include "offlinemessagewriter.hpp"
 #include "friendmodel.hpp"
 #include "groupmodel.hpp"
 
@@ -15,11 +16,26 @@
 using json = nlohmann::json;
 
 #include "redis.hpp"
-
-// 处理消息事件回调方法类型
-using MsgHandler = std::function<void(
+#include "presenceservice.hpp"
+#include "groupcache.hpp"
+#include "friendcache.hpp"
+#include "profilecache.hpp"
+#include "credentialcache.hpp"
+#include "workerpool.hpp"
+#include "connregistry.hpp"
+#include "chatcodec.hpp"
+#include "public.hpp"
+#include "metrics.hpp"
+
+class ChatService;
+
+// 处理消息事件回调方法类型，成员函数指针，分发时不拷贝也不分配内存
+using MsgHandler = void (ChatService::*)(
     const muduo::net::TcpConnectionPtr &conn,
-    json &js, muduo::Timestamp time)>;
+    json &js, muduo::Timestamp time);
+
+// 在连接所属的业务线程中执行任务，由网络层提供
+using ConnExecutor = std::function<void(const muduo::net::TcpConnectionPtr &conn, std::function<void()> task)>;
 
 // 聊天服务器业务类
 class ChatService
@@ -44,16 +60,49 @@ public:
     void addGroup(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time);
     // 群组聊天业务
     void groupChat(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time);
+    // 客户端确认收到一页离线消息
+    void offlineMsgAck(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time);
+    // 查询群组成员业务，登录时没有加载群组成员的客户端按需查询
+    void queryGroupUsers(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time);
+
+
+    // 处理本服务器路由通道上收到的消息，转发给消息中列出的本地用户
+    void handleRedisSubcribeMessage(std::string_view msg);
 
+    // 处理redis订阅连接重连，重新同步断开期间错过的状态
+    void handleRedisReconnect();
 
-    void handleRedisSubcribeMessage(int, std::string);
+    // 处理无法送达其它服务器的消息，为消息中列出的用户存储离线消息
+    void handleRedisUndelivered(const std::string &header, std::shared_ptr<const std::string> payload);
+
+    // 处理redis控制通道上其它服务器发来的通知
+    void handleRedisControlMessage(std::string channel, std::string msg);
 
     // 处理客户端异常退出
     void clientCloseException(const muduo::net::TcpConnectionPtr &conn);
-    // 服务器异常，业务重置方法
+    // 停止验证线程池，还在排队的请求不再验证，直接交回业务线程，服务器退出时在停止业务线程池之前调用
+    void stopAuth();
+    // 服务器退出，业务线程池停止之后调用: 离线消息落库，从位置目录删除本服务器的用户，停止redis的线程
     void reset();
-    // 获取消息对应的处理器
-    MsgHandler getHandler(int msgid);
+    // 调用消息对应的处理器，msgid没有对应的处理器时记录错误
+    // 连接上的登录请求正在验证时，消息暂存到验证结果生效之后再处理
+    void dispatch(int msgid, const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time);
+    // 设置在连接所属的业务线程中执行任务的方法，验证线程池完成验证后由此回到连接的消息顺序中
+    void setConnExecutor(ConnExecutor executor);
+    // 设置离线消息的持久化方式
+    void setOfflineDurability(EnOfflineDurability durability);
+    // 获取离线消息写入的统计信息
+    OfflineWriterStats getOfflineWriterStats();
+    // 获取在线状态缓存的统计信息
+    PresenceCacheStats getPresenceCacheStats();
+    // 获取群组成员缓存的统计信息
+    GroupCacheStats getGroupCacheStats();
+    // 获取redis发布的统计信息
+    RedisPublishStats getRedisPublishStats();
+    // 获取位置缓存的统计信息
+    LocationCacheStats getLocationCacheStats();
+    // 获取redis订阅的统计信息
+    RedisSubscriberStats getRedisSubscriberStats();
 
 private:
     ChatService();
@@ -62,23 +111,95 @@ private:
     ChatService &operator=(const ChatService) = delete;
     ChatService(ChatService &&) = delete;
     ChatService &operator=(ChatService &&) = delete;
-    // 存储消息id和其对应的业务处理方法
-    std::unordered_map<int, MsgHandler> _msgHandlerMap;
-
-    // 存储在线用户的通信连接
-    std::unordered_map<int, muduo::net::TcpConnectionPtr> _userConnMap;
 
-    // 定义互斥锁，保证_userConnMap的线程安全
-    std::mutex _connMutex;
+    // 通过node服务器的路由通道转发消息给该服务器上的userids用户
+    bool forwardToNode(const std::string &node, const std::vector<int> &userids, const EncodedMessagePtr &message);
+    // 在验证线程中查询凭据并验证密码，验证结果交回连接所属的业务线程
+    void authenticate(const muduo::net::TcpConnectionPtr &conn, json &js, int id, const std::string &pwd);
+    // 在连接所属的业务线程中应用验证结果，err为0时完成登录，然后处理验证期间暂存的消息
+    void completeAuth(const muduo::net::TcpConnectionPtr &conn, json &js, int id, const std::string &name, int err);
+    // 清除连接的验证状态，按收到的顺序处理验证期间暂存的消息，只在连接所属的业务线程中调用
+    void resumeDeferred(const muduo::net::TcpConnectionPtr &conn);
+    // 在连接所属的业务线程中执行任务
+    void runInConnThread(const muduo::net::TcpConnectionPtr &conn, std::function<void()> task);
+    // 投递登录验证或者注册任务到验证线程池，排队的任务数或者预计的排队时间超过上限时返回false
+    bool submitAuthTask(size_t key, std::function<void()> task);
+    // 用一个验证任务的实际耗时更新平均耗时的估计
+    void updateAuthCost(std::chrono::steady_clock::time_point begin);
+    // 密码验证通过，记录用户的连接和在线状态，返回好友、群组和离线消息
+    void finishLogin(const muduo::net::TcpConnectionPtr &conn, json &js, int id, const std::string &name);
+    // 推送userid在afterSeq之后的一页离线消息，没有消息时不推送
+    void sendOfflinePage(const muduo::net::TcpConnectionPtr &conn, int userid, long long afterSeq);
+    // 获取群组的成员列表，优先使用本地的群组成员缓存
+    GroupMembers getGroupMembers(int groupid);
+    // 记录群组加入了新成员，并通知集群中的其它服务器
+    void addGroupMember(int groupid, int userid);
+    // 获取用户的好友列表，优先使用本地的好友列表缓存
+    FriendList getFriends(int userid);
+    // 批量获取用户名，和userids一一对应，优先使用本地的用户资料缓存
+    std::vector<std::string> getUserNames(const std::vector<int> &userids);
+
+    // 消息id到业务处理方法的分发表，按消息id直接下标访问
+    struct HandlerTable
+    {
+        MsgHandler handlers[MSG_TYPE_MAX];
+    };
+    // 编译期生成分发表，没有注册的消息id为空
+    static constexpr HandlerTable makeHandlerTable();
+    static const HandlerTable _handlerTable;
+    // 每种消息的处理耗时，和分发表一一对应
+    Histogram *_handlerLatency[MSG_TYPE_MAX];
+    // 没有对应处理器的消息数
+    Counter *_unknownMessages;
+    // 凭据缓存未命中时查询数据库和验证密码的耗时
+    Histogram *_authLatency;
+    // 验证线程池排队已满时拒绝的请求数
+    Counter *_authRejected;
+    // 注册业务层的指标
+    void registerMetrics();
+
+    // 存储在线用户的通信连接，按用户id分片加锁
+    ConnRegistry _userConnMap;
 
     // 数据操作类对象
     UserModel _userModel;
     OffLineMessageModel _offLineMsgModel;
+    // 离线消息的批量写入器
+    OfflineMessageWriter _offLineMsgWriter;
     FriendModel _friendModel;
     GroupModel _groupModel;
 
     // Redis操作对象
     Redis _redis;
+
+    // 本服务器的名字，用于路由通道和位置目录
+    std::string _nodeId;
+
+    // 用户在线状态服务，登录、注销和跨服务器转发时查询，不访问数据库
+    PresenceService _presence;
+
+    // 群组成员缓存，群聊转发时不需要查询数据库
+    GroupCache _groupCache;
+
+    // 好友列表缓存，登录时不需要每次联表查询好友
+    FriendCache _friendCache;
+    // 用户资料缓存，所有用户的好友列表共享
+    ProfileCache _profileCache;
+
+    // 最近验证通过的凭据缓存，断线重连时不需要查询数据库和计算密码哈希
+    CredentialCache _credentialCache;
+    // 验证线程池中排队和正在执行的任务数
+    std::atomic<int> _pendingAuth;
+    // 一个验证任务的平均耗时(us)，和排队的任务数一起估计新请求的排队时间
+    std::atomic<long long> _authCostUs;
+    // 验证线程数
+    int _authThreads;
+    // 服务器正在退出，排队的验证请求不再验证
+    std::atomic<bool> _authStopped;
+    // 在连接所属的业务线程中执行任务，没有设置时直接在调用线程中执行
+    ConnExecutor _connExecutor;
+    // 验证线程池，计算密码哈希不占用I/O线程和业务线程，放在最后，析构时最先停止
+    WorkerPool _authPool;
 };
 
 #endif
\ No newline at end of file
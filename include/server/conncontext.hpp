@@ -0,0 +1,56 @@
+#ifndef CONNCONTEXT_H
+#define CONNCONTEXT_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <muduo/net/TcpConnection.h>
+
+#include "json.hpp"
+
+// 连接上使用的消息格式
+enum EnWireMode
+{
+    WIRE_UNKNOWN = 0, // 还没有收到过消息
+    WIRE_FRAME,       // 长度前缀的消息帧
+    WIRE_LEGACY,      // 旧版本的json+'\0'格式
+    WIRE_BINARY,      // 长度前缀的消息帧，payload是二进制格式
+};
+
+// 登录验证期间暂存的一条后续消息
+struct DeferredMessage
+{
+    int msgid;
+    nlohmann::json js;
+    muduo::Timestamp time;
+};
+
+// 保存在TcpConnection的context中的连接状态
+// I/O线程和业务线程都会访问，成员使用原子变量
+struct ConnContext
+{
+    std::atomic<int> wireMode{WIRE_UNKNOWN};
+    // 在该连接上登录的用户id，没有登录为-1，断开连接时据此直接找到用户
+    std::atomic<int> userid{-1};
+
+    // 以下成员只在连接所属的业务线程中访问，不需要原子变量
+    // 登录请求正在验证线程池中验证密码
+    bool authPending = false;
+    // 验证期间收到的后续消息，验证结果生效之后按收到的顺序处理
+    std::vector<DeferredMessage> deferred;
+};
+
+using ConnContextPtr = std::shared_ptr<ConnContext>;
+
+// 获取连接的状态，连接建立时设置，之后不再替换，可以在任意线程读取
+inline ConnContextPtr getConnContext(const muduo::net::TcpConnectionPtr &conn)
+{
+    const boost::any &context = conn->getContext();
+    if (context.empty())
+    {
+        return nullptr;
+    }
+    return boost::any_cast<ConnContextPtr>(context);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CONNREGISTRY_H
+#define CONNREGISTRY_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <muduo/net/TcpConnection.h>
+
+// 在线用户的通信连接表
+// 按用户id分成多个分片，每个分片有独立的锁，I/O线程、业务线程和redis线程访问不同用户时互不竞争
+class ConnRegistry
+{
+public:
+    // shardCount会向上取整为2的幂
+    explicit ConnRegistry(int shardCount = 64);
+
+    // 查询用户的连接，不在线返回nullptr
+    muduo::net::TcpConnectionPtr find(int userid);
+    // 记录用户的连接，用户已经存在时返回false
+    bool insert(int userid, const muduo::net::TcpConnectionPtr &conn);
+    // 只在用户当前的连接是conn时删除，避免误删用户在新连接上的登录
+    bool erase(int userid, const muduo::net::TcpConnectionPtr &conn);
+    // 批量查询，群聊转发时使用，每个分片只加一次锁
+    // 在本服务器在线的用户连接放入found，其余的用户id放入missing，跳过exclude
+    void findMany(const std::vector<int> &userids, int exclude,
+                  std::vector<muduo::net::TcpConnectionPtr> &found,
+                  std::vector<int> &missing);
+    // 在线用户的数量
+    size_t size();
+    // 所有在线用户的id
+    std::vector<int> userIds();
+
+private:
+    // 每个分片独占缓存行，避免不同分片的锁之间伪共享
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<int, muduo::net::TcpConnectionPtr> conns;
+    };
+
+    Shard &shardOf(int userid);
+    size_t shardIndex(int userid);
+
+    size_t _mask;
+    std::vector<std::unique_ptr<Shard>> _shards;
+};
+
+#endif
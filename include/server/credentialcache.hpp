@@ -0,0 +1,54 @@
+#ifndef CREDENTIALCACHE_H
+#define CREDENTIALCACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+// 凭据缓存的统计信息
+struct CredentialCacheStats
+{
+    long long hits = 0;
+    long long misses = 0;
+    long long users = 0; // 缓存的用户数量
+};
+
+// 最近验证通过的用户凭据缓存 userid => (用户名, 密码的HMAC, 过期时间)
+// 断线重连时同一批用户集中登录，命中缓存时不查询数据库，也不重新计算加盐哈希
+// 只缓存验证通过的凭据，缓存中不保存明文密码
+// 用户在线期间凭据一直保留，下线时才开始计算过期时间，在线很久的用户断线重连也能命中
+class CredentialCache
+{
+public:
+    // ttl是用户下线之后凭据保留的时间
+    explicit CredentialCache(std::chrono::seconds ttl = std::chrono::seconds(30), size_t maxUsers = 1000000);
+
+    // 验证用户的密码，命中且匹配时返回true，name返回用户名
+    bool verify(int userid, const std::string &password, std::string &name);
+    // 放入验证通过的凭据
+    void put(int userid, const std::string &name, const std::string &password);
+    // 用户下线，缓存的凭据从现在开始计算过期时间
+    void touch(int userid);
+    // 获取缓存的统计信息
+    CredentialCacheStats getStats();
+
+private:
+    struct Entry
+    {
+        std::string name;
+        std::string fingerprint;
+        std::chrono::steady_clock::time_point expire;
+    };
+
+    std::chrono::seconds _ttl;
+    size_t _maxUsers;
+    std::mutex _mutex;
+    std::unordered_map<int, Entry> _entries;
+
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+};
+
+#endif
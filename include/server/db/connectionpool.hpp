@@ -0,0 +1,76 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+
+#include "db.h"
+#include "metrics.hpp"
+
+// 连接池运行统计，用于根据业务流量调整连接池大小
+struct ConnectionPoolStats
+{
+    long long hits = 0;        // 直接拿到空闲连接的次数
+    long long misses = 0;      // 没有空闲连接，需要新建或等待的次数
+    long long timeouts = 0;    // 等待超时获取失败的次数
+    long long created = 0;     // 累计创建的连接数
+    long long destroyed = 0;   // 累计回收的连接数
+    long long totalWaitUs = 0; // 获取连接累计耗时(us)
+    long long maxWaitUs = 0;   // 获取连接最大耗时(us)
+    int idle = 0;              // 当前空闲连接数
+    int total = 0;             // 当前连接总数
+};
+
+// MySQL数据库连接池
+class ConnectionPool
+{
+public:
+    // 获取连接池对象实例
+    static ConnectionPool *instance();
+    // 从连接池中获取一个可用连接，超时返回nullptr
+    // 返回的智能指针析构时自动把连接归还到连接池，而不是关闭连接
+    std::shared_ptr<MySQL> getConnection();
+    // 获取连接池的统计信息
+    ConnectionPoolStats getStats();
+
+private:
+    ConnectionPool();
+    ConnectionPool(const ConnectionPool &) = delete;
+    ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+    // 注册连接池的指标
+    void registerMetrics();
+    // 创建一条新的连接，失败返回nullptr
+    MySQL *createConnection();
+    // 把连接包装成智能指针，析构时归还连接池
+    std::shared_ptr<MySQL> lease(MySQL *conn);
+    // 扫描超过最大空闲时间的多余连接，进行回收
+    void scannerConnectionTask();
+    // 记录一次获取连接的耗时
+    void recordWait(std::chrono::steady_clock::time_point begin);
+
+    int _initSize;           // 连接池的初始连接量(最小连接量)
+    int _maxSize;            // 连接池的最大连接量
+    int _maxIdleTime;        // 连接池最大空闲时间(s)
+    int _connectionTimeout;  // 获取连接的超时时间(ms)
+    int _healthCheckTime;    // 空闲超过该时长(ms)的连接，取出时先ping检测
+
+    std::queue<MySQL *> _connectionQue; // 存储空闲连接的队列
+    std::mutex _queueMutex;             // 维护连接队列的线程安全
+    std::condition_variable _cv;        // 连接归还时通知等待的线程
+    int _connectionCnt;                 // 已创建的连接总数，由_queueMutex保护
+
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+    std::atomic<long long> _timeouts;
+    std::atomic<long long> _created;
+    std::atomic<long long> _destroyed;
+    std::atomic<long long> _totalWaitUs;
+    std::atomic<long long> _maxWaitUs;
+    Histogram *_waitLatency; // 获取连接的耗时分布
+};
+
+#endif
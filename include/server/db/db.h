@@ -3,6 +3,11 @@
 
 #include <mysql/mysql.h>
 #include <string>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+#include "statement.hpp"
 
 // 数据库操作类
 class MySQL
@@ -18,9 +23,22 @@ public:
     bool update(std::string sql);
     // 查询操作
     MYSQL_RES *query(std::string sql);
+    // 获取预处理语句，同一条sql在该连接上只预处理一次，失败返回nullptr
+    // 返回的语句在连接归还连接池之前有效
+    Statement *prepare(const std::string &sql);
     // 获取连接
     MYSQL* getConnection();
+    // 检测连接是否可用，断开时由mysql_ping尝试重连
+    bool ping();
+    // 刷新连接进入空闲状态的起始时间点
+    void refreshAliveTime();
+    // 返回连接空闲的时长(ms)
+    long long getAliveTime();
 private:
     MYSQL *_conn;
+    // 记录进入空闲状态后的起始时间
+    std::chrono::steady_clock::time_point _alivetime;
+    // 该连接上预处理过的语句，随连接一起销毁
+    std::unordered_map<std::string, std::unique_ptr<Statement>> _statements;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,84 @@
+#ifndef STATEMENT_H
+#define STATEMENT_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+
+#include "metrics.hpp"
+
+// 预处理语句
+// sql只在预处理时解析一次，参数和结果按类型绑定，整数列直接读取，不经过字符串转换
+// 由MySQL按sql缓存，和所属的连接一起使用，同一时间只能被一个线程使用
+class Statement
+{
+public:
+    explicit Statement(MYSQL *conn);
+    ~Statement();
+
+    Statement(const Statement &) = delete;
+    Statement &operator=(const Statement &) = delete;
+
+    // 预处理sql，准备参数和结果列的绑定
+    bool prepare(const std::string &sql);
+    // 执行失败之后语句可能已经不可用，由MySQL丢弃后重新预处理
+    bool broken() const { return _broken; }
+
+    // 绑定整数参数，index从0开始
+    void bindInt(int index, long long value);
+    // 绑定字符串参数，不拷贝数据，data在execute返回之前必须有效
+    void bindString(int index, const char *data, size_t len);
+    void bindString(int index, const std::string &value);
+
+    // 执行语句，有结果集时全部读取到客户端
+    bool execute();
+    // 移动到结果集的下一行，没有更多的行返回false
+    bool fetch();
+
+    // 读取当前行的列，column从0开始
+    bool isNull(int column);
+    long long getInt(int column);
+    std::string getString(int column);
+
+    // insert语句生成的自增id
+    unsigned long long insertId();
+    // 受影响的行数
+    unsigned long long affectedRows();
+
+    // sql在指标中的名字，语句类型加表名，例如 select_user
+    static std::string metricName(const std::string &sql);
+
+private:
+    // 整数参数的值和字符串参数的长度，MYSQL_BIND中保存的是它们的地址
+    struct Param
+    {
+        long long intValue;
+        unsigned long length;
+    };
+    // 结果列的接收缓冲区
+    struct Column
+    {
+        bool isString;
+        long long intValue;
+        std::vector<char> buffer;
+        unsigned long length;
+    };
+
+    MYSQL *_conn;
+    MYSQL_STMT *_stmt;
+    std::string _sql;
+    bool _broken;
+    bool _hasResult;
+    // 执行耗时和失败次数，同一条sql在所有连接上共用
+    Histogram *_latency;
+    Counter *_errors;
+    // 请求追踪中的阶段名字
+    const char *_spanName;
+
+    std::vector<MYSQL_BIND> _params;
+    std::vector<Param> _paramValues;
+    std::vector<MYSQL_BIND> _results;
+    std::vector<Column> _columns;
+};
+
+#endif
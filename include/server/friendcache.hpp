@@ -0,0 +1,65 @@
+#ifndef FRIENDCACHE_H
+#define FRIENDCACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "friendmodel.hpp"
+
+// 一个用户的好友列表，按friend表的序号升序排列
+// 好友关系只增不减，最后一个序号就是列表的版本号，客户端带上版本号登录时只返回之后新增的好友
+struct FriendListData
+{
+    std::vector<int> ids;
+    std::vector<long long> seqs;
+
+    long long version() const { return seqs.empty() ? 0 : seqs.back(); }
+};
+
+// 好友列表，只读共享
+using FriendList = std::shared_ptr<const FriendListData>;
+
+// 好友列表缓存的统计信息
+struct FriendCacheStats
+{
+    long long hits = 0;
+    long long misses = 0;
+    long long users = 0;   // 缓存的用户数量
+    long long friends = 0; // 缓存的好友关系总数
+};
+
+// 好友列表缓存 userid => 好友id数组
+// 好友列表使用写时拷贝，登录时拿到快照后不再持有锁
+class FriendCache
+{
+public:
+    explicit FriendCache(size_t maxUsers = 1000000);
+
+    // 查询用户的好友列表，未命中返回nullptr
+    FriendList get(int userid);
+    // 获取当前的版本号，从数据库加载好友列表之前调用
+    long long version();
+    // 放入从数据库加载的好友列表，加载期间缓存发生过变更则放弃，避免覆盖更新的数据
+    FriendList put(int userid, const std::vector<FriendRecord> &records, long long version);
+    // 用户添加了好友，只更新已经缓存的用户，按序号插入到有序的位置，重复的通知忽略
+    void addFriend(int userid, int friendid, long long seq);
+    // 丢弃所有缓存
+    void clear();
+    // 获取缓存的统计信息
+    FriendCacheStats getStats();
+
+private:
+    size_t _maxUsers;
+    std::mutex _mutex;
+    std::unordered_map<int, FriendList> _lists;
+    long long _friendCount;
+
+    std::atomic<long long> _version;
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+};
+
+#endif
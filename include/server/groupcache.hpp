@@ -0,0 +1,54 @@
+#ifndef GROUPCACHE_H
+#define GROUPCACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+// 群组成员列表，按用户id升序排列，只读共享
+using GroupMembers = std::shared_ptr<const std::vector<int>>;
+
+// 群组成员缓存的统计信息
+struct GroupCacheStats
+{
+    long long hits = 0;
+    long long misses = 0;
+    long long groups = 0;  // 缓存的群组数量
+    long long members = 0; // 缓存的成员总数
+};
+
+// 群组成员缓存 groupid => 有序的成员id数组
+// 成员列表使用写时拷贝，群聊转发时拿到快照后不再持有锁
+class GroupCache
+{
+public:
+    explicit GroupCache(size_t maxGroups = 100000);
+
+    // 查询群组的成员列表，未命中返回nullptr
+    GroupMembers get(int groupid);
+    // 获取当前的版本号，从数据库加载成员列表之前调用
+    long long version();
+    // 放入从数据库加载的成员列表，加载期间缓存发生过变更则放弃，避免覆盖更新的数据
+    // 返回排序去重后的成员列表
+    GroupMembers put(int groupid, std::vector<int> members, long long version);
+    // 群组加入新成员，只更新已经缓存的群组
+    void addMember(int groupid, int userid);
+    // 丢弃所有缓存
+    void clear();
+    // 获取缓存的统计信息
+    GroupCacheStats getStats();
+
+private:
+    size_t _maxGroups;
+    std::mutex _mutex;
+    std::unordered_map<int, GroupMembers> _groups;
+    long long _memberCount;
+
+    std::atomic<long long> _version;
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef LOCATIONCACHE_H
+#define LOCATIONCACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+// 位置缓存的统计信息
+struct LocationCacheStats
+{
+    long long hits = 0;
+    long long misses = 0;
+    long long users = 0; // 缓存的用户数量
+};
+
+// 用户所在服务器的本地缓存 userid => 服务器名
+// redis位置目录的副本，由控制通道上的在线状态变更通知维护
+class LocationCache
+{
+public:
+    explicit LocationCache(size_t maxUsers = 1000000);
+
+    // 查询用户所在的服务器，未命中返回false
+    bool get(int userid, std::string &node);
+    // 获取用户当前的版本号，从redis加载位置之前调用
+    long long version(int userid);
+    // 放入从redis加载的位置，加载期间该用户的位置发生过变更则放弃，避免覆盖更新的数据
+    void put(int userid, const std::string &node, long long version);
+    // 用户在node服务器上登录
+    void set(int userid, const std::string &node);
+    // 用户下线
+    void erase(int userid);
+    // 丢弃所有缓存
+    void clear();
+    // 获取缓存的统计信息
+    LocationCacheStats getStats();
+
+private:
+    // 用户所在分段的版本号
+    std::atomic<long long> &versionOf(int userid);
+
+    size_t _maxUsers;
+    std::mutex _mutex;
+    std::unordered_map<int, std::string> _nodes;
+
+    // 按用户id分段的版本号，用户的位置变更时增加所在分段的版本号，其它用户的加载不受影响
+    std::unique_ptr<std::atomic<long long>[]> _versions;
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+};
+
+#endif
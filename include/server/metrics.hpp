@@ -0,0 +1,175 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 计数器的分片数，每个线程固定写入其中一个分片，避免多个线程竞争同一个缓存行
+const size_t kMetricShards = 16;
+
+// 当前线程写入的分片，线程第一次使用时轮流分配
+inline size_t metricThreadShard()
+{
+    static std::atomic<size_t> nextShard{0};
+    static thread_local size_t shard = nextShard++ % kMetricShards;
+    return shard;
+}
+
+// 只增不减的计数器，按线程分片累加，读取时求和
+class Counter
+{
+public:
+    void add(long long n = 1)
+    {
+        _shards[metricThreadShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    long long value() const;
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<long long> value{0};
+    };
+    Shard _shards[kMetricShards];
+};
+
+// 可增可减的当前值，例如连接数
+class Gauge
+{
+public:
+    void set(long long value) { _value.store(value, std::memory_order_relaxed); }
+    void add(long long n) { _value.fetch_add(n, std::memory_order_relaxed); }
+    long long value() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<long long> _value{0};
+};
+
+// 时延直方图(us)，log-linear分桶: 每个2的幂区间再等分成16个桶，相对误差不超过约6%
+// 每个桶是独立的原子变量，记录时不加锁
+class Histogram
+{
+public:
+    // 记录一次时延
+    void observe(long long us);
+    // 获取百分位数，返回所在桶的上界
+    long long percentile(double p) const;
+    long long count() const { return _count.load(std::memory_order_relaxed); }
+    long long sum() const { return _sum.load(std::memory_order_relaxed); }
+    long long max() const { return _max.load(std::memory_order_relaxed); }
+
+private:
+    static const int kSubBits = 4;
+    static const long long kSubCount = 1 << kSubBits;
+    // 超过2^40us的值记入最后一个桶
+    static const int kMaxBits = 40;
+    static const size_t kBucketCount = (kMaxBits - kSubBits + 1) * kSubCount;
+
+    static size_t bucketIndex(long long value);
+    static long long bucketUpper(size_t index);
+
+    std::atomic<long long> _buckets[kBucketCount] = {};
+    std::atomic<long long> _count{0};
+    std::atomic<long long> _sum{0};
+    std::atomic<long long> _max{0};
+};
+
+// 统计一个作用域的耗时，析构时记入直方图
+class ScopedLatency
+{
+public:
+    explicit ScopedLatency(Histogram *histogram)
+        : _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency()
+    {
+        _histogram->observe(std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() - _start)
+                                .count());
+    }
+
+private:
+    Histogram *_histogram;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// 按prometheus文本格式输出指标，同名的指标合并在一起，只输出一次HELP和TYPE
+class MetricsWriter
+{
+public:
+    void counter(const std::string &name, const std::string &help, long long value,
+                 const std::string &labels = "");
+    void gauge(const std::string &name, const std::string &help, long long value,
+               const std::string &labels = "");
+    // 直方图按summary输出p50/p99/p999分位数、总数和总和
+    void summary(const std::string &name, const std::string &help, const Histogram &histogram,
+                 const std::string &labels = "");
+    // 生成完整的文本
+    std::string str() const;
+
+private:
+    struct Family
+    {
+        std::string help;
+        std::string type;
+        std::string lines;
+    };
+    Family &family(const std::string &name, const std::string &help, const char *type);
+    static void appendLine(std::string &out, const std::string &name, const std::string &labels,
+                           long long value);
+
+    std::map<std::string, Family> _families;
+};
+
+// 进程内的指标注册表
+// 指标在启动或者第一次使用时按名字和标签注册，之后由调用者保存指针直接更新，热路径上不查表也不加锁
+// labels是prometheus格式的标签，例如 msgid="1"
+class Metrics
+{
+public:
+    // 在抓取时读取已有统计信息的回调
+    using Collector = std::function<void(MetricsWriter &)>;
+
+    // 获取单例对象的接口函数
+    static Metrics *instance();
+
+    // 获取或者注册指标，返回的指针在进程运行期间有效
+    Counter *counter(const std::string &name, const std::string &help, const std::string &labels = "");
+    Gauge *gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+    Histogram *histogram(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    // 注册回调，用于各模块已经维护的统计信息
+    void addCollector(Collector collector);
+
+    // 输出所有指标的文本
+    std::string render();
+
+private:
+    Metrics() = default;
+
+    template <typename T>
+    struct Entry
+    {
+        std::string name;
+        std::string help;
+        std::string labels;
+        std::unique_ptr<T> metric;
+    };
+
+    template <typename T>
+    T *find(std::vector<Entry<T>> &entries, const std::string &name,
+            const std::string &help, const std::string &labels);
+
+    std::mutex _mutex;
+    std::vector<Entry<Counter>> _counters;
+    std::vector<Entry<Gauge>> _gauges;
+    std::vector<Entry<Histogram>> _histograms;
+    std::vector<Collector> _collectors;
+};
+
+#endif
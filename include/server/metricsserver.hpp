@@ -0,0 +1,29 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <memory>
+#include <muduo/net/TcpServer.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThread.h>
+
+// 指标的抓取服务
+// 在独立的线程和端口上提供 GET /metrics，输出prometheus文本格式的指标，抓取时不占用聊天服务的I/O线程
+class MetricsServer
+{
+public:
+    explicit MetricsServer(const muduo::net::InetAddress &listenAddr);
+    // 启动抓取服务的线程并开始监听
+    void start();
+
+private:
+    // 收到请求的回调函数，请求头完整后回复并关闭连接
+    void onMessage(const muduo::net::TcpConnectionPtr &conn,
+                   muduo::net::Buffer *buffer,
+                   muduo::Timestamp time);
+
+    muduo::net::InetAddress _listenAddr;
+    muduo::net::EventLoopThread _thread;
+    std::unique_ptr<muduo::net::TcpServer> _server;
+};
+
+#endif
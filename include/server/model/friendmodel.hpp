@@ -4,16 +4,23 @@
 
 #include "user.hpp"
 
+// 一条好友关系，seq是friend表的自增序号，用于增量同步好友列表
+struct FriendRecord
+{
+    int friendid;
+    long long seq;
+};
+
 // 维护好友信息的操作接口方法
 class FriendModel
 {
 
 public:
-    // 添加好友关系
-    void insert(int userid, int friendid);
+    // 添加好友关系，返回新记录的序号，失败返回0
+    long long insert(int userid, int friendid);
 
-    // 返回用户好友列表
-    std::vector<User> query(int userid);
+    // 返回用户的好友id和序号，按序号升序排列，只查询friend表
+    std::vector<FriendRecord> queryIds(int userid);
 };
 
 #endif
\ No newline at end of file
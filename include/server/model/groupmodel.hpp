@@ -9,12 +9,15 @@ class GroupModel
 public:
     // 创建群组
     bool createGroup(Group &group);
-    // 加入群聊
-    void addGroup(int userid, int groupid, std::string role);
-    // 查询用户所在的群聊
-    std::vector<Group> queryGroups(int userid);
-    // 根据指定的groupid查询群组用户id列表，除userid自己，主要用户群聊业务给群组其他成员发消息
-    std::vector<int> queryGroupUsers(int userid, int groupid);
+    // 加入群聊，插入失败(例如已经是群成员)时返回false
+    bool addGroup(int userid, int groupid, std::string role);
+    // 查询用户所在的群聊，withUsers为false时不加载群组成员，由客户端按需查询
+    // 不查询user表的state列，成员的在线状态由调用者从PresenceService查询
+    std::vector<Group> queryGroups(int userid, bool withUsers = true);
+    // 查询群组成员的id、名字和角色，在线状态同上
+    std::vector<GroupUser> queryGroupUserInfos(int groupid);
+    // 查询群组的所有成员id，用于加载群组成员缓存
+    std::vector<int> queryGroupMembers(int groupid);
 };
 
 #endif
\ No newline at end of file
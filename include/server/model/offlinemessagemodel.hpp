@@ -3,19 +3,44 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+
+// 一条待存储的离线消息，群消息的多个接收者共享同一份消息内容
+struct OfflineMessage
+{
+    int userid;
+    std::shared_ptr<const std::string> msg;
+};
+
+// 从数据库读取的离线消息，seq是offlinemessage表的自增id，作为分页的游标
+struct OfflineRecord
+{
+    long long seq;
+    std::string msg;
+};
 
 // 提供离线消息表的操作接口类
 class OffLineMessageModel
 {
 public:
-    // 存储用户的离线消息
-    void insert(int userid, std::string msg);
+    // 存储用户的离线消息，返回是否成功
+    bool insert(int userid, const std::string &msg);
+
+    // 批量存储离线消息，合并成多行insert预处理语句按顺序执行
+    // 遇到失败的语句就停止，返回之前已经写入的条数，等于msgs.size()表示全部成功
+    size_t insert(const std::vector<OfflineMessage> &msgs);
 
     // 删除用户的离线消息
     void remove(int userid);
 
     // 查询用户的离线消息
     std::vector<std::string> query(int userid);
+
+    // 分页查询用户seq之后的离线消息，最多limit条
+    std::vector<OfflineRecord> query(int userid, long long afterSeq, int limit);
+
+    // 删除用户seq及之前的离线消息，客户端确认收到之后调用
+    void remove(int userid, long long uptoSeq);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,89 @@
+#ifndef OFFLINEMESSAGEWRITER_H
+#define OFFLINEMESSAGEWRITER_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "offlinemessagemodel.hpp"
+
+// 离线消息的持久化方式
+enum EnOfflineDurability
+{
+    OFFLINE_DURABILITY_SYNC = 0,     // 调用线程直接写入数据库，返回时已经落库
+    OFFLINE_DURABILITY_GROUP_COMMIT, // 先写入内存队列，后台线程攒批提交，服务器崩溃时可能丢失最近一个周期的消息
+};
+
+// 离线消息写入的统计信息
+struct OfflineWriterStats
+{
+    long long rows = 0;     // 累计写入的消息条数
+    long long batches = 0;  // 累计提交的批次数
+    long long blocked = 0;  // 队列满时调用线程等待队列空出位置的次数
+    long long retried = 0;  // 批量写入失败后逐条重试的消息条数
+    long long failed = 0;   // 重试之后仍然写入失败而丢弃的消息条数
+    long long pending = 0;  // 当前队列中等待写入的消息条数
+};
+
+// 离线消息的批量写入器
+// 队列中的消息数量达到批量上限，或者第一条消息等待超过刷新间隔时，合并成多行insert写入数据库
+class OfflineMessageWriter
+{
+public:
+    OfflineMessageWriter();
+    ~OfflineMessageWriter();
+
+    // 设置离线消息的持久化方式
+    void setDurability(EnOfflineDurability durability);
+    // 存储一条离线消息
+    void write(int userid, std::shared_ptr<const std::string> msg);
+    // 存储多条离线消息
+    void write(std::vector<OfflineMessage> msgs);
+    // 等待调用之前写入的消息全部落库，服务器退出时调用
+    void flush();
+    // 等待调用之前写给userid的消息全部落库
+    // 用户登录读取离线消息之前调用，不需要等待其它用户的消息
+    void flush(int userid);
+    // 获取统计信息
+    OfflineWriterStats getStats();
+
+private:
+    // 后台线程，攒批写入数据库
+    void flushTask();
+    // 把一批消息写入数据库，失败的语句之后的消息逐条重试
+    void writeBatch(const std::vector<OfflineMessage> &batch);
+    // 记录每个接收者还没有落库的消息条数，调用时持有_mutex
+    void track(const std::vector<OfflineMessage> &msgs);
+    // 消息已经落库或者写入失败，减少接收者还没有落库的消息条数并唤醒等待的线程，调用时持有_mutex
+    void untrack(const std::vector<OfflineMessage> &msgs);
+
+    OffLineMessageModel _model;
+    std::atomic<int> _durability;
+
+    size_t _maxBatch;   // 批量写入的消息条数上限
+    int _flushInterval; // 刷新间隔(ms)
+    size_t _maxPending; // 队列中消息条数的上限，超过后调用线程等待队列空出位置
+
+    std::mutex _mutex;
+    std::condition_variable _cv;        // 通知后台线程有消息需要写入
+    std::condition_variable _flushedCv; // 通知等待flush的线程
+    std::condition_variable _spaceCv;   // 通知等待队列空出位置的线程
+    std::vector<OfflineMessage> _pending;
+    unsigned long long _enqueued; // 累计进入队列的消息条数
+    unsigned long long _flushed;  // 累计已经写入数据库的消息条数
+    // 接收者 => 队列中、正在提交和正在同步写入的消息条数，没有未落库消息的接收者不在表中
+    std::unordered_map<int, int> _unflushed;
+    bool _flushRequested;
+    bool _running;
+    std::thread _thread;
+
+    std::atomic<long long> _rows;
+    std::atomic<long long> _batches;
+    std::atomic<long long> _blocked;
+    std::atomic<long long> _retried;
+    std::atomic<long long> _failed;
+};
+
+#endif
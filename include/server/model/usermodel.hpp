@@ -1,5 +1,6 @@
 #ifndef USERMODEL_H
 #define USERMODEL_H
+#include <vector>
 #include "user.hpp"
 
 // User表的数据操作类
@@ -8,13 +9,12 @@ class UserModel
 public:
     // User表的增加方法
     bool insert(User &user);
-    // 根据用户号码查询用户信息
-    User query(int id);
-    // 更新用户信息状态
-    bool updateState(User user);
-
-    //重置用户的状态信息
-    void resetState();
+    // 批量查询用户的id和用户名，不存在的用户不返回
+    std::vector<User> queryNames(const std::vector<int> &ids);
+    // 登录验证时查询用户名和密码记录，不查询其它字段
+    User queryCredential(int id);
+    // 更新用户的密码记录，旧版本的明文密码验证通过后升级成加盐哈希
+    bool updatePassword(int id, const std::string &password);
 };
 
 #endif
\ No newline at end of file
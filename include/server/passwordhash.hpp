@@ -0,0 +1,33 @@
+#ifndef PASSWORDHASH_H
+#define PASSWORDHASH_H
+
+#include <string>
+
+// 用户密码的加盐哈希，使用OpenSSL的PBKDF2-HMAC-SHA256
+// 数据库中存储的格式: pbkdf2_sha256$迭代次数$盐(hex)$哈希(hex)，迭代次数随格式保存，以后可以调整
+// 不是这个格式的记录是旧版本存储的明文密码，验证通过后由调用者升级成哈希
+class PasswordHash
+{
+public:
+    // 默认的迭代次数，NIST SP 800-63B要求的最小值，单核每次约7.6ms
+    // 验证线程池在服务器重启后的重连风暴中每个线程每秒可以验证约130次，更大的值由启动参数设置
+    static const int kDefaultIterations = 10000;
+
+    // 设置新生成的哈希记录使用的迭代次数，启动时调用
+    static void setIterations(int iterations);
+    // 新生成的哈希记录使用的迭代次数
+    static int iterations();
+
+    // 生成随机盐并计算密码的哈希记录，计算量很大，不在I/O线程中调用
+    static std::string hash(const std::string &password);
+    // 验证密码和数据库中的记录是否匹配，比较时间和匹配的位置无关
+    static bool verify(const std::string &password, const std::string &record);
+    // 记录是否需要重新计算哈希: 旧版本的明文密码，或者迭代次数和当前的设置不同
+    static bool needsRehash(const std::string &record);
+    // 用进程内的随机密钥计算密码的HMAC，用于内存中的凭据缓存，缓存中不保存明文密码
+    static std::string fingerprint(const std::string &password);
+    // 长度相同时，比较时间和内容无关
+    static bool equals(const std::string &a, const std::string &b);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef PRESENCECACHE_H
+#define PRESENCECACHE_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// 缓存中记录的用户在线状态
+enum EnPresence
+{
+    PRESENCE_UNKNOWN = 0, // 缓存中没有该用户的状态，需要查询redis位置目录
+    PRESENCE_ONLINE,
+    PRESENCE_OFFLINE,
+};
+
+// 在线状态缓存的统计信息
+struct PresenceCacheStats
+{
+    long long hits = 0;        // 命中次数
+    long long misses = 0;      // 未命中次数
+    long long memoryBytes = 0; // 已分配的内存
+};
+
+// 本地的用户在线状态缓存
+// 每个用户的状态只占2个bit，按用户id分块懒分配，百万级用户只需要几百KB内存
+// 读写都是原子操作，不需要加锁
+class PresenceCache
+{
+public:
+    // maxUsers限制缓存的用户id范围，超出范围的用户总是未命中
+    explicit PresenceCache(int maxUsers = 1 << 26);
+    ~PresenceCache();
+
+    // 查询用户的在线状态
+    EnPresence get(int userid);
+    // 设置用户的在线状态，用于本节点登录注销和其它节点的通知
+    void set(int userid, EnPresence presence);
+    // 获取用户当前的版本号，从redis加载状态之前调用
+    long long version(int userid);
+    // 只在缓存中没有该用户状态、并且加载期间该用户的状态没有变更过时才设置
+    // 用于从redis回填，避免覆盖更新的通知
+    void fill(int userid, EnPresence presence, long long version);
+    // 清空所有用户的状态
+    void clear();
+    // 把所有离线状态重置成未知，下次查询时重新从redis加载
+    // 离线通知乱序或丢失时，错误的离线状态最多保留到下一次重置
+    void expireOffline();
+    // 获取缓存的统计信息
+    PresenceCacheStats getStats();
+
+private:
+    using Word = std::atomic<uint64_t>;
+
+    // 获取用户所在的块，create为true时不存在则创建
+    Word *getChunk(int userid, bool create);
+    // 更新用户的状态，expect不为空时只在当前状态等于*expect时更新，返回是否更新
+    bool update(int userid, EnPresence presence, const EnPresence *expect);
+    // 用户所在分段的版本号
+    std::atomic<long long> &versionOf(int userid);
+    // 增加所有分段的版本号，清空或者重置状态之前调用
+    void bumpAllVersions();
+
+    int _maxUsers;
+    int _chunkCount;
+    std::unique_ptr<std::atomic<Word *>[]> _chunks;
+    std::atomic<long long> _allocatedChunks;
+    // 按用户id分段的版本号，用户的状态变更时增加所在分段的版本号，其它用户的回填不受影响
+    std::unique_ptr<std::atomic<long long>[]> _versions;
+
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+};
+
+#endif
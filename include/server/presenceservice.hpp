@@ -0,0 +1,88 @@
+#ifndef PRESENCESERVICE_H
+#define PRESENCESERVICE_H
+
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+
+#include "redis.hpp"
+#include "presencecache.hpp"
+#include "locationcache.hpp"
+
+// 用户在线状态服务
+// redis位置目录是集群内在线状态的唯一来源，本地缓存位置和在线状态，由控制通道上的变更通知维护
+// 每个服务器定期刷新带过期时间的心跳，服务器宕机后心跳过期，登记在该服务器上的用户视为离线，不需要人工清理
+// 在线状态不写入数据库，数据库中user表的state字段不再维护
+class PresenceService
+{
+public:
+    PresenceService(Redis &redis, const std::string &nodeId);
+    ~PresenceService();
+
+    // 集群内广播用户在线状态变更的控制通道
+    static const char *channel();
+
+    // 刷新本服务器的心跳并启动心跳线程，连接redis之后调用
+    void start();
+    // 用户在本服务器登录，在位置目录中登记并通知其它服务器
+    // 用户已经登录在其它存活的服务器上时返回false，redis出错时放行
+    bool login(int userid);
+    // 用户在本服务器下线
+    void logout(int userid);
+    // 查询用户登录所在的服务器，不在线返回空字符串
+    std::string findUserNode(int userid);
+    // 批量查询用户登录所在的服务器，按服务器分组放入byNode，不在线的用户放入offline
+    // 缓存未命中的用户合并成一次redis查询
+    void findUserNodes(const std::vector<int> &userids,
+                       std::unordered_map<std::string, std::vector<int>> &byNode,
+                       std::vector<int> &offline);
+    // 查询userids中在线的用户，用于好友和群组成员列表的状态
+    std::unordered_set<int> onlineUsers(const std::vector<int> &userids);
+    // 处理控制通道上其它服务器发来的在线状态通知
+    void handleControlMessage(const std::string &msg);
+    // redis订阅连接重连后丢弃缓存，重新登记本服务器上的用户
+    void resync(const std::vector<int> &localUsers);
+    // 服务器退出，从位置目录删除本服务器上的用户并删除心跳，通知其它服务器丢弃缓存
+    void shutdown(const std::vector<int> &localUsers);
+
+    // 获取在线状态缓存的统计信息
+    PresenceCacheStats getPresenceCacheStats();
+    // 获取位置缓存的统计信息
+    LocationCacheStats getLocationCacheStats();
+
+private:
+    // 服务器是否存活，查询结果在本地缓存一段时间
+    bool isNodeAlive(const std::string &node);
+    // 服务器已经宕机，丢弃缓存的用户位置，并从位置目录删除
+    void dropStale(int userid, const std::string &node);
+    // 更新本地缓存，并通知集群中的其它服务器
+    void publish(int userid, EnPresence presence);
+    // 心跳线程，定期刷新本服务器的心跳
+    void heartbeatTask();
+    // 停止心跳线程
+    void stopHeartbeat();
+
+    Redis &_redis;
+    std::string _nodeId;
+
+    // 用户所在服务器的缓存，跨服务器转发时不需要每次查询redis
+    LocationCache _locationCache;
+    // 用户在线状态缓存，转发消息时不需要查询redis
+    PresenceCache _presenceCache;
+
+    // 其它服务器的存活状态 服务器名 => (是否存活, 查询时间)
+    std::mutex _nodeMutex;
+    std::unordered_map<std::string, std::pair<bool, std::chrono::steady_clock::time_point>> _nodes;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _running;
+    std::thread _thread;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef PROFILECACHE_H
+#define PROFILECACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// 用户资料缓存的统计信息
+struct ProfileCacheStats
+{
+    long long hits = 0;
+    long long misses = 0;
+    long long users = 0; // 缓存的用户数量
+};
+
+// 用户资料缓存 userid => 用户名
+// 所有用户的好友列表共享同一份资料，用户名注册后不再修改，缓存不需要失效
+class ProfileCache
+{
+public:
+    explicit ProfileCache(size_t maxUsers = 1000000);
+
+    // 批量查询用户名，names和userids一一对应，未命中的用户放入missing
+    void get(const std::vector<int> &userids, std::vector<std::string> &names, std::vector<int> &missing);
+    // 放入从数据库加载的用户名
+    void put(int userid, const std::string &name);
+    // 获取缓存的统计信息
+    ProfileCacheStats getStats();
+
+private:
+    size_t _maxUsers;
+    std::mutex _mutex;
+    std::unordered_map<int, std::string> _names;
+
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+};
+
+#endif
@@ -2,13 +2,49 @@
 #define REDIS_H
 
 #include <hiredis/hiredis.h>
+#include <sys/uio.h>
 #include <thread>
 #include <functional>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "metrics.hpp"
 /*
 redis作为集群服务器通信的基于发布-订阅消息队列时，会遇到两个难搞的bug问题，参考我的博客详细描述：
 https://blog.csdn.net/QIANGWEIYUAN/article/details/97895611
 */
 
+// redis发布的统计信息
+struct RedisPublishStats
+{
+    long long published = 0;      // 累计发布成功的消息数
+    long long failed = 0;         // 发送失败或者返回错误的消息数
+    long long rejected = 0;       // 队列满时拒绝的消息数
+    long long retried = 0;        // 目标服务器没有订阅或者连接断开后重发的次数
+    long long undelivered = 0;    // 重发超时后交给业务层处理的消息数
+    long long batches = 0;        // 累计写出的批次数
+    long long pending = 0;        // 当前队列中等待发送的消息数
+    long long totalLatencyUs = 0; // 从提交到收到响应的累计时延
+    long long maxLatencyUs = 0;   // 从提交到收到响应的最大时延
+};
+
+// redis订阅的统计信息
+struct RedisSubscriberStats
+{
+    long long messages = 0;      // 累计收到的通道消息数
+    long long confirmations = 0; // 累计收到的订阅和取消订阅确认数
+    long long reconnects = 0;    // 订阅连接断开后重连的次数
+    long long totalGapMs = 0;    // 订阅连接断开的累计时长，这期间发给本服务器的消息由发送方重发
+    long long maxGapMs = 0;      // 订阅连接断开的最大时长
+    bool connected = false;      // 订阅连接当前是否可用
+};
+
 class Redis
 {
 public:
@@ -17,31 +53,170 @@ public:
 
     // 连接服务器
     bool connect();
+    // 停止订阅线程和发送线程，队列中剩余的命令发完再返回，服务器退出时在业务对象析构之前调用
+    void stop();
+
+    // 向指定服务器的路由通道发布消息，通道上的消息内容是header后面紧接着payload，可以是任意二进制数据
+    // 消息放入发送队列后立即返回，由发送线程批量发出，队列满时返回false，由调用者存储离线消息
+    // payload由多个发布共享，不拷贝，发送线程用writev把它和命令的其它部分一起直接写到连接上
+    // 目标服务器暂时没有订阅路由通道时在一段时间内重发，仍然失败交给undelivered回调
+    bool publish_node(const std::string &node, std::string header, std::shared_ptr<const std::string> payload);
 
-    // 向redis指定通道channel发布消息
-    bool publish(int channel, std::string message);
+    // 向集群内部的控制通道发布消息，例如用户在线状态的变更通知
+    bool publish(const std::string &channel, const std::string &message);
 
-    // 向redis指定的通道subscribe订阅消息
-    bool subscribe(int channel);
+    // 在命令连接上同步发布控制通道消息，发送线程停止之后服务器退出时使用
+    bool publish_now(const std::string &channel, const std::string &message);
 
-    // 想redis指定的通道unsubscribe取消订阅消息
-    bool unsubscribe(int channel);
+    // 订阅本服务器的路由通道，发给本服务器上用户的消息都从这个通道接收
+    bool subscribe_node(const std::string &node);
 
-    // 独立线程中接收订阅通道中的消息
+    // 订阅集群内部的控制通道
+    bool subscribe(const std::string &channel);
+
+    // 独立线程中接收订阅通道中的消息，连接断开时重连并重新订阅
     void observer_channel_message();
 
-    // 初始化向业务上报通道消息的回调对象
-    void init_notify_handler(std::function<void(int, std::string)> fun);
+    // 在位置目录中记录用户登录在node服务器上
+    bool set_location(int userid, const std::string &node);
+
+    // 在位置目录中登记用户登录在node服务器上，用户已经登记在其它存活的服务器上时不修改，owner返回该服务器
+    // 登记成功时owner为空，redis出错返回false
+    bool claim_location(int userid, const std::string &node, std::string &owner);
+
+    // 从位置目录中删除用户，只在用户仍然记录在node服务器上时删除，避免误删用户在其它服务器上的新登录
+    // removed不为空时返回记录是否真的被删除，redis出错返回false
+    bool remove_location(int userid, const std::string &node, bool *removed = nullptr);
+
+    // 查询用户所在的服务器，用户不在线时node为空，redis出错返回false
+    bool get_location(int userid, std::string &node);
+
+    // 批量查询用户所在的服务器，nodes和userids一一对应，不在线的用户为空，redis出错返回false
+    bool get_locations(const std::vector<int> &userids, std::vector<std::string> &nodes);
+
+    // 刷新node服务器的心跳，ttl秒内没有再次刷新视为该服务器已经宕机
+    bool set_heartbeat(const std::string &node, int ttl);
+
+    // 删除node服务器的心跳，服务器正常退出时调用
+    bool remove_heartbeat(const std::string &node);
+
+    // 查询node服务器的心跳是否存在，redis出错返回false
+    bool get_heartbeat(const std::string &node, bool &alive);
+
+    // 初始化向业务上报路由通道消息的回调对象，消息直接指向redis的响应，只在回调期间有效
+    void init_notify_handler(std::function<void(std::string_view)> fun);
+
+    // 初始化向业务上报控制通道消息的回调对象
+    void init_control_handler(std::function<void(std::string, std::string)> fun);
+
+    // 初始化订阅连接重连成功的回调对象，断开期间错过的控制通道消息需要业务层重新同步
+    void init_reconnect_handler(std::function<void()> fun);
+
+    // 初始化路由通道消息无法送达的回调对象，由业务层存储离线消息
+    void init_undelivered_handler(std::function<void(const std::string &, std::shared_ptr<const std::string>)> fun);
+
+    // 获取发布的统计信息
+    RedisPublishStats getPublishStats();
+
+    // 获取订阅的统计信息
+    RedisSubscriberStats getSubscriberStats();
 
 private:
-    // hiredis同步上下文对象,负责publish消息
+    // 等待发送的一条PUBLISH命令
+    struct PublishItem
+    {
+        std::string channel;
+        std::string header;
+        std::shared_ptr<const std::string> payload;
+        std::chrono::steady_clock::time_point enqueueTime;
+    };
+
+    // 放入发送队列
+    bool enqueue(std::string channel, std::string header, std::shared_ptr<const std::string> payload);
+    // 把一条PUBLISH命令在消息内容之前的部分按redis协议格式追加到cmd
+    static void formatPublishPrefix(std::string &cmd, const PublishItem &item);
+    // 发送线程，取出队列中的全部命令，流水线方式写出并读取响应
+    void publishTask();
+    // 流水线发送batch中[begin, end)的命令
+    void pipeline(const std::vector<PublishItem> &batch, size_t begin, size_t end);
+    // 没有送达的路由通道消息放入重发列表，超过重发时间交给业务层
+    void retryLater(const PublishItem &item);
+    // 处理订阅连接上收到的一个响应
+    void dispatch(redisReply *reply);
+    // 订阅连接断开后按退避间隔重连，并重新订阅所有通道，停止时返回false
+    bool resubscribe();
+    // 检查命令连接，出错后重连，调用时持有_command_mutex
+    bool ensureCommandContext();
+
+    // hiredis同步上下文对象,负责publish消息，只在发送线程中使用
     redisContext *_publish_context;
 
+    // 业务线程提交命令的队列，发送线程每次整体交换出来
+    std::mutex _publish_mutex;
+    std::condition_variable _publish_cv;
+    std::vector<PublishItem> _publish_queue;
+    bool _running;
+    std::thread _publish_thread;
+    // 等待重发的命令，只在发送线程中使用
+    std::vector<PublishItem> _retry_queue;
+    // 一次流水线写出的命令中除消息内容以外的部分、各段的起始位置和writev的iovec，只在发送线程中使用，复用内存
+    std::string _pipeline_buffer;
+    std::vector<size_t> _pipeline_offsets;
+    std::vector<struct iovec> _pipeline_iov;
+
+    std::atomic<long long> _published;
+    std::atomic<long long> _failed;
+    std::atomic<long long> _rejected;
+    std::atomic<long long> _retried;
+    std::atomic<long long> _undelivered;
+    std::atomic<long long> _batches;
+    std::atomic<long long> _totalLatencyUs;
+    std::atomic<long long> _maxLatencyUs;
+    // 从提交到收到响应的时延分布
+    Histogram *_publishLatency;
+
     // hiredis同步上下文对象,负责subscribe消息
     redisContext *_subscribe_context;
+    // 保护订阅上下文的替换和订阅命令的发送，以及已经订阅的通道列表
+    std::mutex _subscribe_mutex;
+    std::vector<std::string> _channels;
+    // 订阅线程，停止时关闭订阅连接唤醒阻塞的读取
+    std::thread _subscribe_thread;
+    bool _stopping;
+    // 唤醒重连退避等待中的订阅线程
+    std::condition_variable _subscribe_cv;
+
+    std::atomic<long long> _messages;
+    std::atomic<long long> _confirmations;
+    std::atomic<long long> _reconnects;
+    std::atomic<long long> _totalGapMs;
+    std::atomic<long long> _maxGapMs;
+    std::atomic<bool> _subscribed;
+    // 业务层处理路由通道消息的耗时，处理期间订阅连接不读取新的消息
+    Histogram *_notifyLatency;
+
+    // hiredis同步上下文对象,负责位置目录的读写
+    redisContext *_command_context;
+    std::mutex _command_mutex;
+    // 位置目录各命令的耗时，包括等待命令连接的时间
+    Histogram *_setLocationLatency;
+    Histogram *_removeLocationLatency;
+    Histogram *_getLocationLatency;
+    Histogram *_getLocationsLatency;
+    Histogram *_claimLocationLatency;
+    Histogram *_heartbeatLatency;
+
+    // 回调操作,收到路由通道的消息,给service层上报
+    std::function<void(std::string_view)> _notify_message_handler;
+
+    // 回调操作,收到控制通道的消息,给service层上报
+    std::function<void(std::string, std::string)> _control_message_handler;
+
+    // 回调操作,订阅连接重连成功,给service层上报
+    std::function<void()> _reconnect_handler;
 
-    // 回调操作,收到订阅消息,给service层上报
-    std::function<void(int, std::string)> _notify_message_handler;
+    // 回调操作,路由通道消息无法送达,给service层上报
+    std::function<void(const std::string &, std::shared_ptr<const std::string>)> _undelivered_handler;
 };
 
-#endif
\ No newline at end of file
+#endif
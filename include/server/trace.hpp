@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// 请求内各阶段的耗时追踪
+// 业务线程处理一条消息时开启一次请求追踪，请求内的TraceSpan把阶段的起止时间写入线程局部的环形缓冲区
+// 使用时间戳计数器计时，不加锁也不分配内存；请求耗时超过阈值时输出完整的阶段分解，否则直接丢弃
+class Trace
+{
+public:
+    // 设置慢请求的阈值(us)，0表示关闭追踪，第一次调用时校准时间戳计数器
+    static void setSlowThresholdUs(long long us);
+    static long long slowThresholdUs();
+
+    // 读取时间戳计数器
+    static uint64_t now();
+    // 时间戳计数器每微秒的计数
+    static double ticksPerUs();
+    // 保存阶段名字，返回的指针在进程运行期间有效，用于运行时生成的名字
+    static const char *intern(const std::string &name);
+
+    // 开始和结束当前线程上的一次请求追踪
+    static void beginRequest(int msgid);
+    static void endRequest();
+    // 开始和结束一个阶段，没有进行中的请求时什么都不做
+    static int beginSpan(const char *name);
+    static void endSpan(int index);
+};
+
+// 一次请求追踪的作用域
+class RequestTrace
+{
+public:
+    explicit RequestTrace(int msgid) { Trace::beginRequest(msgid); }
+    ~RequestTrace() { Trace::endRequest(); }
+
+    RequestTrace(const RequestTrace &) = delete;
+    RequestTrace &operator=(const RequestTrace &) = delete;
+};
+
+// 请求内一个阶段的作用域，name必须在请求结束之前有效，通常是字符串常量
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name) : _index(Trace::beginSpan(name)) {}
+    ~TraceSpan() { Trace::endSpan(_index); }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    int _index;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// 追踪从这里到作用域结束的耗时
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#endif
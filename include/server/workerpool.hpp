@@ -0,0 +1,72 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+#include <condition_variable>
+
+// 业务线程池运行统计
+struct WorkerPoolStats
+{
+    long long queueDepth = 0;     // 当前排队等待执行的任务数
+    long long maxQueueDepth = 0;  // 历史最大排队任务数
+    long long tasks = 0;          // 累计执行完成的任务数
+    long long totalQueueUs = 0;   // 任务累计排队耗时(us)
+    long long totalHandleUs = 0;  // 任务累计执行耗时(us)
+    long long maxHandleUs = 0;    // 任务最大执行耗时(us)
+};
+
+// 业务线程池
+// 把会阻塞的数据库、redis操作从muduo的I/O线程中剥离出来
+// 相同key的任务总是投递到同一个线程中串行执行，保证同一个用户消息的先后顺序
+class WorkerPool
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkerPool(const std::string &name);
+    ~WorkerPool();
+
+    // 启动threadNum个业务线程，threadNum为0时任务直接在调用线程中执行
+    void start(int threadNum);
+    // 停止所有业务线程，已经投递的任务执行完再退出
+    void stop();
+    // 按key投递任务
+    void dispatch(size_t key, Task task);
+    // 获取线程池的统计信息
+    WorkerPoolStats getStats();
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::pair<Task, std::chrono::steady_clock::time_point>> tasks;
+        std::thread thread;
+    };
+
+    // 业务线程的执行函数
+    void runInThread(Worker *worker);
+    // 执行一个任务并统计耗时
+    void runTask(const Task &task);
+
+    std::string _name;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic_bool _running;
+
+    std::atomic<long long> _queueDepth;
+    std::atomic<long long> _maxQueueDepth;
+    std::atomic<long long> _tasks;
+    std::atomic<long long> _totalQueueUs;
+    std::atomic<long long> _totalHandleUs;
+    std::atomic<long long> _maxHandleUs;
+};
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef WIREFORMAT_H
+#define WIREFORMAT_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "json.hpp"
+#include "public.hpp"
+#include "codec.hpp"
+
+/*
+server和client公共的二进制消息格式，帧头部的flags为FRAME_FLAG_BINARY时使用
+| 字段存在位图(varint) | 存在的字段，按schema中的顺序排列 |
+整数:       zigzag编码的varint
+布尔:       1字节
+字符串:     长度(varint) + 数据
+字符串列表: 个数(varint) + 每个字符串
+整数列表:   个数(varint) + 每个zigzag编码的varint
+msgid由帧头部携带，不在payload中重复，解码后补回json的msgid字段
+schema中没有的字段不编码，好友、群组、离线消息这些嵌套的记录仍然是json字符串，按字符串列表编码
+*/
+
+// 字段类型
+enum EnWireFieldType
+{
+    WIRE_FIELD_INT = 0,
+    WIRE_FIELD_BOOL,
+    WIRE_FIELD_STRING,
+    WIRE_FIELD_STRINGS,
+    WIRE_FIELD_INTS,
+};
+
+// schema中的一个字段
+struct WireField
+{
+    const char *name;
+    EnWireFieldType type;
+};
+
+// 一种消息类型的全部字段
+struct WireSchema
+{
+    const WireField *fields;
+    size_t count;
+};
+
+// 所有消息类型的schema，字段的位置就是它在存在位图中的位置
+// 修改时只能在末尾追加字段，不能删除或者调整顺序，否则新旧版本之间无法互通
+#define WIRE_MESSAGES(MSG, FIELD)                                                                  \
+    MSG(LOGIN_MSG, FIELD(id, INT) FIELD(password, STRING) FIELD(offlineSync, BOOL)                 \
+                       FIELD(lazyGroups, BOOL) FIELD(friendsVersion, INT))                         \
+    MSG(LOGIN_MSG_ACK, FIELD(errno, INT) FIELD(errmsg, STRING) FIELD(id, INT) FIELD(name, STRING)  \
+                           FIELD(offlineSync, BOOL) FIELD(offLineMsg, STRINGS)                     \
+                               FIELD(friends, STRINGS) FIELD(groups, STRINGS)                      \
+                                   FIELD(friendsVersion, INT) FIELD(friendsDelta, BOOL)            \
+                                       FIELD(onlineFriends, INTS))                                 \
+    MSG(LOGINOUT_MSG, FIELD(id, INT))                                                              \
+    MSG(REG_MSG, FIELD(name, STRING) FIELD(password, STRING))                                      \
+    MSG(REG_MSG_ACK, FIELD(errno, INT) FIELD(id, INT))                                             \
+    MSG(ONE_CHAT_MSG, FIELD(id, INT) FIELD(name, STRING) FIELD(to, INT) FIELD(msg, STRING)         \
+                          FIELD(time, STRING))                                                     \
+    MSG(ADD_FRIEND_MSG, FIELD(id, INT) FIELD(friendid, INT))                                       \
+    MSG(CREATE_GROUP_MSG, FIELD(id, INT) FIELD(groupname, STRING) FIELD(groupdesc, STRING))        \
+    MSG(ADD_GROUP_MSG, FIELD(id, INT) FIELD(groupid, INT))                                         \
+    MSG(GROUP_CHAT_MSG, FIELD(id, INT) FIELD(name, STRING) FIELD(groupid, INT)                     \
+                            FIELD(msg, STRING) FIELD(time, STRING))                                \
+    MSG(OFFLINE_MSG_PAGE, FIELD(msgs, STRINGS) FIELD(cursor, INT) FIELD(more, BOOL))               \
+    MSG(OFFLINE_MSG_ACK, FIELD(cursor, INT))                                                       \
+    MSG(QUERY_GROUP_USERS_MSG, FIELD(groupid, INT))                                                \
+    MSG(QUERY_GROUP_USERS_MSG_ACK, FIELD(groupid, INT) FIELD(errno, INT) FIELD(errmsg, STRING)     \
+                                       FIELD(users, STRINGS))
+
+// 由schema生成每种消息类型的字段表
+#define WIRE_FIELD_ENTRY(name, type) WireField{#name, WIRE_FIELD_##type},
+#define WIRE_FIELD_TABLE(msg, fields)                             \
+    inline constexpr WireField kWireFields_##msg[] = {fields};    \
+    static_assert(sizeof(kWireFields_##msg) / sizeof(WireField) <= 64, \
+                  #msg " has too many fields");
+WIRE_MESSAGES(WIRE_FIELD_TABLE, WIRE_FIELD_ENTRY)
+#undef WIRE_FIELD_TABLE
+
+// 由schema生成消息id到字段表的索引，没有schema的消息id为空
+struct WireSchemaTable
+{
+    WireSchema schemas[MSG_TYPE_MAX];
+};
+
+inline constexpr WireSchemaTable makeWireSchemaTable()
+{
+    WireSchemaTable table{};
+#define WIRE_SCHEMA_ENTRY(msg, fields) \
+    table.schemas[msg] = WireSchema{kWireFields_##msg, sizeof(kWireFields_##msg) / sizeof(WireField)};
+    WIRE_MESSAGES(WIRE_SCHEMA_ENTRY, WIRE_FIELD_ENTRY)
+#undef WIRE_SCHEMA_ENTRY
+    return table;
+}
+
+inline constexpr WireSchemaTable kWireSchemaTable = makeWireSchemaTable();
+
+#undef WIRE_FIELD_ENTRY
+
+// 获取消息类型的schema，没有schema返回nullptr
+inline const WireSchema *wireSchema(int msgid)
+{
+    if (msgid <= 0 || msgid >= MSG_TYPE_MAX || kWireSchemaTable.schemas[msgid].fields == nullptr)
+    {
+        return nullptr;
+    }
+    return &kWireSchemaTable.schemas[msgid];
+}
+
+// 追加一个varint
+inline void appendVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// 读取一个varint，数据不完整或者超过64位返回false
+inline bool readVarint(const char *&p, const char *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 追加一个长度前缀的字符串
+inline void appendWireString(std::string &out, const std::string &value)
+{
+    appendVarint(out, value.size());
+    out.append(value);
+}
+
+// 读取一个长度前缀的字符串
+inline bool readWireString(const char *&p, const char *end, std::string &value)
+{
+    uint64_t len = 0;
+    if (!readVarint(p, end, len) || len > static_cast<uint64_t>(end - p))
+    {
+        return false;
+    }
+    value.assign(p, len);
+    p += len;
+    return true;
+}
+
+// 追加一个zigzag编码的整数
+inline void appendWireInt(std::string &out, int64_t value)
+{
+    appendVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+// 读取一个zigzag编码的整数
+inline bool readWireInt(const char *&p, const char *end, int64_t &value)
+{
+    uint64_t v = 0;
+    if (!readVarint(p, end, v))
+    {
+        return false;
+    }
+    value = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    return true;
+}
+
+// 按schema把json对象编码成二进制payload，追加到out
+// msgid没有schema或者字段的类型和schema不符时返回false，调用者改用json格式
+inline bool encodeWirePayload(int msgid, const nlohmann::json &js, std::string &out)
+{
+    const WireSchema *schema = wireSchema(msgid);
+    if (schema == nullptr || !js.is_object())
+    {
+        return false;
+    }
+
+    const nlohmann::json *values[64];
+    uint64_t present = 0;
+    for (size_t i = 0; i < schema->count; ++i)
+    {
+        auto it = js.find(schema->fields[i].name);
+        values[i] = (it != js.end() && !it->is_null()) ? &*it : nullptr;
+        if (values[i] != nullptr)
+        {
+            present |= 1ull << i;
+        }
+    }
+
+    appendVarint(out, present);
+    for (size_t i = 0; i < schema->count; ++i)
+    {
+        const nlohmann::json *value = values[i];
+        if (value == nullptr)
+        {
+            continue;
+        }
+        switch (schema->fields[i].type)
+        {
+        case WIRE_FIELD_INT:
+        {
+            if (!value->is_number_integer())
+            {
+                return false;
+            }
+            appendWireInt(out, value->get<int64_t>());
+            break;
+        }
+        case WIRE_FIELD_BOOL:
+            if (!value->is_boolean())
+            {
+                return false;
+            }
+            out.push_back(value->get<bool>() ? 1 : 0);
+            break;
+        case WIRE_FIELD_STRING:
+            if (!value->is_string())
+            {
+                return false;
+            }
+            appendWireString(out, value->get_ref<const std::string &>());
+            break;
+        case WIRE_FIELD_STRINGS:
+            if (!value->is_array())
+            {
+                return false;
+            }
+            appendVarint(out, value->size());
+            for (const nlohmann::json &item : *value)
+            {
+                if (!item.is_string())
+                {
+                    return false;
+                }
+                appendWireString(out, item.get_ref<const std::string &>());
+            }
+            break;
+        case WIRE_FIELD_INTS:
+            if (!value->is_array())
+            {
+                return false;
+            }
+            appendVarint(out, value->size());
+            for (const nlohmann::json &item : *value)
+            {
+                if (!item.is_number_integer())
+                {
+                    return false;
+                }
+                appendWireInt(out, item.get<int64_t>());
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+// 按schema把二进制payload解码成json对象，数据不完整或者和schema不符返回false
+inline bool decodeWirePayload(int msgid, const char *data, size_t len, nlohmann::json &js)
+{
+    const WireSchema *schema = wireSchema(msgid);
+    if (schema == nullptr)
+    {
+        return false;
+    }
+    const char *p = data;
+    const char *end = data + len;
+    uint64_t present = 0;
+    if (!readVarint(p, end, present) || (schema->count < 64 && (present >> schema->count) != 0))
+    {
+        return false;
+    }
+
+    js = nlohmann::json::object();
+    js["msgid"] = msgid;
+    for (size_t i = 0; i < schema->count; ++i)
+    {
+        if ((present & (1ull << i)) == 0)
+        {
+            continue;
+        }
+        const char *name = schema->fields[i].name;
+        switch (schema->fields[i].type)
+        {
+        case WIRE_FIELD_INT:
+        {
+            int64_t v = 0;
+            if (!readWireInt(p, end, v))
+            {
+                return false;
+            }
+            js[name] = v;
+            break;
+        }
+        case WIRE_FIELD_BOOL:
+            if (p == end)
+            {
+                return false;
+            }
+            js[name] = *p++ != 0;
+            break;
+        case WIRE_FIELD_STRING:
+        {
+            std::string value;
+            if (!readWireString(p, end, value))
+            {
+                return false;
+            }
+            js[name] = std::move(value);
+            break;
+        }
+        case WIRE_FIELD_STRINGS:
+        {
+            uint64_t count = 0;
+            // 每个字符串至少占1字节，个数不可能超过剩余的字节数
+            if (!readVarint(p, end, count) || count > static_cast<uint64_t>(end - p))
+            {
+                return false;
+            }
+            nlohmann::json items = nlohmann::json::array();
+            for (uint64_t n = 0; n < count; ++n)
+            {
+                std::string value;
+                if (!readWireString(p, end, value))
+                {
+                    return false;
+                }
+                items.push_back(std::move(value));
+            }
+            js[name] = std::move(items);
+            break;
+        }
+        case WIRE_FIELD_INTS:
+        {
+            uint64_t count = 0;
+            // 每个整数至少占1字节
+            if (!readVarint(p, end, count) || count > static_cast<uint64_t>(end - p))
+            {
+                return false;
+            }
+            nlohmann::json items = nlohmann::json::array();
+            for (uint64_t n = 0; n < count; ++n)
+            {
+                int64_t v = 0;
+                if (!readWireInt(p, end, v))
+                {
+                    return false;
+                }
+                items.push_back(v);
+            }
+            js[name] = std::move(items);
+            break;
+        }
+        }
+    }
+    return p == end;
+}
+
+// 把一条消息编码成二进制格式的完整帧，msgid没有schema或者字段类型不符时返回false
+inline bool encodeWireFrame(int msgid, const nlohmann::json &js, std::string &frame)
+{
+    frame.assign(kFrameHeaderLen, '\0');
+    if (!encodeWirePayload(msgid, js, frame))
+    {
+        return false;
+    }
+    encodeFrameHeader(&frame[0], FrameHeader{static_cast<uint32_t>(frame.size() - kFrameHeaderLen),
+                                             static_cast<uint16_t>(msgid), FRAME_FLAG_BINARY});
+    return true;
+}
+
+#endif
@@ -0,0 +1,1090 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "json.hpp"
+#include "public.hpp"
+#include "codec.hpp"
+#include "wireformat.hpp"
+
+using json = nlohmann::json;
+
+/*
+聊天服务器的压测客户端
+每个线程使用一个epoll管理一部分连接，连接建立后先注册新用户再登录，
+然后按配置的总速率和比例随机选择在线的连接发起注册、单聊、群聊和注销，注销的连接下次被选中时重新登录
+注册和登录统计请求到响应的时延，单聊和群聊在消息内容中携带发送时间，统计发送到接收者收到的端到端时延
+*/
+
+// 压测的操作类型
+enum EnBenchOp
+{
+    OP_REGISTER = 0,
+    OP_LOGIN,
+    OP_ONE_CHAT,
+    OP_GROUP_CHAT,
+    OP_LOGOUT,
+    OP_RECONNECT,
+    OP_COUNT,
+};
+
+static const char *kOpNames[OP_COUNT] = {"register", "login", "onechat", "groupchat", "logout", "reconnect"};
+
+// 聊天消息内容的前缀，后面是发送时间(us)
+static const char *kBenchMsgPrefix = "bench:";
+
+// 压测配置
+struct BenchConfig
+{
+    std::string ip;
+    uint16_t port = 0;
+    int connections = 1000; // 连接总数
+    int threads = 4;        // 压测线程数
+    int duration = 60;      // 压测时长(s)
+    double rate = 1000;     // 所有连接合计每秒发起的操作数
+    double connectRate = 2000; // 每秒新建的连接数
+    int groupid = 0;           // 群聊使用的群组，0表示不压测群聊
+    bool binary = false;       // 使用二进制格式的消息帧
+    std::string password = "bench";
+    // 各操作被选中的权重，登录不单独配置，注销的连接再次被选中时重新登录
+    int weights[OP_COUNT] = {5, 0, 80, 10, 5, 0};
+};
+
+// 时延直方图，log-linear分桶: 每个2的幂区间再等分成32个桶，相对误差不超过约3%
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() : _buckets(kBucketCount, 0), _count(0), _max(0) {}
+
+    // 记录一次时延(us)
+    void record(int64_t us)
+    {
+        if (us < 0)
+        {
+            us = 0;
+        }
+        ++_buckets[bucketIndex(static_cast<uint64_t>(us))];
+        ++_count;
+        _max = std::max(_max, us);
+    }
+
+    // 合并其它线程的直方图
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < _buckets.size(); ++i)
+        {
+            _buckets[i] += other._buckets[i];
+        }
+        _count += other._count;
+        _max = std::max(_max, other._max);
+    }
+
+    // 获取百分位数(us)，返回所在桶的上界
+    int64_t percentile(double p) const
+    {
+        if (_count == 0)
+        {
+            return 0;
+        }
+        long long target = static_cast<long long>(p * _count);
+        if (target >= _count)
+        {
+            target = _count - 1;
+        }
+        long long seen = 0;
+        for (size_t i = 0; i < _buckets.size(); ++i)
+        {
+            seen += _buckets[i];
+            if (seen > target)
+            {
+                return std::min(bucketUpper(i), _max);
+            }
+        }
+        return _max;
+    }
+
+    long long count() const { return _count; }
+    int64_t max() const { return _max; }
+
+private:
+    static const int kSubBits = 5;
+    static const uint64_t kSubCount = 1 << kSubBits;
+    static const size_t kBucketCount = 64 * kSubCount;
+
+    static size_t bucketIndex(uint64_t value)
+    {
+        if (value < kSubCount)
+        {
+            return value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - kSubBits;
+        return (shift + 1) * kSubCount + ((value >> shift) - kSubCount);
+    }
+
+    static int64_t bucketUpper(size_t index)
+    {
+        if (index < kSubCount)
+        {
+            return index;
+        }
+        int shift = index / kSubCount - 1;
+        uint64_t sub = index % kSubCount + kSubCount;
+        return static_cast<int64_t>(((sub + 1) << shift) - 1);
+    }
+
+    std::vector<long long> _buckets;
+    long long _count;
+    int64_t _max;
+};
+
+// 一种操作的统计，计数器由主线程周期性读取，直方图只在所属线程中写入，压测结束后合并
+struct OpStats
+{
+    std::atomic<long long> sent{0};     // 发出的请求数
+    std::atomic<long long> received{0}; // 收到的响应数或者消息的投递数
+    std::atomic<long long> errors{0};   // 失败的响应数
+    LatencyHistogram latency;
+};
+
+// 连接的状态
+enum EnConnState
+{
+    CONN_IDLE = 0,    // 还没有建立连接
+    CONN_CONNECTING,  // 正在建立连接
+    CONN_REGISTERING, // 等待注册响应
+    CONN_LOGGING_IN,  // 等待登录响应
+    CONN_ONLINE,      // 已经登录
+    CONN_OFFLINE,     // 已经注销，等待重新登录
+    CONN_CLOSED,      // 连接已经关闭
+};
+
+// 一条压测连接，只在所属线程中访问
+struct BenchConn
+{
+    int fd = -1;
+    int index = 0; // 在所有连接中的序号
+    int userid = 0;
+    std::string name;
+    EnConnState state = CONN_IDLE;
+    bool joinedGroup = false;
+    bool writing = false; // 输出缓冲区有数据，正在等待可写事件
+    std::string input;
+    std::string output;
+    // 还没有收到响应的注册和登录请求的发送时间，同一条连接上的响应按顺序返回
+    std::deque<int64_t> pendingReg;
+    std::deque<int64_t> pendingLogin;
+    // 断线重连开始的时间，重新登录成功之前不为0
+    int64_t reconnectUs = 0;
+    // 本次登录收到的最后一页离线消息的cursor
+    long long offlineCursor = 0;
+};
+
+// 压测是否结束
+static std::atomic<bool> g_stop{false};
+// 每条连接上当前在线的用户id，不在线为0，用于选择单聊的接收者
+static std::unique_ptr<std::atomic<int>[]> g_onlineIds;
+
+// 获取单调时钟的当前时间(us)，所有线程使用同一个时钟，接收者可以直接计算端到端时延
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// 压测线程，管理[first, first+count)的连接
+class BenchWorker
+{
+public:
+    BenchWorker(const BenchConfig &config, int first, int count, unsigned seed)
+        : _config(config), _conns(count), _random(seed), _epfd(-1), _opened(0), _tokens(0),
+          _connected(0), _online(0), _connectFailed(0), _closed(0),
+          _offlinePages(0), _offlineMsgs(0), _offlineErrors(0)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            _conns[i].index = first + i;
+        }
+        for (int i = 0; i < OP_COUNT; ++i)
+        {
+            _totalWeight += _config.weights[i];
+        }
+    }
+
+    void start()
+    {
+        _thread = std::thread(&BenchWorker::run, this);
+    }
+
+    void join()
+    {
+        _thread.join();
+    }
+
+    OpStats &stats(int op) { return _stats[op]; }
+    long long connected() const { return _connected; }
+    long long online() const { return _online; }
+    long long connectFailed() const { return _connectFailed; }
+    long long closed() const { return _closed; }
+    long long offlinePages() const { return _offlinePages; }
+    long long offlineMsgs() const { return _offlineMsgs; }
+    long long offlineErrors() const { return _offlineErrors; }
+
+private:
+    // 线程函数，处理网络事件，按速率建立连接和发起操作
+    void run()
+    {
+        _epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (_epfd < 0)
+        {
+            std::cerr << "epoll_create1 error:" << strerror(errno) << std::endl;
+            return;
+        }
+        _startUs = nowUs();
+        _lastFireUs = _startUs;
+
+        std::vector<epoll_event> events(1024);
+        while (!g_stop)
+        {
+            int n = epoll_wait(_epfd, events.data(), events.size(), 1);
+            int64_t now = nowUs();
+            for (int i = 0; i < n; ++i)
+            {
+                handleEvent(*static_cast<BenchConn *>(events[i].data.ptr), events[i].events, now);
+            }
+            openConnections(now);
+            fireOps(now);
+        }
+
+        // 压测结束，注销在线的用户后关闭所有连接
+        for (BenchConn &conn : _conns)
+        {
+            if (conn.state == CONN_ONLINE)
+            {
+                json js;
+                js["msgid"] = LOGINOUT_MSG;
+                js["id"] = conn.userid;
+                sendMsg(conn, LOGINOUT_MSG, js);
+            }
+            if (conn.fd >= 0)
+            {
+                ::close(conn.fd);
+                conn.fd = -1;
+            }
+        }
+        ::close(_epfd);
+    }
+
+    // 按建立连接的速率打开新的连接
+    void openConnections(int64_t now)
+    {
+        double perThread = _config.connectRate / _config.threads;
+        size_t target = static_cast<size_t>((now - _startUs) * perThread / 1000000) + 1;
+        while (_opened < _conns.size() && _opened < target)
+        {
+            openConnection(_conns[_opened++]);
+        }
+    }
+
+    // 非阻塞方式建立连接，连接结果由可写事件通知
+    void openConnection(BenchConn &conn)
+    {
+        conn.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (conn.fd < 0)
+        {
+            connectFailed(conn);
+            conn.state = CONN_CLOSED;
+            return;
+        }
+        int on = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+        sockaddr_in server;
+        memset(&server, 0, sizeof server);
+        server.sin_family = AF_INET;
+        server.sin_port = htons(_config.port);
+        server.sin_addr.s_addr = inet_addr(_config.ip.c_str());
+        if (::connect(conn.fd, reinterpret_cast<sockaddr *>(&server), sizeof server) < 0 && errno != EINPROGRESS)
+        {
+            connectFailed(conn);
+            ::close(conn.fd);
+            conn.fd = -1;
+            conn.state = CONN_CLOSED;
+            return;
+        }
+        conn.state = CONN_CONNECTING;
+        conn.writing = true;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.ptr = &conn;
+        epoll_ctl(_epfd, EPOLL_CTL_ADD, conn.fd, &ev);
+    }
+
+    // 处理一条连接上的事件
+    void handleEvent(BenchConn &conn, uint32_t events, int64_t now)
+    {
+        if (conn.state == CONN_CONNECTING)
+        {
+            int err = 0;
+            socklen_t len = sizeof err;
+            getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0 || (events & (EPOLLERR | EPOLLHUP)))
+            {
+                connectFailed(conn);
+                closeConn(conn, false);
+                return;
+            }
+            if ((events & EPOLLOUT) == 0)
+            {
+                return;
+            }
+            if (conn.reconnectUs != 0)
+            {
+                // 断线重连，不重新注册，直接用原来的用户登录
+                conn.state = CONN_LOGGING_IN;
+                sendLogin(conn, now);
+                updateWriting(conn);
+                return;
+            }
+            // 连接建立，注册一个新用户
+            ++_connected;
+            conn.name = "bench_" + std::to_string(getpid()) + "_" + std::to_string(conn.index);
+            conn.state = CONN_REGISTERING;
+            sendRegister(conn, conn.name, now);
+            updateWriting(conn);
+            return;
+        }
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        {
+            if (!readConn(conn, now))
+            {
+                closeConn(conn, true);
+                return;
+            }
+        }
+        if ((events & EPOLLOUT) && conn.fd >= 0)
+        {
+            flush(conn);
+        }
+    }
+
+    // 读取连接上的数据，逐条处理完整的消息帧，连接关闭或者出错返回false
+    bool readConn(BenchConn &conn, int64_t now)
+    {
+        char buffer[65536];
+        for (;;)
+        {
+            ssize_t n = ::recv(conn.fd, buffer, sizeof buffer, 0);
+            if (n > 0)
+            {
+                conn.input.append(buffer, n);
+                continue;
+            }
+            if (n == 0)
+            {
+                return false;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return false;
+        }
+
+        size_t pos = 0;
+        while (conn.input.size() - pos >= kFrameHeaderLen)
+        {
+            FrameHeader header = decodeFrameHeader(conn.input.data() + pos);
+            if (header.length > kMaxFrameLen)
+            {
+                std::cerr << "invalid frame length:" << header.length << std::endl;
+                return false;
+            }
+            if (conn.input.size() - pos < kFrameHeaderLen + header.length)
+            {
+                break;
+            }
+            const char *payload = conn.input.data() + pos + kFrameHeaderLen;
+            json js;
+            bool ok = true;
+            if (header.flags == FRAME_FLAG_BINARY)
+            {
+                ok = decodeWirePayload(header.msgid, payload, header.length, js);
+            }
+            else
+            {
+                js = json::parse(payload, payload + header.length, nullptr, false);
+                ok = !js.is_discarded();
+            }
+            pos += kFrameHeaderLen + header.length;
+            if (!ok)
+            {
+                std::cerr << "invalid message, msgid:" << header.msgid << std::endl;
+                continue;
+            }
+            handleMessage(conn, header.msgid, js, now);
+            if (conn.fd < 0)
+            {
+                return true;
+            }
+        }
+        conn.input.erase(0, pos);
+        updateWriting(conn);
+        return true;
+    }
+
+    // 处理服务器发来的一条消息
+    void handleMessage(BenchConn &conn, int msgid, const json &js, int64_t now)
+    {
+        switch (msgid)
+        {
+        case REG_MSG_ACK:
+        {
+            recordResponse(OP_REGISTER, conn.pendingReg, js, now);
+            if (conn.state != CONN_REGISTERING)
+            {
+                // 在线期间发起的注册只统计时延
+                break;
+            }
+            if (js.value("errno", -1) != 0)
+            {
+                closeConn(conn, true);
+                break;
+            }
+            conn.userid = js["id"].get<int>();
+            conn.state = CONN_LOGGING_IN;
+            sendLogin(conn, now);
+            break;
+        }
+        case LOGIN_MSG_ACK:
+        {
+            bool ok = recordResponse(OP_LOGIN, conn.pendingLogin, js, now);
+            if (conn.reconnectUs != 0)
+            {
+                // 重连的时延从断开连接开始计算，服务器还没有处理完旧连接的断开时登录会失败
+                OpStats &stats = _stats[OP_RECONNECT];
+                ++stats.received;
+                if (ok)
+                {
+                    stats.latency.record(now - conn.reconnectUs);
+                }
+                else
+                {
+                    ++stats.errors;
+                }
+                conn.reconnectUs = 0;
+            }
+            if (!ok)
+            {
+                // 登录失败的连接下次被选中时重试
+                conn.state = CONN_OFFLINE;
+                break;
+            }
+            conn.state = CONN_ONLINE;
+            conn.offlineCursor = 0;
+            g_onlineIds[conn.index] = conn.userid;
+            ++_online;
+            if (_config.groupid != 0 && !conn.joinedGroup)
+            {
+                // 第一次登录后加入压测的群组
+                json request;
+                request["msgid"] = ADD_GROUP_MSG;
+                request["id"] = conn.userid;
+                request["groupid"] = _config.groupid;
+                sendMsg(conn, ADD_GROUP_MSG, request);
+                conn.joinedGroup = true;
+            }
+            break;
+        }
+        case ONE_CHAT_MSG:
+            recordDelivery(OP_ONE_CHAT, js, now);
+            break;
+        case GROUP_CHAT_MSG:
+            recordDelivery(OP_GROUP_CHAT, js, now);
+            break;
+        case OFFLINE_MSG_PAGE:
+        {
+            // 注销期间收到的消息分页推送过来，确认之后服务器推送下一页
+            // 每页至少有一条消息，同一次登录中cursor严格递增，否则是分页出错，重复或者漏掉了消息
+            long long cursor = js.value("cursor", 0LL);
+            size_t msgs = js.contains("msgs") && js["msgs"].is_array() ? js["msgs"].size() : 0;
+            ++_offlinePages;
+            _offlineMsgs += msgs;
+            if (msgs == 0 || cursor <= conn.offlineCursor)
+            {
+                ++_offlineErrors;
+            }
+            conn.offlineCursor = std::max(conn.offlineCursor, cursor);
+            json ack;
+            ack["msgid"] = OFFLINE_MSG_ACK;
+            ack["cursor"] = js["cursor"];
+            sendMsg(conn, OFFLINE_MSG_ACK, ack);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // 统计注册和登录的响应，返回响应是否成功
+    bool recordResponse(int op, std::deque<int64_t> &pending, const json &js, int64_t now)
+    {
+        OpStats &stats = _stats[op];
+        ++stats.received;
+        if (!pending.empty())
+        {
+            stats.latency.record(now - pending.front());
+            pending.pop_front();
+        }
+        if (js.value("errno", -1) != 0)
+        {
+            ++stats.errors;
+            return false;
+        }
+        return true;
+    }
+
+    // 统计收到的聊天消息，根据消息中携带的发送时间计算端到端时延
+    void recordDelivery(int op, const json &js, int64_t now)
+    {
+        OpStats &stats = _stats[op];
+        ++stats.received;
+        auto it = js.find("msg");
+        if (it == js.end() || !it->is_string())
+        {
+            return;
+        }
+        const std::string &msg = it->get_ref<const std::string &>();
+        size_t prefixLen = strlen(kBenchMsgPrefix);
+        if (msg.compare(0, prefixLen, kBenchMsgPrefix) == 0)
+        {
+            stats.latency.record(now - atoll(msg.c_str() + prefixLen));
+        }
+    }
+
+    // 按速率随机选择连接发起操作
+    void fireOps(int64_t now)
+    {
+        double perThread = _config.rate / _config.threads;
+        _tokens += (now - _lastFireUs) * perThread / 1000000;
+        _lastFireUs = now;
+        // 最多积攒1秒的操作，避免连接建立期间积攒的操作一次性发出
+        _tokens = std::min(_tokens, std::max(perThread, 1.0));
+        if (_totalWeight <= 0 || _opened == 0)
+        {
+            return;
+        }
+        while (_tokens >= 1)
+        {
+            _tokens -= 1;
+            BenchConn *conn = pickConn();
+            if (conn == nullptr)
+            {
+                continue;
+            }
+            if (conn->state == CONN_OFFLINE)
+            {
+                conn->state = CONN_LOGGING_IN;
+                sendLogin(*conn, now);
+            }
+            else
+            {
+                fireOp(*conn, pickOp(), now);
+            }
+            updateWriting(*conn);
+        }
+    }
+
+    // 随机选择一条已经登录或者已经注销的连接，找不到返回nullptr
+    BenchConn *pickConn()
+    {
+        std::uniform_int_distribution<size_t> dist(0, _opened - 1);
+        for (int i = 0; i < 4; ++i)
+        {
+            BenchConn &conn = _conns[dist(_random)];
+            if (conn.state == CONN_ONLINE || conn.state == CONN_OFFLINE)
+            {
+                return &conn;
+            }
+        }
+        return nullptr;
+    }
+
+    // 按权重随机选择一种操作
+    int pickOp()
+    {
+        int value = std::uniform_int_distribution<int>(0, _totalWeight - 1)(_random);
+        for (int op = 0; op < OP_COUNT; ++op)
+        {
+            if (value < _config.weights[op])
+            {
+                return op;
+            }
+            value -= _config.weights[op];
+        }
+        return OP_ONE_CHAT;
+    }
+
+    // 在已经登录的连接上发起一次操作
+    void fireOp(BenchConn &conn, int op, int64_t now)
+    {
+        switch (op)
+        {
+        case OP_REGISTER:
+            sendRegister(conn, conn.name + "_" + std::to_string(++_registerSeq), now);
+            break;
+        case OP_ONE_CHAT:
+        {
+            json js;
+            js["msgid"] = ONE_CHAT_MSG;
+            js["id"] = conn.userid;
+            js["name"] = conn.name;
+            js["to"] = pickReceiver(conn);
+            js["msg"] = kBenchMsgPrefix + std::to_string(now);
+            js["time"] = "bench";
+            ++_stats[OP_ONE_CHAT].sent;
+            sendMsg(conn, ONE_CHAT_MSG, js);
+            break;
+        }
+        case OP_GROUP_CHAT:
+        {
+            json js;
+            js["msgid"] = GROUP_CHAT_MSG;
+            js["id"] = conn.userid;
+            js["name"] = conn.name;
+            js["groupid"] = _config.groupid;
+            js["msg"] = kBenchMsgPrefix + std::to_string(now);
+            js["time"] = "bench";
+            ++_stats[OP_GROUP_CHAT].sent;
+            sendMsg(conn, GROUP_CHAT_MSG, js);
+            break;
+        }
+        case OP_LOGOUT:
+        {
+            // 注销没有响应，先修改状态，发送失败关闭连接时不会重复计数
+            conn.state = CONN_OFFLINE;
+            g_onlineIds[conn.index] = 0;
+            --_online;
+            json js;
+            js["msgid"] = LOGINOUT_MSG;
+            js["id"] = conn.userid;
+            ++_stats[OP_LOGOUT].sent;
+            sendMsg(conn, LOGINOUT_MSG, js);
+            break;
+        }
+        case OP_RECONNECT:
+        {
+            // 不注销直接断开连接，马上重新连接并登录同一个用户，模拟网络闪断后的重连风暴
+            g_onlineIds[conn.index] = 0;
+            --_online;
+            epoll_ctl(_epfd, EPOLL_CTL_DEL, conn.fd, nullptr);
+            ::close(conn.fd);
+            conn.fd = -1;
+            conn.input.clear();
+            conn.output.clear();
+            conn.pendingReg.clear();
+            conn.pendingLogin.clear();
+            conn.reconnectUs = now;
+            ++_stats[OP_RECONNECT].sent;
+            openConnection(conn);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // 建立连接失败，断线重连的失败同时计入重连的错误
+    void connectFailed(BenchConn &conn)
+    {
+        ++_connectFailed;
+        if (conn.reconnectUs != 0)
+        {
+            ++_stats[OP_RECONNECT].errors;
+            conn.reconnectUs = 0;
+        }
+    }
+
+    // 随机选择一个在线的用户作为单聊的接收者，找不到时发给自己
+    int pickReceiver(const BenchConn &conn)
+    {
+        std::uniform_int_distribution<int> dist(0, _config.connections - 1);
+        for (int i = 0; i < 4; ++i)
+        {
+            int userid = g_onlineIds[dist(_random)];
+            if (userid != 0)
+            {
+                return userid;
+            }
+        }
+        return conn.userid;
+    }
+
+    // 发送注册请求
+    void sendRegister(BenchConn &conn, const std::string &name, int64_t now)
+    {
+        json js;
+        js["msgid"] = REG_MSG;
+        js["name"] = name;
+        js["password"] = _config.password;
+        ++_stats[OP_REGISTER].sent;
+        conn.pendingReg.push_back(now);
+        sendMsg(conn, REG_MSG, js);
+    }
+
+    // 发送登录请求
+    void sendLogin(BenchConn &conn, int64_t now)
+    {
+        json js;
+        js["msgid"] = LOGIN_MSG;
+        js["id"] = conn.userid;
+        js["password"] = _config.password;
+        js["offlineSync"] = true;
+        js["lazyGroups"] = true;
+        ++_stats[OP_LOGIN].sent;
+        conn.pendingLogin.push_back(now);
+        sendMsg(conn, LOGIN_MSG, js);
+    }
+
+    // 按配置的格式编码消息，放入输出缓冲区并尽量直接发送
+    void sendMsg(BenchConn &conn, int msgid, const json &js)
+    {
+        std::string frame;
+        if (!_config.binary || !encodeWireFrame(msgid, js, frame))
+        {
+            frame = encodeFrame(msgid, js.dump());
+        }
+        conn.output += frame;
+        flush(conn);
+    }
+
+    // 发送输出缓冲区中的数据
+    void flush(BenchConn &conn)
+    {
+        while (!conn.output.empty() && conn.fd >= 0)
+        {
+            ssize_t n = ::send(conn.fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                conn.output.erase(0, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            closeConn(conn, true);
+            return;
+        }
+    }
+
+    // 输出缓冲区有数据时关注可写事件，发送完之后取消，正在建立的连接一直关注可写事件
+    void updateWriting(BenchConn &conn)
+    {
+        if (conn.fd < 0 || conn.state == CONN_CONNECTING || conn.writing == !conn.output.empty())
+        {
+            return;
+        }
+        conn.writing = !conn.output.empty();
+        epoll_event ev;
+        ev.events = conn.writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.ptr = &conn;
+        epoll_ctl(_epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+    }
+
+    // 关闭连接，不再重连
+    void closeConn(BenchConn &conn, bool counted)
+    {
+        if (conn.fd < 0)
+        {
+            return;
+        }
+        if (conn.state == CONN_ONLINE)
+        {
+            g_onlineIds[conn.index] = 0;
+            --_online;
+        }
+        if (counted)
+        {
+            ++_closed;
+        }
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        ::close(conn.fd);
+        conn.fd = -1;
+        conn.state = CONN_CLOSED;
+        conn.output.clear();
+        conn.input.clear();
+    }
+
+    const BenchConfig &_config;
+    std::vector<BenchConn> _conns;
+    std::mt19937 _random;
+    int _epfd;
+    size_t _opened; // 已经打开的连接数
+    int64_t _startUs;
+    int64_t _lastFireUs;
+    double _tokens; // 当前可以发起的操作数
+    int _totalWeight = 0;
+    long long _registerSeq = 0;
+    std::thread _thread;
+
+    OpStats _stats[OP_COUNT];
+    std::atomic<long long> _connected;
+    std::atomic<long long> _online;
+    std::atomic<long long> _connectFailed;
+    std::atomic<long long> _closed;
+    std::atomic<long long> _offlinePages;  // 收到的离线消息页数
+    std::atomic<long long> _offlineMsgs;   // 收到的离线消息条数
+    std::atomic<long long> _offlineErrors; // 空页或者cursor没有递增的页数
+};
+
+// 解析操作比例 register=5,onechat=80,groupchat=10,logout=5
+static bool parseMix(const std::string &mix, int weights[OP_COUNT])
+{
+    std::fill(weights, weights + OP_COUNT, 0);
+    std::stringstream ss(mix);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = item.substr(0, eq);
+        int op = std::find(kOpNames, kOpNames + OP_COUNT, name) - kOpNames;
+        if (op == OP_COUNT || op == OP_LOGIN)
+        {
+            return false;
+        }
+        weights[op] = atoi(item.c_str() + eq + 1);
+    }
+    return true;
+}
+
+static void usage()
+{
+    std::cerr << "usage: ./ChatBench ip port [-c connections] [-t threads] [-d seconds]\n"
+                 "                   [-r ops_per_second] [-C connects_per_second] [-g groupid]\n"
+                 "                   [-m register=5,onechat=80,groupchat=10,logout=5] [-p password] [-b]\n"
+                 "  -b  use the binary wire format instead of json\n"
+                 "  -g  group used by groupchat, every connection joins it after the first login\n"
+                 "  reconnect closes an online connection without logout, then reconnects and logs in as the same user\n"
+                 "  a logged out connection logs in again the next time it is picked"
+              << std::endl;
+}
+
+// 提高进程可以打开的文件描述符数量
+static void raiseFileLimit(int connections)
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    {
+        return;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < static_cast<rlim_t>(connections) + 64)
+    {
+        std::cerr << "warning: open file limit " << limit.rlim_cur
+                  << " is lower than the number of connections " << connections << std::endl;
+    }
+}
+
+// 压测结束后输出各操作的吞吐量和时延分布，离线消息分页出错时返回false
+static bool report(std::vector<std::unique_ptr<BenchWorker>> &workers, double seconds)
+{
+    std::cout << std::endl
+              << std::left << std::setw(10) << "op"
+              << std::right << std::setw(12) << "sent" << std::setw(12) << "recv"
+              << std::setw(10) << "errors" << std::setw(12) << "sent/s" << std::setw(12) << "recv/s"
+              << std::setw(10) << "p50(us)" << std::setw(10) << "p99(us)"
+              << std::setw(11) << "p999(us)" << std::setw(11) << "max(us)" << std::endl;
+    for (int op = 0; op < OP_COUNT; ++op)
+    {
+        long long sent = 0;
+        long long received = 0;
+        long long errors = 0;
+        LatencyHistogram latency;
+        for (auto &worker : workers)
+        {
+            OpStats &stats = worker->stats(op);
+            sent += stats.sent;
+            received += stats.received;
+            errors += stats.errors;
+            latency.merge(stats.latency);
+        }
+        std::cout << std::left << std::setw(10) << kOpNames[op]
+                  << std::right << std::setw(12) << sent << std::setw(12) << received
+                  << std::setw(10) << errors
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << sent / seconds << std::setw(12) << received / seconds
+                  << std::setw(10) << latency.percentile(0.50)
+                  << std::setw(10) << latency.percentile(0.99)
+                  << std::setw(11) << latency.percentile(0.999)
+                  << std::setw(11) << latency.max() << std::endl;
+    }
+    std::cout << "onechat/groupchat recv counts deliveries to receivers, latency is end-to-end from sender to receiver"
+              << std::endl;
+    std::cout << "reconnect latency is from the abrupt close to the successful login on the new connection"
+              << std::endl;
+
+    // 离线消息分页检查，有出错的页时返回false
+    long long pages = 0, msgs = 0, errors = 0;
+    for (auto &worker : workers)
+    {
+        pages += worker->offlinePages();
+        msgs += worker->offlineMsgs();
+        errors += worker->offlineErrors();
+    }
+    std::cout << "offline pages:" << pages << " msgs:" << msgs << " bad pages:" << errors << std::endl;
+    return errors == 0;
+}
+
+// 聊天服务器压测程序
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:d:r:C:g:m:p:bh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atoi(optarg);
+            break;
+        case 'r':
+            config.rate = atof(optarg);
+            break;
+        case 'C':
+            config.connectRate = atof(optarg);
+            break;
+        case 'g':
+            config.groupid = atoi(optarg);
+            break;
+        case 'm':
+            if (!parseMix(optarg, config.weights))
+            {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'p':
+            config.password = optarg;
+            break;
+        case 'b':
+            config.binary = true;
+            break;
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+    if (argc - optind < 2 || config.connections <= 0 || config.threads <= 0 ||
+        config.duration <= 0 || config.connectRate <= 0)
+    {
+        usage();
+        exit(-1);
+    }
+    config.ip = argv[optind];
+    config.port = atoi(argv[optind + 1]);
+    config.threads = std::min(config.threads, config.connections);
+    if (config.groupid == 0 && config.weights[OP_GROUP_CHAT] != 0)
+    {
+        std::cerr << "no group given by -g, groupchat is disabled" << std::endl;
+        config.weights[OP_GROUP_CHAT] = 0;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    raiseFileLimit(config.connections);
+    g_onlineIds.reset(new std::atomic<int>[config.connections]());
+
+    std::cout << "ChatBench " << config.ip << ":" << config.port
+              << " connections:" << config.connections << " threads:" << config.threads
+              << " duration:" << config.duration << "s rate:" << config.rate << "/s"
+              << " format:" << (config.binary ? "binary" : "json") << std::endl;
+
+    // 连接平均分配给各个线程
+    std::vector<std::unique_ptr<BenchWorker>> workers;
+    int first = 0;
+    for (int i = 0; i < config.threads; ++i)
+    {
+        int count = config.connections / config.threads + (i < config.connections % config.threads ? 1 : 0);
+        workers.emplace_back(new BenchWorker(config, first, count, std::random_device()() + i));
+        first += count;
+    }
+    int64_t start = nowUs();
+    for (auto &worker : workers)
+    {
+        worker->start();
+    }
+
+    // 每秒输出一次进度
+    long long lastSent = 0;
+    for (int second = 1; second <= config.duration; ++second)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        long long connected = 0, online = 0, failed = 0, closed = 0, sent = 0, received = 0;
+        for (auto &worker : workers)
+        {
+            connected += worker->connected();
+            online += worker->online();
+            failed += worker->connectFailed();
+            closed += worker->closed();
+            for (int op = 0; op < OP_COUNT; ++op)
+            {
+                sent += worker->stats(op).sent;
+                received += worker->stats(op).received;
+            }
+        }
+        std::cout << "[" << std::setw(4) << second << "s] connected:" << connected << " online:" << online
+                  << " connect_failed:" << failed << " closed:" << closed
+                  << " sent/s:" << sent - lastSent << " recv:" << received << std::endl;
+        lastSent = sent;
+    }
+
+    g_stop = true;
+    for (auto &worker : workers)
+    {
+        worker->join();
+    }
+    return report(workers, (nowUs() - start) / 1000000.0) ? 0 : 1;
+}
@@ -8,17 +8,21 @@
 #include <thread>
 #include <semaphore.h>
 #include <atomic>
+#include <algorithm>
 
 #include "json.hpp"
 
 #include "user.hpp"
 #include "group.hpp"
 #include "public.hpp"
+#include "codec.hpp"
 
 // 记录当前系统登录的用户信息
 User g_currentUser;
 // 记录当前登录用户的好友列表信息
 std::vector<User> g_currentFriendList;
+// 好友列表的版本号，同一个用户重新登录时带上，服务器只返回新增的好友
+long long g_friendsVersion = -1;
 // 记录当前登录用户的群组列表信息
 std::vector<Group> g_currentGroupList;
 
@@ -29,6 +33,8 @@ bool isMainMenuRunning = false;
 sem_t rwsem;
 // 记录登录状态
 std::atomic_bool g_isLoginSuccess{false};
+// 是否使用旧版本的json+'\0'消息格式，用于连接还没有升级的服务器
+bool g_legacyMode = false;
 
 // 接收线程
 void readTaskHandler(int clientfd);
@@ -38,6 +44,8 @@ std::string getCurrentTime();
 void mainMenu(int clientfd);
 // 显示当前登录成功用户的基本信息
 void showCurrentUserData();
+// 按照当前使用的消息格式，向服务器发送一条消息
+int sendMsg(int clientfd, int msgid, const std::string &payload);
 
 using json = nlohmann::json;
 
@@ -46,10 +54,16 @@ int main(int argc, char **argv)
 {
     if (argc < 3)
     {
-        std::cerr << "command invalid! example: ./ChatClient 127.0.0.1 6000" << std::endl;
+        std::cerr << "command invalid! example: ./ChatClient 127.0.0.1 6000 [legacy]" << std::endl;
         exit(-1);
     }
 
+    // 第三个参数为legacy时，使用旧版本的消息格式
+    if (argc > 3 && std::string(argv[3]) == "legacy")
+    {
+        g_legacyMode = true;
+    }
+
     // 解析通过命令行参数传递的ip和port端口
     char *ip = argv[1];
     uint16_t port = atoi(argv[2]);
@@ -113,11 +127,23 @@ int main(int argc, char **argv)
             js["msgid"] = LOGIN_MSG;
             js["id"] = id;
             js["password"] = pwd;
+            if (!g_legacyMode)
+            {
+                // 登录响应之后由服务器分页推送离线消息
+                js["offlineSync"] = true;
+                // 登录时不加载群组成员，需要时使用groupusers命令查询
+                js["lazyGroups"] = true;
+                // 同一个用户重新登录时，已有的好友列表只做增量同步
+                if (g_currentUser.getId() == id && g_friendsVersion >= 0)
+                {
+                    js["friendsVersion"] = g_friendsVersion;
+                }
+            }
             std::string request = js.dump();
 
             g_isLoginSuccess = false;
 
-            int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
+            int len = sendMsg(clientfd, LOGIN_MSG, request);
             if (-1 == len)
             {
                 std::cout << "send login msg error:" << request << std::endl;
@@ -147,7 +173,7 @@ int main(int argc, char **argv)
             js["name"] = name;
             js["password"] = pwd;
             std::string request = js.dump();
-            int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
+            int len = sendMsg(clientfd, REG_MSG, request);
             if (len == -1)
             {
                 std::cerr << "send reg msg error:" << request << std::endl;
@@ -168,6 +194,60 @@ int main(int argc, char **argv)
     return 0;
 }
 
+// 显示一条离线消息 个人聊天信息或者群组消息
+void showOffLineMessage(const std::string &str)
+{
+    json js = json::parse(str);
+    if (ONE_CHAT_MSG == js["msgid"])
+    {
+        std::cout << js["time"] << " [" << js["id"] << "]" << js["name"] << " said: " << js["msg"] << std::endl;
+    }
+    else
+    {
+        std::cout << "群消息[" << js["groupid"] << "]:" << js["time"] << " [" << js["id"] << "]" << js["name"] << " said: " << js["msg"] << std::endl;
+    }
+}
+
+// 处理分页推送的离线消息，显示之后向服务器确认，服务器再推送下一页
+void doOffLineMsgPage(int clientfd, json &responsejs)
+{
+    std::vector<std::string> vec = responsejs["msgs"];
+    for (std::string &str : vec)
+    {
+        showOffLineMessage(str);
+    }
+
+    json js;
+    js["msgid"] = OFFLINE_MSG_ACK;
+    js["cursor"] = responsejs["cursor"];
+    std::string buffer = js.dump();
+    int len = sendMsg(clientfd, OFFLINE_MSG_ACK, buffer);
+    if (-1 == len)
+    {
+        std::cerr << "send offline ack error -> " << buffer << std::endl;
+    }
+}
+
+// 处理查询群组成员的响应逻辑
+void doQueryGroupUsersResponse(json &responsejs)
+{
+    if (0 != responsejs["errno"].get<int>())
+    {
+        std::cerr << responsejs["errmsg"] << std::endl;
+        return;
+    }
+    std::cout << "----------------------group users---------------------" << std::endl;
+    std::cout << "groupid:" << responsejs["groupid"] << std::endl;
+    std::vector<std::string> vec = responsejs["users"];
+    for (std::string &str : vec)
+    {
+        json js = json::parse(str);
+        std::cout << js["id"] << " " << js["name"].get<std::string>() << " " << js["state"].get<std::string>()
+                  << " " << js["role"].get<std::string>() << std::endl;
+    }
+    std::cout << "======================================================" << std::endl;
+}
+
 // 处理登录响应的逻辑
 void doLoginResponse(json &responsejs)
 {
@@ -184,11 +264,26 @@ void doLoginResponse(json &responsejs)
         g_currentUser.setId(responsejs["id"]);
         g_currentUser.setName(responsejs["name"]);
 
-        // 记录当前用户的好友列表信息
-        if (responsejs.contains("friends"))
+        // 记录当前用户的好友列表信息，增量同步时在已有的列表后面追加新增的好友
+        bool friendsDelta = responsejs.contains("friendsDelta") && responsejs["friendsDelta"].get<bool>();
+        if (!friendsDelta)
         {
             // 初始化好友列表
             g_currentFriendList.clear();
+        }
+        else if (responsejs.contains("onlineFriends"))
+        {
+            // 已有的好友只更新在线状态
+            std::vector<int> online = responsejs["onlineFriends"];
+            for (User &user : g_currentFriendList)
+            {
+                bool isOnline = std::find(online.begin(), online.end(), user.getId()) != online.end();
+                user.setState(isOnline ? "online" : "offline");
+            }
+        }
+        g_friendsVersion = responsejs.contains("friendsVersion") ? responsejs["friendsVersion"].get<long long>() : -1;
+        if (responsejs.contains("friends"))
+        {
             std::vector<std::string> vec = responsejs["friends"];
             for (std::string &str : vec)
             {
@@ -214,17 +309,19 @@ void doLoginResponse(json &responsejs)
                 group.setId(grpjs["id"]);
                 group.setName(grpjs["groupname"]);
                 group.setDesc(grpjs["groupdesc"]);
-                std::vector<std::string> vec2 = grpjs["users"];
-
-                for (std::string &userstr : vec2)
+                if (grpjs.contains("users"))
                 {
-                    GroupUser user;
-                    json js = json::parse(userstr);
-                    user.setId(js["id"]);
-                    user.setName(js["name"]);
-                    user.setState(js["state"]);
-                    user.setRole(js["role"]);
-                    group.getUsers().push_back(user);
+                    std::vector<std::string> vec2 = grpjs["users"];
+                    for (std::string &userstr : vec2)
+                    {
+                        GroupUser user;
+                        json js = json::parse(userstr);
+                        user.setId(js["id"]);
+                        user.setName(js["name"]);
+                        user.setState(js["state"]);
+                        user.setRole(js["role"]);
+                        group.getUsers().push_back(user);
+                    }
                 }
                 g_currentGroupList.push_back(group);
             }
@@ -239,15 +336,7 @@ void doLoginResponse(json &responsejs)
             std::vector<std::string> vec = responsejs["offLineMsg"];
             for (std::string &str : vec)
             {
-                json js = json::parse(str);
-                if (ONE_CHAT_MSG == js["msgid"])
-                {
-                    std::cout << js["time"] << " [" << js["id"] << "]" << js["name"] << " said: " << js["msg"] << std::endl;
-                }
-                else
-                {
-                    std::cout << "群消息[" << js["groupid"] << "]:" << js["time"] << " [" << js["id"] << "]" << js["name"] << " said: " << js["msg"] << std::endl;
-                }
+                showOffLineMessage(str);
             }
         }
 
@@ -271,12 +360,48 @@ void doRegsponse(json &responsejs)
     }
 }
 
+// 处理服务器发来的一条消息
+void handleServerMessage(int clientfd, json &js)
+{
+    int msgtype = js["msgid"];
+    if (ONE_CHAT_MSG == msgtype)
+    {
+        std::cout << js["time"] << " [" << js["id"] << "]" << js["name"]
+                  << " said: " << js["msg"] << std::endl;
+    }
+    else if (GROUP_CHAT_MSG == msgtype)
+    {
+        std::cout << "群消息[" << js["groupid"] << "]:" << js["time"] << " ["
+                  << js["id"] << "]" << js["name"] << " said: " << js["msg"] << std::endl;
+    }
+    else if (LOGIN_MSG_ACK == msgtype)
+    {
+        doLoginResponse(js); // 处理登录响应的业务逻辑
+        sem_post(&rwsem);    // 通知主线程，登录结果处理完成
+    }
+    else if (REG_MSG_ACK == msgtype)
+    {
+        doRegsponse(js);
+        sem_post(&rwsem); // 通知主线程，登录结果处理完成
+    }
+    else if (OFFLINE_MSG_PAGE == msgtype)
+    {
+        doOffLineMsgPage(clientfd, js);
+    }
+    else if (QUERY_GROUP_USERS_MSG_ACK == msgtype)
+    {
+        doQueryGroupUsersResponse(js);
+    }
+}
+
 // 子线程 - 接收线程
 void readTaskHandler(int clientfd)
 {
+    // 接收缓冲区，保存还没有组成完整消息帧的数据
+    std::string recvBuf;
     for (;;)
     {
-        char buffer[1024] = {0};
+        char buffer[4096] = {0};
         int len = recv(clientfd, buffer, sizeof(buffer), 0);
         if (-1 == len || 0 == len)
         {
@@ -284,32 +409,56 @@ void readTaskHandler(int clientfd)
             exit(-1);
         }
 
-        // 接收ChatServer转发的数据 反序列化生成json数据对象
-        json js = json::parse(buffer);
-        int msgtype = js["msgid"];
-        if (ONE_CHAT_MSG == msgtype)
+        if (g_legacyMode)
         {
-            std::cout << js["time"] << " [" << js["id"] << "]" << js["name"]
-                      << " said: " << js["msg"] << std::endl;
-        }
-        else if (GROUP_CHAT_MSG == msgtype)
-        {
-            std::cout << "群消息[" << js["groupid"] << "]:" << js["time"] << " ["
-                      << js["id"] << "]" << js["name"] << " said: " << js["msg"] << std::endl;
-        }
-        else if (LOGIN_MSG_ACK == msgtype)
-        {
-            doLoginResponse(js); // 处理登录响应的业务逻辑
-            sem_post(&rwsem);    // 通知主线程，登录结果处理完成
+            // 旧版本服务器没有消息边界，每次接收的数据当作一条json
+            json js = json::parse(buffer, buffer + len);
+            handleServerMessage(clientfd, js);
+            continue;
         }
-        else if (REG_MSG_ACK == msgtype)
+
+        // 接收ChatServer转发的数据，取出所有完整的消息帧，反序列化生成json数据对象
+        recvBuf.append(buffer, len);
+        size_t pos = 0;
+        while (recvBuf.size() - pos >= kFrameHeaderLen)
         {
-            doRegsponse(js);
-            sem_post(&rwsem); // 通知主线程，登录结果处理完成
+            FrameHeader header = decodeFrameHeader(recvBuf.data() + pos);
+            if (header.length > kMaxFrameLen)
+            {
+                std::cerr << "invalid frame length:" << header.length << std::endl;
+                close(clientfd);
+                exit(-1);
+            }
+            if (recvBuf.size() - pos < kFrameHeaderLen + header.length)
+            {
+                break;
+            }
+            const char *payload = recvBuf.data() + pos + kFrameHeaderLen;
+            json js = json::parse(payload, payload + header.length);
+            handleServerMessage(clientfd, js);
+            pos += kFrameHeaderLen + header.length;
         }
+        recvBuf.erase(0, pos);
     }
 }
 
+// 按照当前使用的消息格式，向服务器发送一条消息
+int sendMsg(int clientfd, int msgid, const std::string &payload)
+{
+    std::string data;
+    if (g_legacyMode)
+    {
+        // 旧格式以'\0'作为消息的结束
+        data = payload;
+        data.push_back('\0');
+    }
+    else
+    {
+        data = encodeFrame(msgid, payload);
+    }
+    return send(clientfd, data.data(), data.size(), 0);
+}
+
 // 显示当前登录成功用户的基本信息
 void showCurrentUserData()
 {
@@ -351,6 +500,8 @@ void creategroup(int, std::string);
 void addgroup(int, std::string);
 // "groupchat" command handler
 void groupchat(int, std::string);
+// "groupusers" command handler
+void groupusers(int, std::string);
 // "loginout" command handler
 void loginout(int, std::string);
 
@@ -362,6 +513,7 @@ std::unordered_map<std::string, std::string> commandMap = {
     {"creategroup", "创建群组,格式creategroup:groupname:groupdesc"},
     {"addgroup", "加入群组,格式addgroup:groupid"},
     {"groupchat", "群聊,格式groupchat:groupid:message"},
+    {"groupusers", "查询群组成员,格式groupusers:groupid"},
     {"loginout", "注销,格式loginout"},
 };
 
@@ -373,6 +525,7 @@ std::unordered_map<std::string, std::function<void(int, std::string)>> commandHa
     {"creategroup", creategroup},
     {"addgroup", addgroup},
     {"groupchat", groupchat},
+    {"groupusers", groupusers},
     {"loginout", loginout},
 };
 
@@ -427,7 +580,7 @@ void addfriend(int clientfd, std::string str)
     js["friendid"] = friendid;
     std::string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), buffer.length() + 1, 0);
+    int len = sendMsg(clientfd, ADD_FRIEND_MSG, buffer);
     if (-1 == len)
     {
         std::cerr << "send addfriend msg error" << buffer << std::endl;
@@ -454,7 +607,7 @@ void chat(int clientfd, std::string str)
     js["time"] = getCurrentTime();
     std::string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), buffer.length() + 1, 0);
+    int len = sendMsg(clientfd, ONE_CHAT_MSG, buffer);
     if (-1 == len)
     {
         std::cerr << "send chat msg error -> " << buffer << std::endl;
@@ -479,7 +632,7 @@ void creategroup(int clientfd, std::string str)
     js["groupdesc"] = groupdesc;
     std::string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), buffer.length() + 1, 0);
+    int len = sendMsg(clientfd, CREATE_GROUP_MSG, buffer);
     if (-1 == len)
     {
         std::cerr << "send creategroup msg error -> " << buffer << std::endl;
@@ -495,7 +648,7 @@ void addgroup(int clientfd, std::string str)
     js["groupid"] = groupid;
 
     std::string buffer = js.dump();
-    int len = send(clientfd, buffer.c_str(), buffer.length() + 1, 0);
+    int len = sendMsg(clientfd, ADD_GROUP_MSG, buffer);
     if (-1 == len)
     {
         std::cerr << "send addgroup msg error -> " << buffer << std::endl;
@@ -523,12 +676,27 @@ void groupchat(int clientfd, std::string str)
     js["time"] = getCurrentTime();
     std::string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, GROUP_CHAT_MSG, buffer);
     if (-1 == len)
     {
         std::cerr << "send groupchat msg error -> " << buffer << std::endl;
     }
 };
+// "groupusers" command handler
+void groupusers(int clientfd, std::string str)
+{
+    int groupid = atoi(str.c_str());
+    json js;
+    js["msgid"] = QUERY_GROUP_USERS_MSG;
+    js["groupid"] = groupid;
+
+    std::string buffer = js.dump();
+    int len = sendMsg(clientfd, QUERY_GROUP_USERS_MSG, buffer);
+    if (-1 == len)
+    {
+        std::cerr << "send groupusers msg error -> " << buffer << std::endl;
+    }
+};
 // "loginout" command handler
 void loginout(int clientfd, std::string str)
 {
@@ -537,7 +705,7 @@ void loginout(int clientfd, std::string str)
     js["id"] = g_currentUser.getId();
     std::string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, LOGINOUT_MSG, buffer);
     if (-1 == len)
     {
         std::cerr << "send loginout msg error -> " << buffer << std::endl;
@@ -0,0 +1,902 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <climits>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+#include <muduo/net/Buffer.h>
+#include <muduo/base/Logging.h>
+
+#include "json.hpp"
+#include "public.hpp"
+#include "codec.hpp"
+#include "wireformat.hpp"
+#include "chatcodec.hpp"
+#include "workerpool.hpp"
+#include "connregistry.hpp"
+
+using json = nlohmann::json;
+
+/*
+服务器热点路径的微基准和正确性检查
+每个用例独立运行: ./ChatMicroBench 用例名，检查失败时返回非0
+只使用服务器的编解码、业务线程池和连接表的实现，不需要数据库和redis
+*/
+
+// 当前线程消耗的CPU时间(ns)，排除调度和其它线程的干扰
+static long long threadCpuNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 检查条件，失败时输出原因
+static bool expect(bool condition, const std::string &what)
+{
+    if (!condition)
+    {
+        std::cerr << "check failed: " << what << std::endl;
+    }
+    return condition;
+}
+
+// 原子变量更新最大值
+static void updateMax(std::atomic<long long> &target, long long value)
+{
+    long long prev = target.load();
+    while (value > prev && !target.compare_exchange_weak(prev, value))
+    {
+    }
+}
+
+// 用户id对应的假连接，只用作连接表中的值，不会被访问
+static muduo::net::TcpConnectionPtr fakeConn(int userid)
+{
+    return muduo::net::TcpConnectionPtr(std::shared_ptr<void>(),
+                                        reinterpret_cast<muduo::net::TcpConnection *>(
+                                            static_cast<uintptr_t>(userid + 1) * 64));
+}
+
+// 旧版本的连接表，一把锁保护整个map
+struct LockedConnMap
+{
+    std::mutex mutex;
+    std::unordered_map<int, muduo::net::TcpConnectionPtr> conns;
+
+    muduo::net::TcpConnectionPtr find(int userid)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = conns.find(userid);
+        return it == conns.end() ? nullptr : it->second;
+    }
+};
+
+// 群聊消息，和客户端发送的字段一致
+static json makeGroupMessage(size_t msgLen)
+{
+    json js;
+    js["msgid"] = GROUP_CHAT_MSG;
+    js["id"] = 10001;
+    js["name"] = "bench";
+    js["groupid"] = 1;
+    js["msg"] = std::string(msgLen, 'x');
+    js["time"] = "2024-01-01 00:00:00";
+    return js;
+}
+
+// 用例: 消息帧编解码的往返检查
+// 随机长度的json帧、二进制帧和旧格式消息拼接后按随机位置切开，模拟粘包和半包，逐段交给ChatCodec
+// 上报的每条消息的类型、格式和内容都要和发送的一致
+static int runCodec(int, char **)
+{
+    struct Sent
+    {
+        int msgid;
+        uint16_t flags;
+        std::string payload;
+    };
+    std::mt19937 random(42);
+    std::vector<Sent> sent;
+    std::string stream;
+    for (int i = 0; i < 2000; ++i)
+    {
+        json js = makeGroupMessage(random() % (i % 100 == 0 ? 100000 : 200));
+        int kind = random() % 3;
+        if (kind == 0)
+        {
+            std::string payload = js.dump();
+            stream += encodeFrame(GROUP_CHAT_MSG, payload);
+            sent.push_back(Sent{GROUP_CHAT_MSG, FRAME_FLAG_JSON, payload});
+        }
+        else if (kind == 1)
+        {
+            std::string frame;
+            if (!expect(encodeWireFrame(GROUP_CHAT_MSG, js, frame), "binary encode"))
+            {
+                return 1;
+            }
+            stream += frame;
+            sent.push_back(Sent{GROUP_CHAT_MSG, FRAME_FLAG_BINARY, frame.substr(kFrameHeaderLen)});
+        }
+        else
+        {
+            // 旧格式 json+'\0'，msgid从json中获取
+            std::string payload = js.dump();
+            stream += payload;
+            stream.push_back('\0');
+            sent.push_back(Sent{0, FRAME_FLAG_JSON, payload});
+        }
+    }
+
+    std::vector<Sent> received;
+    ChatCodec codec([&](const muduo::net::TcpConnectionPtr &, int msgid, uint16_t flags,
+                        const char *data, size_t len, muduo::Timestamp)
+                    { received.push_back(Sent{msgid, flags, std::string(data, len)}); });
+
+    // 编解码器只读取连接的context和名字，用socketpair的一端建立一个真实的连接对象
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        std::cerr << "socketpair error:" << strerror(errno) << std::endl;
+        return 1;
+    }
+    muduo::net::EventLoop loop;
+    muduo::net::TcpConnectionPtr conn = std::make_shared<muduo::net::TcpConnection>(
+        &loop, "codec", fds[0], muduo::net::InetAddress(0), muduo::net::InetAddress(0));
+    conn->connectEstablished();
+
+    muduo::net::Buffer buffer;
+    long long begin = threadCpuNs();
+    for (size_t pos = 0; pos < stream.size();)
+    {
+        size_t chunk = std::min<size_t>(stream.size() - pos, 1 + random() % 4096);
+        buffer.append(stream.data() + pos, chunk);
+        pos += chunk;
+        codec.onMessage(conn, &buffer, muduo::Timestamp::now());
+    }
+    long long cpuNs = threadCpuNs() - begin;
+    conn->connectDestroyed();
+    ::close(fds[1]);
+
+    bool ok = expect(received.size() == sent.size(), "message count " + std::to_string(received.size()) +
+                                                         " != " + std::to_string(sent.size())) &&
+              expect(buffer.readableBytes() == 0, "bytes left in buffer");
+    for (size_t i = 0; ok && i < sent.size(); ++i)
+    {
+        ok = expect(received[i].msgid == sent[i].msgid && received[i].flags == sent[i].flags &&
+                        received[i].payload == sent[i].payload,
+                    "message " + std::to_string(i) + " differs");
+    }
+    std::cout << "codec messages:" << sent.size() << " bytes:" << stream.size()
+              << " ns/byte:" << std::fixed << std::setprecision(2) << double(cpuNs) / stream.size()
+              << (ok ? " ok" : " FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+// 用例: 群聊转发时每条消息的CPU耗时和群组大小的关系
+// per-recipient: 每个接收者各自序列化json并编码帧，旧版本的做法
+// encode-once:   编码一次，所有接收者共享同一个消息对象，只增加引用计数
+static int runFanout(int argc, char **argv)
+{
+    size_t msgLen = argc > 2 ? atoi(argv[2]) : 100;
+    const int sizes[] = {1, 10, 100, 500, 1000, 5000};
+    json js = makeGroupMessage(msgLen);
+
+    std::cout << std::setw(8) << "members" << std::setw(20) << "per-recipient(us)"
+              << std::setw(18) << "encode-once(us)" << std::setw(10) << "speedup" << std::endl;
+    for (int members : sizes)
+    {
+        // 每种群组大小发送的消息数，保证总的转发次数相近
+        int messages = std::max(20, 200000 / members);
+        std::vector<std::string> frames(members);
+        size_t bytes = 0;
+
+        long long begin = threadCpuNs();
+        for (int m = 0; m < messages; ++m)
+        {
+            for (int i = 0; i < members; ++i)
+            {
+                frames[i] = encodeFrame(GROUP_CHAT_MSG, js.dump());
+                bytes += frames[i].size();
+            }
+        }
+        double perRecipientUs = (threadCpuNs() - begin) / 1000.0 / messages;
+
+        std::vector<EncodedMessagePtr> shared(members);
+        begin = threadCpuNs();
+        for (int m = 0; m < messages; ++m)
+        {
+            EncodedMessagePtr message = ChatCodec::encode(GROUP_CHAT_MSG, js);
+            for (int i = 0; i < members; ++i)
+            {
+                shared[i] = message;
+                bytes += shared[i]->frame().size();
+            }
+        }
+        double encodeOnceUs = (threadCpuNs() - begin) / 1000.0 / messages;
+
+        std::cout << std::setw(8) << members << std::fixed << std::setprecision(2)
+                  << std::setw(20) << perRecipientUs << std::setw(18) << encodeOnceUs
+                  << std::setw(9) << perRecipientUs / encodeOnceUs << "x" << std::endl;
+        if (bytes == 0)
+        {
+            return 1;
+        }
+    }
+
+    // 同一条群消息发给json格式和二进制格式的接收者，每条消息的CPU时间和每个接收者的帧长度
+    // json: 业务处理移入json对象，发送json帧
+    // binary: 业务处理移入json对象，二进制帧直接从json对象编码
+    // reparse: 只有json内容(其它服务器转发来的消息)，二进制帧需要先解析json内容
+    std::string jsonFrame = ChatCodec::encode(GROUP_CHAT_MSG, json(js))->frame();
+    std::string binaryFrame = ChatCodec::encode(GROUP_CHAT_MSG, json(js))->binaryFrame();
+    std::string reparsedFrame = ChatCodec::encode(GROUP_CHAT_MSG, js.dump())->binaryFrame();
+    if (!expect(binaryFrame == reparsedFrame, "binary frame from json equals binary frame from payload") ||
+        !expect(binaryFrame != jsonFrame, "group message has a binary schema"))
+    {
+        return 1;
+    }
+    std::cout << std::endl
+              << "frame bytes json:" << jsonFrame.size() << " binary:" << binaryFrame.size() << std::endl;
+    std::cout << std::setw(8) << "members" << std::setw(12) << "json(us)"
+              << std::setw(12) << "binary(us)" << std::setw(13) << "reparse(us)" << std::endl;
+    for (int members : sizes)
+    {
+        int messages = std::max(20, 200000 / members);
+        std::vector<const std::string *> frames(members);
+        size_t bytes[3] = {0, 0, 0};
+        double us[3];
+        for (int format = 0; format < 3; ++format)
+        {
+            long long begin = threadCpuNs();
+            for (int m = 0; m < messages; ++m)
+            {
+                EncodedMessagePtr message = format == 2 ? ChatCodec::encode(GROUP_CHAT_MSG, js.dump())
+                                                        : ChatCodec::encode(GROUP_CHAT_MSG, json(js));
+                for (int i = 0; i < members; ++i)
+                {
+                    frames[i] = format == 0 ? &message->frame() : &message->binaryFrame();
+                    bytes[format] += frames[i]->size();
+                }
+            }
+            us[format] = (threadCpuNs() - begin) / 1000.0 / messages;
+        }
+        std::cout << std::setw(8) << members << std::fixed << std::setprecision(2)
+                  << std::setw(12) << us[0] << std::setw(12) << us[1] << std::setw(13) << us[2] << std::endl;
+        if (bytes[0] == 0 || bytes[1] == 0 || bytes[2] == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 用例: 业务线程池的顺序检查
+// 相同key的任务必须在同一个线程中按投递顺序执行，stop()之前投递的任务全部执行完
+static int runWorker(int, char **)
+{
+    const int kKeys = 64;
+    const int kTasksPerKey = 5000;
+    bool ok = true;
+    for (int threads : {0, 1, 4, 16})
+    {
+        WorkerPool pool("worker-check");
+        pool.start(threads);
+        // 每个key的状态只在该key所在的线程中访问，stop()等待线程退出之后再读取
+        std::vector<int> last(kKeys, -1);
+        std::vector<std::thread::id> owner(kKeys);
+        std::atomic<int> outOfOrder(0);
+        std::atomic<int> wrongThread(0);
+        std::atomic<int> done(0);
+
+        long long begin = threadCpuNs();
+        for (int seq = 0; seq < kTasksPerKey; ++seq)
+        {
+            for (int key = 0; key < kKeys; ++key)
+            {
+                pool.dispatch(key, [&, key, seq]
+                              {
+                    if (last[key] + 1 != seq)
+                    {
+                        ++outOfOrder;
+                    }
+                    last[key] = seq;
+                    if (seq == 0)
+                    {
+                        owner[key] = std::this_thread::get_id();
+                    }
+                    else if (owner[key] != std::this_thread::get_id())
+                    {
+                        ++wrongThread;
+                    }
+                    ++done; });
+            }
+        }
+        double dispatchNs = double(threadCpuNs() - begin) / (kKeys * kTasksPerKey);
+        pool.stop();
+
+        bool passed = expect(done == kKeys * kTasksPerKey, "worker tasks lost, threads:" + std::to_string(threads)) &&
+                      expect(outOfOrder == 0, "worker tasks out of order, threads:" + std::to_string(threads)) &&
+                      expect(wrongThread == 0, "worker key moved thread, threads:" + std::to_string(threads));
+        ok = ok && passed;
+        std::cout << "worker threads:" << threads << " tasks:" << done
+                  << " dispatch ns/task:" << std::fixed << std::setprecision(1) << dispatchNs
+                  << (passed ? " ok" : " FAILED") << std::endl;
+    }
+    return ok ? 0 : 1;
+}
+
+// 查询线程和群聊转发线程并发运行1秒，输出查询吞吐量和单次查询的最长等待时间
+template <typename Lookup, typename FanOut>
+static void measureContention(const char *name, int threads, Lookup lookup, FanOut fanout)
+{
+    const int kOnlineUsers = 100000;
+    std::atomic_bool running(true);
+    std::atomic<long long> lookups(0);
+    std::atomic<long long> maxWaitNs(0);
+    std::atomic<long long> fanouts(0);
+
+    std::vector<std::thread> lookupThreads;
+    for (int t = 0; t < threads; ++t)
+    {
+        lookupThreads.emplace_back([&, t]
+                                   {
+            std::mt19937 random(t);
+            long long count = 0;
+            long long maxNs = 0;
+            while (running)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                if (lookup(static_cast<int>(random() % kOnlineUsers)) != nullptr)
+                {
+                    ++count;
+                }
+                maxNs = std::max<long long>(maxNs, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                       std::chrono::steady_clock::now() - begin)
+                                                       .count());
+            }
+            lookups += count;
+            updateMax(maxWaitNs, maxNs); });
+    }
+    std::thread fanoutThread([&]
+                             {
+        while (running)
+        {
+            fanout();
+            ++fanouts;
+        } });
+
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    running = false;
+    for (std::thread &thread : lookupThreads)
+    {
+        thread.join();
+    }
+    fanoutThread.join();
+
+    std::cout << std::setw(14) << name << std::setw(16) << lookups.load()
+              << std::setw(16) << std::fixed << std::setprecision(1) << maxWaitNs / 1000.0
+              << std::setw(12) << fanouts.load() << std::endl;
+}
+
+// 用例: 群聊转发和单聊、登录等连接表查询之间的锁竞争
+// locked:   旧版本的做法，持有整个连接表的锁期间对不在本服务器的成员做阻塞的数据库/redis调用
+// snapshot: 先在分片锁下批量取出本服务器上的连接，释放锁之后再处理其它成员
+// 阻塞调用用sleep模拟，ioUs为每个不在本服务器的成员的调用耗时
+static int runContention(int argc, char **argv)
+{
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    int ioUs = argc > 3 ? atoi(argv[3]) : 50;
+    const int kOnlineUsers = 100000;
+    const int kGroupSize = 200;
+
+    LockedConnMap locked;
+    ConnRegistry registry;
+    for (int userid = 0; userid < kOnlineUsers; ++userid)
+    {
+        locked.conns[userid] = fakeConn(userid);
+        registry.insert(userid, fakeConn(userid));
+    }
+    // 一半的群成员在本服务器在线，另一半需要查询位置、跨服务器转发或者存储离线消息
+    std::vector<int> group;
+    for (int i = 0; i < kGroupSize / 2; ++i)
+    {
+        group.push_back(i * 7);
+        group.push_back(kOnlineUsers + i);
+    }
+    auto blockingCall = [ioUs]
+    { std::this_thread::sleep_for(std::chrono::microseconds(ioUs)); };
+
+    std::cout << std::setw(14) << "mode" << std::setw(16) << "lookups/s"
+              << std::setw(16) << "max wait(us)" << std::setw(12) << "fanouts/s" << std::endl;
+    measureContention(
+        "locked", threads,
+        [&](int userid)
+        { return locked.find(userid); },
+        [&]
+        {
+            std::lock_guard<std::mutex> lock(locked.mutex);
+            for (int userid : group)
+            {
+                if (locked.conns.find(userid) == locked.conns.end())
+                {
+                    blockingCall();
+                }
+            }
+        });
+
+    std::vector<muduo::net::TcpConnectionPtr> found;
+    std::vector<int> missing;
+    measureContention(
+        "snapshot", threads,
+        [&](int userid)
+        { return registry.find(userid); },
+        [&]
+        {
+            found.clear();
+            missing.clear();
+            registry.findMany(group, -1, found, missing);
+            for (size_t i = 0; i < missing.size(); ++i)
+            {
+                blockingCall();
+            }
+        });
+    return 0;
+}
+
+// 用例: 连接表的查询吞吐量和线程数的关系
+// 每个线程随机查询在线用户，writePct%的操作是登录和下线(删除再插入)
+static int runRegistry(int argc, char **argv)
+{
+    int writePct = argc > 2 ? atoi(argv[2]) : 0;
+    const int kOnlineUsers = 100000;
+    const int threadNums[] = {1, 2, 4, 8, 16, 32, 64};
+
+    LockedConnMap locked;
+    ConnRegistry registry;
+    for (int userid = 0; userid < kOnlineUsers; ++userid)
+    {
+        locked.conns[userid] = fakeConn(userid);
+        registry.insert(userid, fakeConn(userid));
+    }
+
+    std::cout << std::setw(8) << "threads" << std::setw(18) << "single-lock(op/s)"
+              << std::setw(18) << "sharded(op/s)" << std::setw(10) << "speedup" << std::endl;
+    for (int threads : threadNums)
+    {
+        double results[2];
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            std::atomic_bool running(true);
+            std::atomic<long long> ops(0);
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&, t]
+                                     {
+                    std::mt19937 random(t);
+                    long long count = 0;
+                    while (running)
+                    {
+                        int userid = static_cast<int>(random() % kOnlineUsers);
+                        if (static_cast<int>(random() % 100) < writePct)
+                        {
+                            muduo::net::TcpConnectionPtr conn = fakeConn(userid);
+                            if (mode == 0)
+                            {
+                                std::lock_guard<std::mutex> lock(locked.mutex);
+                                locked.conns.erase(userid);
+                                locked.conns[userid] = conn;
+                            }
+                            else if (registry.erase(userid, registry.find(userid)))
+                            {
+                                registry.insert(userid, conn);
+                            }
+                        }
+                        else if ((mode == 0 ? locked.find(userid) : registry.find(userid)) == nullptr)
+                        {
+                            continue;
+                        }
+                        ++count;
+                    }
+                    ops += count; });
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            running = false;
+            for (std::thread &thread : workers)
+            {
+                thread.join();
+            }
+            results[mode] = ops * 2.0;
+        }
+        std::cout << std::setw(8) << threads << std::setw(18) << std::fixed << std::setprecision(0) << results[0]
+                  << std::setw(18) << results[1] << std::setw(9) << std::setprecision(2)
+                  << results[1] / results[0] << "x" << std::endl;
+    }
+    return 0;
+}
+
+// 用例: 分片连接表的正确性检查
+// 单线程检查插入、按连接删除、查询、批量查询的语义，再用多个线程并发登录下线，检查最终的用户数和用户列表
+static int runSharding(int, char **)
+{
+    const int kUsers = 10000;
+    bool ok = true;
+    for (int shards : {1, 3, 64})
+    {
+        ConnRegistry registry(shards);
+        for (int userid = 0; userid < kUsers; userid += 2)
+        {
+            ok = expect(registry.insert(userid, fakeConn(userid)), "insert " + std::to_string(userid)) && ok;
+        }
+        ok = expect(!registry.insert(0, fakeConn(1)), "duplicate insert accepted") && ok;
+        ok = expect(registry.find(0) == fakeConn(0), "duplicate insert replaced the connection") && ok;
+        ok = expect(!registry.erase(2, fakeConn(3)), "erase with another connection") && ok;
+        ok = expect(registry.find(2) == fakeConn(2), "erase with another connection removed the user") && ok;
+        ok = expect(registry.erase(4, fakeConn(4)), "erase with the user's connection") && ok;
+        ok = expect(registry.find(4) == nullptr && registry.find(5) == nullptr, "find offline user") && ok;
+        ok = expect(registry.insert(4, fakeConn(4)), "insert after erase") && ok;
+        ok = expect(registry.size() == kUsers / 2, "size " + std::to_string(registry.size())) && ok;
+
+        // 批量查询的结果和逐个查询一致，跳过exclude
+        std::vector<int> userids;
+        for (int userid = 0; userid < 1000; ++userid)
+        {
+            userids.push_back(userid);
+        }
+        std::vector<muduo::net::TcpConnectionPtr> found;
+        std::vector<int> missing;
+        registry.findMany(userids, 10, found, missing);
+        std::unordered_set<muduo::net::TcpConnection *> foundSet;
+        for (const muduo::net::TcpConnectionPtr &conn : found)
+        {
+            foundSet.insert(conn.get());
+        }
+        bool manyOk = found.size() == 499 && missing.size() == 500 && foundSet.size() == found.size();
+        for (int userid = 0; manyOk && userid < 1000; ++userid)
+        {
+            manyOk = userid == 10 || (userid % 2 == 0) == (foundSet.count(fakeConn(userid).get()) == 1);
+        }
+        for (int userid : missing)
+        {
+            manyOk = manyOk && userid % 2 == 1;
+        }
+        ok = expect(manyOk, "findMany differs from find, shards:" + std::to_string(shards)) && ok;
+
+        // 每个线程在自己的用户id范围内反复登录下线，结束时奇数id在线
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t)
+        {
+            threads.emplace_back([&registry, t]
+                                 {
+                for (int round = 0; round < 20; ++round)
+                {
+                    for (int userid = kUsers + t * 1000; userid < kUsers + (t + 1) * 1000; ++userid)
+                    {
+                        if (round % 2 == 0)
+                        {
+                            registry.insert(userid, fakeConn(userid));
+                        }
+                        else if (userid % 2 == 0)
+                        {
+                            registry.erase(userid, fakeConn(userid));
+                        }
+                    }
+                } });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        std::vector<int> online = registry.userIds();
+        std::unordered_set<int> onlineSet(online.begin(), online.end());
+        bool concurrentOk = online.size() == onlineSet.size() && registry.size() == kUsers / 2 + 4000 &&
+                            online.size() == registry.size();
+        for (int userid = kUsers; concurrentOk && userid < kUsers + 8000; ++userid)
+        {
+            concurrentOk = (onlineSet.count(userid) == 1) == (userid % 2 == 1);
+        }
+        ok = expect(concurrentOk, "concurrent insert/erase, shards:" + std::to_string(shards)) && ok;
+    }
+    std::cout << "sharding" << (ok ? " ok" : " FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+// 分发测试的目标对象，处理函数只累加计数，测量的只是查找和调用处理函数的开销
+class DispatchTarget
+{
+public:
+    using Handler = void (DispatchTarget::*)(const muduo::net::TcpConnectionPtr &conn,
+                                             json &js, muduo::Timestamp time);
+    struct HandlerTable
+    {
+        Handler handlers[MSG_TYPE_MAX];
+    };
+
+    // 和ChatService一样在编译期生成按消息类型索引的处理函数表
+    static constexpr HandlerTable makeHandlerTable()
+    {
+        HandlerTable table{};
+        table.handlers[LOGIN_MSG] = &DispatchTarget::handle;
+        table.handlers[LOGINOUT_MSG] = &DispatchTarget::handle;
+        table.handlers[REG_MSG] = &DispatchTarget::handle;
+        table.handlers[ONE_CHAT_MSG] = &DispatchTarget::handleChat;
+        table.handlers[ADD_FRIEND_MSG] = &DispatchTarget::handle;
+        table.handlers[OFFLINE_MSG_ACK] = &DispatchTarget::handle;
+        table.handlers[CREATE_GROUP_MSG] = &DispatchTarget::handle;
+        table.handlers[ADD_GROUP_MSG] = &DispatchTarget::handle;
+        table.handlers[GROUP_CHAT_MSG] = &DispatchTarget::handleChat;
+        table.handlers[QUERY_GROUP_USERS_MSG] = &DispatchTarget::handle;
+        return table;
+    }
+
+    void handle(const muduo::net::TcpConnectionPtr &, json &, muduo::Timestamp) { ++handled; }
+    void handleChat(const muduo::net::TcpConnectionPtr &, json &, muduo::Timestamp) { ++chats; }
+
+    long long handled = 0;
+    long long chats = 0;
+};
+
+// 用例: 每条消息查找和调用处理函数的开销
+// function-map: 旧版本的做法，unordered_map<int, std::function>查找，找到后再用[]取一次并拷贝返回
+// table:        编译期生成的成员函数指针表，按消息类型直接索引，不拷贝也不分配内存
+static int runDispatch(int, char **)
+{
+    using MsgFunction = std::function<void(const muduo::net::TcpConnectionPtr &, json &, muduo::Timestamp)>;
+    static constexpr DispatchTarget::HandlerTable kTable = DispatchTarget::makeHandlerTable();
+    const int kMessages = 1 << 20;
+    const int kRounds = 8;
+
+    // 消息类型以聊天为主，其余随机选择，包括没有处理函数的响应类型，1%是超出范围的消息类型
+    std::mt19937 random(7);
+    std::vector<int> msgids(kMessages);
+    for (int &msgid : msgids)
+    {
+        int value = random() % 100;
+        msgid = value < 60 ? ONE_CHAT_MSG : value < 80 ? GROUP_CHAT_MSG : value < 99 ? 1 + random() % QUERY_GROUP_USERS_MSG : MSG_TYPE_MAX + 1;
+    }
+
+    DispatchTarget target;
+    std::unordered_map<int, MsgFunction> handlerMap;
+    for (int msgid = 1; msgid < MSG_TYPE_MAX; ++msgid)
+    {
+        DispatchTarget::Handler handler = kTable.handlers[msgid];
+        if (handler != nullptr)
+        {
+            handlerMap[msgid] = std::bind(handler, &target, std::placeholders::_1,
+                                          std::placeholders::_2, std::placeholders::_3);
+        }
+    }
+    long long unknown = 0;
+    auto getHandler = [&](int msgid) -> MsgFunction
+    {
+        auto it = handlerMap.find(msgid);
+        if (it == handlerMap.end())
+        {
+            return [&unknown](const muduo::net::TcpConnectionPtr &, json &, muduo::Timestamp)
+            { ++unknown; };
+        }
+        return handlerMap[msgid];
+    };
+
+    muduo::net::TcpConnectionPtr conn;
+    json js = makeGroupMessage(16);
+    muduo::Timestamp time;
+
+    long long begin = threadCpuNs();
+    for (int round = 0; round < kRounds; ++round)
+    {
+        for (int msgid : msgids)
+        {
+            getHandler(msgid)(conn, js, time);
+        }
+    }
+    double mapNs = double(threadCpuNs() - begin) / kRounds / kMessages;
+
+    begin = threadCpuNs();
+    for (int round = 0; round < kRounds; ++round)
+    {
+        for (int msgid : msgids)
+        {
+            DispatchTarget::Handler handler = (msgid > 0 && msgid < MSG_TYPE_MAX) ? kTable.handlers[msgid] : nullptr;
+            if (handler == nullptr)
+            {
+                ++unknown;
+                continue;
+            }
+            (target.*handler)(conn, js, time);
+        }
+    }
+    double tableNs = double(threadCpuNs() - begin) / kRounds / kMessages;
+
+    bool ok = expect(target.handled + target.chats + unknown == 2LL * kRounds * kMessages, "dispatched message count");
+    std::cout << "dispatch function-map ns/msg:" << std::fixed << std::setprecision(2) << mapNs
+              << " table ns/msg:" << tableNs << " speedup:" << mapNs / tableNs << "x" << std::endl;
+    return ok ? 0 : 1;
+}
+
+// 按字段类型生成随机的值，包括边界值、空字符串和含'\0'的字符串
+static json randomWireValue(EnWireFieldType type, std::mt19937_64 &random)
+{
+    auto randomInt = [&random]() -> int64_t
+    {
+        static const int64_t kEdges[] = {0, 1, -1, 63, 64, -64, -65, INT_MAX, INT_MIN, LLONG_MAX, LLONG_MIN};
+        return random() % 2 ? kEdges[random() % (sizeof(kEdges) / sizeof(kEdges[0]))]
+                            : static_cast<int64_t>(random());
+    };
+    auto randomString = [&random]()
+    {
+        std::string value(random() % 4 == 0 ? random() % 1000 : random() % 20, '\0');
+        for (char &c : value)
+        {
+            c = static_cast<char>(random());
+        }
+        return value;
+    };
+    json value = json::array();
+    switch (type)
+    {
+    case WIRE_FIELD_INT:
+        return randomInt();
+    case WIRE_FIELD_BOOL:
+        return random() % 2 == 0;
+    case WIRE_FIELD_STRING:
+        return randomString();
+    case WIRE_FIELD_STRINGS:
+        for (int i = random() % 6; i > 0; --i)
+        {
+            value.push_back(randomString());
+        }
+        return value;
+    case WIRE_FIELD_INTS:
+        for (int i = random() % 6; i > 0; --i)
+        {
+            value.push_back(randomInt());
+        }
+        return value;
+    }
+    return value;
+}
+
+// 用例: 二进制消息格式的编解码往返检查
+// 对每种有schema的消息类型随机选择存在的字段和值，编码后解码必须得到相同的json
+// 截断的数据和多出的字节都必须解码失败，字段类型和schema不符时编码失败
+static int runWire(int, char **)
+{
+    const int kRounds = 300;
+    std::mt19937_64 random(11);
+    bool ok = true;
+    size_t wireBytes = 0;
+    size_t jsonBytes = 0;
+    int messages = 0;
+    for (int msgid = 1; msgid < MSG_TYPE_MAX; ++msgid)
+    {
+        const WireSchema *schema = wireSchema(msgid);
+        if (schema == nullptr)
+        {
+            continue;
+        }
+        for (int round = 0; round < kRounds; ++round)
+        {
+            // 第一轮所有字段都存在，第二轮所有字段都不存在
+            json js = json::object();
+            js["msgid"] = msgid;
+            for (size_t i = 0; i < schema->count; ++i)
+            {
+                if (round == 0 || (round != 1 && random() % 2 == 0))
+                {
+                    js[schema->fields[i].name] = randomWireValue(schema->fields[i].type, random);
+                }
+            }
+            std::string payload;
+            json decoded;
+            if (!expect(encodeWirePayload(msgid, js, payload), "encode msgid:" + std::to_string(msgid)))
+            {
+                ok = false;
+                continue;
+            }
+            ++messages;
+            wireBytes += payload.size();
+            jsonBytes += js.dump(-1, ' ', false, json::error_handler_t::replace).size();
+            ok = expect(decodeWirePayload(msgid, payload.data(), payload.size(), decoded) && decoded == js,
+                        "round trip msgid:" + std::to_string(msgid) + " round:" + std::to_string(round)) &&
+                 ok;
+            for (size_t len = 0; round < 20 && len < payload.size(); ++len)
+            {
+                ok = expect(!decodeWirePayload(msgid, payload.data(), len, decoded),
+                            "truncated payload decoded, msgid:" + std::to_string(msgid)) &&
+                     ok;
+            }
+            std::string longer = payload + '\0';
+            ok = expect(!decodeWirePayload(msgid, longer.data(), longer.size(), decoded),
+                        "payload with a trailing byte decoded, msgid:" + std::to_string(msgid)) &&
+                 ok;
+        }
+
+        // 每个字段换成其它类型的值
+        for (size_t i = 0; i < schema->count; ++i)
+        {
+            json js = json::object();
+            js[schema->fields[i].name] = schema->fields[i].type == WIRE_FIELD_STRING ? json(1) : json("x");
+            std::string payload;
+            ok = expect(!encodeWirePayload(msgid, js, payload),
+                        std::string("wrong type accepted, field:") + schema->fields[i].name) &&
+                 ok;
+        }
+    }
+    std::string payload;
+    ok = expect(!encodeWirePayload(0, json::object(), payload) && !encodeWirePayload(MSG_TYPE_MAX, json::object(), payload),
+                "message without schema encoded") &&
+         ok;
+    std::cout << "wire messages:" << messages << " binary/json bytes:" << std::fixed << std::setprecision(2)
+              << double(wireBytes) / jsonBytes << (ok ? " ok" : " FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+// 用例表
+struct BenchCase
+{
+    const char *name;
+    const char *help;
+    int (*run)(int argc, char **argv);
+};
+
+static const BenchCase kCases[] = {
+    {"codec", "frame split/merge round trip through ChatCodec (check)", runCodec},
+    {"fanout", "[msgLen] group message CPU per message vs group size, json vs binary frames", runFanout},
+    {"worker", "per-key ordering of WorkerPool tasks (check)", runWorker},
+    {"registry", "[writePct] connection registry ops/s with 1-64 threads", runRegistry},
+    {"sharding", "insert/erase/find/findMany consistency of ConnRegistry (check)", runSharding},
+    {"dispatch", "handler lookup cost per message, function map vs member pointer table", runDispatch},
+    {"wire", "binary wire format encode/decode round trip of every schema (check)", runWire},
+    {"contention", "[threads] [ioUs] registry lookups while a group message does blocking I/O", runContention},
+};
+
+static void usage()
+{
+    std::cerr << "usage: ./ChatMicroBench <case> [args]" << std::endl;
+    for (const BenchCase &item : kCases)
+    {
+        std::cerr << "  " << std::left << std::setw(12) << item.name << item.help << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+    // 只输出错误日志，不干扰测量结果
+    muduo::Logger::setLogLevel(muduo::Logger::ERROR);
+    for (const BenchCase &item : kCases)
+    {
+        if (strcmp(argv[1], item.name) == 0)
+        {
+            return item.run(argc, argv);
+        }
+    }
+    usage();
+    return 1;
+}
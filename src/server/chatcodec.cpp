@@ -0,0 +1,177 @@
+#include "chatcodec.hpp"
+#include "conncontext.hpp"
+#include "wireformat.hpp"
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+
+EncodedMessage::EncodedMessage(int msgid, std::string payload)
+    : _msgid(msgid), _payload(std::move(payload))
+{
+    _frame = encodeFrame(_msgid, _payload);
+}
+
+EncodedMessage::EncodedMessage(int msgid, const nlohmann::json &js)
+    : _msgid(msgid), _payload(js.dump())
+{
+    _frame = encodeFrame(_msgid, _payload);
+}
+
+EncodedMessage::EncodedMessage(int msgid, nlohmann::json &&js)
+    : _msgid(msgid), _payload(js.dump()), _json(std::move(js))
+{
+    _frame = encodeFrame(_msgid, _payload);
+}
+
+// 二进制格式的完整消息帧
+const std::string &EncodedMessage::binaryFrame() const
+{
+    // 接收者都是json格式的连接时不编码，第一个二进制格式的接收者编码一次，之后共享
+    // 业务处理移入的json对象直接编码，从其它服务器转发来的消息只有json内容，需要先解析
+    std::call_once(_binaryOnce, [this]()
+                   {
+        if (_json.is_null())
+        {
+            _json = nlohmann::json::parse(_payload, nullptr, false);
+        }
+        if (_json.is_discarded() || !encodeWireFrame(_msgid, _json, _binaryFrame))
+        {
+            _binaryFrame.clear();
+        }
+        _json = nullptr; });
+    return _binaryFrame.empty() ? _frame : _binaryFrame;
+}
+
+ChatCodec::ChatCodec(const FrameCallback &cb)
+    : _frameCallback(cb)
+{
+}
+
+// 从Buffer中解析出所有完整的消息帧
+void ChatCodec::onMessage(const muduo::net::TcpConnectionPtr &conn,
+                          muduo::net::Buffer *buffer,
+                          muduo::Timestamp time)
+{
+    ConnContextPtr context = getConnContext(conn);
+    while (buffer->readableBytes() > 0)
+    {
+        const char *data = buffer->peek();
+        if (isLegacyFormat(data))
+        {
+            // 旧格式 以'\0'作为消息的结束
+            const char *end = static_cast<const char *>(
+                memchr(data, '\0', buffer->readableBytes()));
+            if (end == nullptr)
+            {
+                if (buffer->readableBytes() > kMaxFrameLen)
+                {
+                    LOG_ERROR << conn->name() << " legacy message too long:" << buffer->readableBytes();
+                    conn->forceClose();
+                }
+                break;
+            }
+            if (context != nullptr)
+            {
+                context->wireMode = WIRE_LEGACY;
+            }
+            _frameCallback(conn, 0, FRAME_FLAG_JSON, data, end - data, time);
+            buffer->retrieveUntil(end + 1);
+        }
+        else
+        {
+            if (buffer->readableBytes() < kFrameHeaderLen)
+            {
+                break;
+            }
+            FrameHeader header = decodeFrameHeader(data);
+            if (header.length > kMaxFrameLen)
+            {
+                LOG_ERROR << conn->name() << " invalid frame length:" << header.length;
+                conn->forceClose();
+                break;
+            }
+            if (buffer->readableBytes() < kFrameHeaderLen + header.length)
+            {
+                // 帧还没有接收完整
+                break;
+            }
+            if (header.flags != FRAME_FLAG_JSON && header.flags != FRAME_FLAG_BINARY)
+            {
+                LOG_ERROR << conn->name() << " invalid frame flags:" << header.flags;
+                conn->forceClose();
+                break;
+            }
+            if (context != nullptr)
+            {
+                context->wireMode = header.flags == FRAME_FLAG_BINARY ? WIRE_BINARY : WIRE_FRAME;
+            }
+            _frameCallback(conn, header.msgid, header.flags, data + kFrameHeaderLen, header.length, time);
+            buffer->retrieve(kFrameHeaderLen + header.length);
+        }
+    }
+}
+
+// 编码一条消息
+EncodedMessagePtr ChatCodec::encode(int msgid, std::string payload)
+{
+    return std::make_shared<const EncodedMessage>(msgid, std::move(payload));
+}
+
+EncodedMessagePtr ChatCodec::encode(int msgid, const nlohmann::json &js)
+{
+    return std::make_shared<const EncodedMessage>(msgid, js);
+}
+
+EncodedMessagePtr ChatCodec::encode(int msgid, nlohmann::json &&js)
+{
+    return std::make_shared<const EncodedMessage>(msgid, std::move(js));
+}
+
+// 按照连接使用的格式发送一条消息
+void ChatCodec::send(const muduo::net::TcpConnectionPtr &conn,
+                     int msgid, std::string payload)
+{
+    send(conn, encode(msgid, std::move(payload)));
+}
+
+// 按照连接使用的格式编码并发送一条消息
+void ChatCodec::send(const muduo::net::TcpConnectionPtr &conn,
+                     int msgid, const nlohmann::json &js)
+{
+    ConnContextPtr context = getConnContext(conn);
+    int wireMode = context != nullptr ? context->wireMode.load() : WIRE_UNKNOWN;
+    std::string data;
+    if (wireMode == WIRE_LEGACY)
+    {
+        data = js.dump();
+    }
+    else if (wireMode != WIRE_BINARY || !encodeWireFrame(msgid, js, data))
+    {
+        data = encodeFrame(msgid, js.dump());
+    }
+    conn->getLoop()->runInLoop([conn, data = std::move(data)]()
+                               { conn->send(data); });
+}
+
+// 发送已经编码好的消息
+void ChatCodec::send(const muduo::net::TcpConnectionPtr &conn,
+                     const EncodedMessagePtr &message)
+{
+    // 业务线程直接调用conn->send时，muduo会把数据拷贝一份再转交给I/O线程
+    // 这里只把共享的消息对象交给I/O线程，由I/O线程直接写入socket或者输出缓冲区
+    conn->getLoop()->runInLoop([conn, message]()
+                               {
+        ConnContextPtr context = getConnContext(conn);
+        int wireMode = context != nullptr ? context->wireMode.load() : WIRE_UNKNOWN;
+        if (wireMode == WIRE_LEGACY)
+        {
+            conn->send(message->payload());
+        }
+        else if (wireMode == WIRE_BINARY)
+        {
+            conn->send(message->binaryFrame());
+        }
+        else
+        {
+            conn->send(message->frame());
+        } });
+}
@@ -1,16 +1,39 @@
 #include "chatserver.hpp"
 #include "json.hpp"
 #include "chatservice.hpp"
+#include "conncontext.hpp"
+#include "wireformat.hpp"
 
 #include <muduo/base/Logging.h>
 using json = nlohmann::json;
 
+// 默认的业务线程数量
+static const int kDefaultWorkerThreadNum = 8;
+
+// 同一个用户同一时刻只对应一条连接，按连接分派业务线程，即可保证同一个用户的消息按顺序处理
+static size_t dispatchKey(const muduo::net::TcpConnectionPtr &conn)
+{
+    return std::hash<muduo::net::TcpConnection *>()(conn.get());
+}
+
 // 初始化聊天服务器
 ChatServer::ChatServer(muduo::net::EventLoop *loop,
                        const muduo::net::InetAddress &listenAddr,
                        const std::string &nameArg)
-    : _server(loop, listenAddr, nameArg), _loop(loop)
+    : _server(loop, listenAddr, nameArg), _loop(loop),
+      _codec(std::bind(&ChatServer::onFrame, this,
+                       std::placeholders::_1, std::placeholders::_2,
+                       std::placeholders::_3, std::placeholders::_4,
+                       std::placeholders::_5, std::placeholders::_6)),
+      _workerPool("ChatWorker"), _workerThreadNum(kDefaultWorkerThreadNum)
 {
+    registerMetrics();
+
+    // 验证线程池中完成的登录和注册，回到连接所属的业务线程中继续处理
+    ChatService::instance()->setConnExecutor(
+        std::bind(&ChatServer::runInConnThread, this,
+                  std::placeholders::_1, std::placeholders::_2));
+
     // 注册连接回调
     this->_server.setConnectionCallback(
         std::bind(&ChatServer::onConnection,
@@ -26,20 +49,134 @@ ChatServer::ChatServer(muduo::net::EventLoop *loop,
     this->_server.setThreadNum(4);
 }
 
+// 注册服务器和业务线程池的指标
+void ChatServer::registerMetrics()
+{
+    Metrics *metrics = Metrics::instance();
+    _connections = metrics->gauge("chat_connections", "Current client connections.");
+    _acceptedConnections = metrics->counter("chat_connections_accepted_total", "Client connections accepted.");
+    const char *formats[3] = {"json", "binary", "legacy"};
+    for (int i = 0; i < 3; ++i)
+    {
+        _frames[i] = metrics->counter("chat_frames_received_total", "Messages received from clients.",
+                                      std::string("format=\"") + formats[i] + "\"");
+    }
+    _receivedBytes = metrics->counter("chat_frame_bytes_received_total", "Payload bytes received from clients.");
+    _decodeErrors = metrics->counter("chat_frame_decode_errors_total", "Messages that failed to decode.");
+    _onMessageLatency = metrics->histogram("chat_on_message_latency_us",
+                                           "Time spent in onMessage splitting and decoding frames.");
+
+    metrics->addCollector([this](MetricsWriter &writer)
+                          {
+        WorkerPoolStats stats = this->_workerPool.getStats();
+        writer.gauge("chat_worker_queue_depth", "Tasks waiting in the worker pool.", stats.queueDepth);
+        writer.gauge("chat_worker_max_queue_depth", "Largest worker pool backlog seen.", stats.maxQueueDepth);
+        writer.counter("chat_worker_tasks_total", "Tasks completed by the worker pool.", stats.tasks);
+        writer.counter("chat_worker_queue_us_total", "Time tasks spent queued.", stats.totalQueueUs);
+        writer.counter("chat_worker_handle_us_total", "Time tasks spent running.", stats.totalHandleUs);
+        writer.gauge("chat_worker_max_handle_us", "Longest task run time.", stats.maxHandleUs); });
+}
+
+// 在连接所属的业务线程中执行任务
+void ChatServer::runInConnThread(const muduo::net::TcpConnectionPtr &conn, WorkerPool::Task task)
+{
+    // 没有业务线程时消息在连接所属的I/O线程中处理
+    if (this->_workerThreadNum <= 0)
+    {
+        conn->getLoop()->runInLoop(std::move(task));
+        return;
+    }
+    this->_workerPool.dispatch(dispatchKey(conn), std::move(task));
+}
+
+// 设置业务线程的数量
+void ChatServer::setWorkerThreadNum(int numThreads)
+{
+    this->_workerThreadNum = numThreads;
+}
+
 // 启动服务
 void ChatServer::start()
 {
+    this->_workerPool.start(this->_workerThreadNum);
     this->_server.start();
+
+    // 定时输出业务线程池的排队和处理耗时
+    this->_loop->runEvery(60.0, [this]()
+                          {
+        WorkerPoolStats stats = this->_workerPool.getStats();
+        LOG_INFO << "worker queueDepth:" << stats.queueDepth
+                 << " maxQueueDepth:" << stats.maxQueueDepth
+                 << " tasks:" << stats.tasks
+                 << " avgQueueUs:" << (stats.tasks ? stats.totalQueueUs / stats.tasks : 0)
+                 << " avgHandleUs:" << (stats.tasks ? stats.totalHandleUs / stats.tasks : 0)
+                 << " maxHandleUs:" << stats.maxHandleUs;
+        PresenceCacheStats presence = ChatService::instance()->getPresenceCacheStats();
+        LOG_INFO << "presence cache hits:" << presence.hits
+                 << " misses:" << presence.misses
+                 << " memoryBytes:" << presence.memoryBytes;
+        GroupCacheStats group = ChatService::instance()->getGroupCacheStats();
+        LOG_INFO << "group cache hits:" << group.hits
+                 << " misses:" << group.misses
+                 << " groups:" << group.groups
+                 << " members:" << group.members;
+        LocationCacheStats location = ChatService::instance()->getLocationCacheStats();
+        LOG_INFO << "location cache hits:" << location.hits
+                 << " misses:" << location.misses
+                 << " users:" << location.users;
+        OfflineWriterStats offline = ChatService::instance()->getOfflineWriterStats();
+        LOG_INFO << "offline writer rows:" << offline.rows
+                 << " batches:" << offline.batches
+                 << " blocked:" << offline.blocked
+                 << " retried:" << offline.retried
+                 << " failed:" << offline.failed
+                 << " pending:" << offline.pending;
+        RedisPublishStats publish = ChatService::instance()->getRedisPublishStats();
+        LOG_INFO << "redis publish published:" << publish.published
+                 << " failed:" << publish.failed
+                 << " rejected:" << publish.rejected
+                 << " retried:" << publish.retried
+                 << " undelivered:" << publish.undelivered
+                 << " batches:" << publish.batches
+                 << " pending:" << publish.pending
+                 << " avgLatencyUs:" << (publish.published ? publish.totalLatencyUs / publish.published : 0)
+                 << " maxLatencyUs:" << publish.maxLatencyUs;
+        RedisSubscriberStats subscriber = ChatService::instance()->getRedisSubscriberStats();
+        LOG_INFO << "redis subscriber messages:" << subscriber.messages
+                 << " confirmations:" << subscriber.confirmations
+                 << " reconnects:" << subscriber.reconnects
+                 << " totalGapMs:" << subscriber.totalGapMs
+                 << " maxGapMs:" << subscriber.maxGapMs
+                 << " connected:" << subscriber.connected; });
+}
+
+// 停止服务
+void ChatServer::stop()
+{
+    // 验证结果要交回业务线程，先停止验证线程池，再停止业务线程池，已经投递的任务都执行完
+    ChatService::instance()->stopAuth();
+    this->_workerPool.stop();
+    ChatService::instance()->reset();
 }
 
 // 上报连接相关信息的回调函数
 void ChatServer::onConnection(
     const muduo::net::TcpConnectionPtr &conn)
 {
+    if (conn->connected())
+    {
+        // 记录连接的状态信息
+        conn->setContext(std::make_shared<ConnContext>());
+        _connections->add(1);
+        _acceptedConnections->add();
+    }
     // 客户端断开连接
-    if (!conn->connected())
+    else
     {
-        ChatService::instance()->clientCloseException(conn);
+        _connections->add(-1);
+        // 投递到和该连接消息相同的业务线程，保证在该连接之前的消息处理完之后再清理
+        this->_workerPool.dispatch(dispatchKey(conn), [conn]()
+                                   { ChatService::instance()->clientCloseException(conn); });
         conn->shutdown();
     }
 }
@@ -50,20 +187,64 @@ void ChatServer::onMessage(
     muduo::net::Buffer *buffer,
     muduo::Timestamp time)
 {
-    std::string buf = buffer->retrieveAllAsString();
+    ScopedLatency latency(_onMessageLatency);
+    // 由编解码器处理粘包和半包，每条完整的消息回调一次onFrame
+    this->_codec.onMessage(conn, buffer, time);
+}
+
+// 编解码器上报一条完整消息的回调函数
+void ChatServer::onFrame(
+    const muduo::net::TcpConnectionPtr &conn,
+    int msgid, uint16_t flags,
+    const char *data, size_t len,
+    muduo::Timestamp time)
+{
     try
     {
-        // 数据的反序列化
-        json js = json::parse(buf);
+        // 数据的反序列化 直接解析Buffer中的数据，不拷贝成string
+        _frames[flags == FRAME_FLAG_BINARY ? 1 : (msgid == 0 ? 2 : 0)]->add();
+        _receivedBytes->add(len);
+        json js;
+        if (flags == FRAME_FLAG_BINARY)
+        {
+            // 二进制格式按消息类型的schema解码，不经过json文本的解析
+            if (!decodeWirePayload(msgid, data, len, js))
+            {
+                _decodeErrors->add();
+                LOG_INFO << "binary error, msgid:" << msgid << " length:" << len;
+                return;
+            }
+        }
+        else
+        {
+            js = json::parse(data, data + len);
+        }
         // 达到的目的：完全解耦网络模块的代码和业务模块的代码
-        // 通过js["msgid"] 获取 =》 业务hander =》 coon js time
-        auto msgHandler = ChatService::instance()->getHandler(
-            js["msgid"].get<int>());
-        // 回调消息绑定好的事件处理器，来执行相应的业务处理
-        msgHandler(conn, js, time);
+        // 通过帧头部或者js["msgid"] 获取 =》 业务hander =》 coon js time
+        if (msgid == 0)
+        {
+            msgid = js["msgid"].get<int>();
+        }
+        // 业务处理会访问数据库和redis，投递到业务线程中执行，不阻塞I/O线程
+        // 业务线程中调用conn->send，muduo会通过runInLoop把发送操作转回连接所属的I/O线程
+        this->_workerPool.dispatch(
+            dispatchKey(conn),
+            [conn, msgid, time, js = std::move(js)]() mutable
+            {
+                try
+                {
+                    // 回调消息绑定好的事件处理器，来执行相应的业务处理
+                    ChatService::instance()->dispatch(msgid, conn, js, time);
+                }
+                catch (const std::exception &e)
+                {
+                    LOG_INFO << "handle error:" << e.what() << " " << js.dump();
+                }
+            });
     }
     catch (const std::exception &e)
     {
-        LOG_INFO << "js error:"<<buf;
+        _decodeErrors->add();
+        LOG_INFO << "js error:" << std::string(data, len);
     }
 }
@@ -1,8 +1,96 @@
 #include "chatservice.hpp"
 #include "public.hpp"
+#include "chatcodec.hpp"
+#include "conncontext.hpp"
+#include "trace.hpp"
+#include "passwordhash.hpp"
 #include <muduo/base/Logging.h>
 #include <vector>
 #include <map>
+#include <unordered_set>
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+#include <unistd.h>
+
+// 获取消息的json内容，和消息对象共享同一块内存，用于存储离线消息
+static std::shared_ptr<const std::string> sharedPayload(const EncodedMessagePtr &message)
+{
+    return std::shared_ptr<const std::string>(message, &message->payload());
+}
+
+// 验证线程池中排队的登录和注册请求上限，超过后直接拒绝
+static const int kMaxPendingAuth = 10000;
+// 验证请求预计的最长排队时间(us)，按排队的任务数和实测的平均耗时估算，超过后直接拒绝，客户端稍后重试
+static const long long kMaxAuthWaitUs = 3000000;
+// 登录验证期间每个连接最多暂存的后续消息数，超过后丢弃
+static const size_t kMaxDeferredMessages = 64;
+
+// 每页离线消息的最大条数和最大字节数
+static const int kOfflinePageSize = 100;
+static const size_t kOfflinePageBytes = 256 * 1024;
+
+// 集群内广播群组成员变更的控制通道
+static const char *kGroupChannel = "group";
+// 集群内广播好友关系变更的控制通道
+static const char *kFriendChannel = "friend";
+
+// 跨服务器转发的消息格式: 消息类型:接收者id列表(逗号分隔)\n消息内容
+// 头部是文本，消息内容紧跟在第一个换行之后，可以是任意二进制数据
+static std::string encodeEnvelopeHeader(int msgid, const std::vector<int> &userids)
+{
+    std::string header = std::to_string(msgid);
+    header.push_back(':');
+    for (size_t i = 0; i < userids.size(); ++i)
+    {
+        if (i != 0)
+        {
+            header.push_back(',');
+        }
+        header += std::to_string(userids[i]);
+    }
+    header.push_back('\n');
+    return header;
+}
+
+// 解析跨服务器转发的消息头部，offset返回消息内容的起始位置
+static bool decodeEnvelopeHeader(std::string_view envelope, int &msgid, std::vector<int> &userids, size_t &offset)
+{
+    size_t end = envelope.find('\n');
+    if (end == std::string_view::npos)
+    {
+        return false;
+    }
+    const char *p = envelope.data();
+    const char *last = p + end;
+    std::from_chars_result result = std::from_chars(p, last, msgid);
+    if (result.ec != std::errc() || result.ptr == last || *result.ptr != ':')
+    {
+        return false;
+    }
+    p = result.ptr + 1;
+    while (p < last)
+    {
+        int userid = 0;
+        result = std::from_chars(p, last, userid);
+        if (result.ec != std::errc())
+        {
+            return false;
+        }
+        userids.push_back(userid);
+        p = (result.ptr < last && *result.ptr == ',') ? result.ptr + 1 : result.ptr;
+    }
+    offset = end + 1;
+    return true;
+}
+
+// 本服务器的名字 主机名:进程号，重启之后是新的名字，不会收到发给上一个进程的消息
+static std::string makeNodeId()
+{
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    return std::string(host) + ":" + std::to_string(getpid());
+}
 
 // 获取单例对象的接口函数
 ChatService *ChatService::instance()
@@ -12,82 +100,197 @@ ChatService *ChatService::instance()
 }
 
 // 注册消息以及对应的Handler操作
-ChatService::ChatService()
+constexpr ChatService::HandlerTable ChatService::makeHandlerTable()
 {
+    HandlerTable table{};
 
     // 用户基本业务管理相关事件处理回调注册
-    _msgHandlerMap.insert({LOGIN_MSG, std::bind(&ChatService::login, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
-    _msgHandlerMap.insert({LOGINOUT_MSG, std::bind(&ChatService::loginout, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
-    _msgHandlerMap.insert({REG_MSG, std::bind(&ChatService::reg, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
-    _msgHandlerMap.insert({ONE_CHAT_MSG, std::bind(&ChatService::oneChat, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
-    _msgHandlerMap.insert({ADD_FRIEND_MSG, std::bind(&ChatService::addFriend, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
+    table.handlers[LOGIN_MSG] = &ChatService::login;
+    table.handlers[LOGINOUT_MSG] = &ChatService::loginout;
+    table.handlers[REG_MSG] = &ChatService::reg;
+    table.handlers[ONE_CHAT_MSG] = &ChatService::oneChat;
+    table.handlers[ADD_FRIEND_MSG] = &ChatService::addFriend;
+    table.handlers[OFFLINE_MSG_ACK] = &ChatService::offlineMsgAck;
 
     // 群组业务管理相关事件处理回调注册
-    _msgHandlerMap.insert({CREATE_GROUP_MSG, std::bind(&ChatService::createGroup, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
-    _msgHandlerMap.insert({ADD_GROUP_MSG, std::bind(&ChatService::addGroup, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
-    _msgHandlerMap.insert({GROUP_CHAT_MSG, std::bind(&ChatService::groupChat, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)});
+    table.handlers[CREATE_GROUP_MSG] = &ChatService::createGroup;
+    table.handlers[ADD_GROUP_MSG] = &ChatService::addGroup;
+    table.handlers[GROUP_CHAT_MSG] = &ChatService::groupChat;
+    table.handlers[QUERY_GROUP_USERS_MSG] = &ChatService::queryGroupUsers;
+    return table;
+}
+
+// 初始化是常量表达式，在编译期完成
+const ChatService::HandlerTable ChatService::_handlerTable = ChatService::makeHandlerTable();
+
+ChatService::ChatService()
+    : _nodeId(makeNodeId()), _presence(_redis, _nodeId),
+      _pendingAuth(0), _authCostUs(0), _authStopped(false), _authPool("ChatAuth")
+{
+    registerMetrics();
+
+    // 密码哈希是纯计算，验证线程数不超过一半的核数，给I/O线程和业务线程留出CPU
+    _authThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency() / 2));
+    _authPool.start(_authThreads);
+    // 先计算一次哈希作为验证耗时的初始估计，第一批请求就能按排队时间限流
+    _authPool.dispatch(0, [this]()
+                       {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        PasswordHash::hash("calibrate");
+        updateAuthCost(begin); });
+
 
     // 连接redis服务器
     if (_redis.connect())
     {
-        // 设置上报消息回调
-        _redis.init_notify_handler(std::bind(&ChatService::handleRedisSubcribeMessage, this, std::placeholders::_1, std::placeholders::_2));
+        // 设置上报消息回调，每个服务器只订阅自己的路由通道，用户登录注销不需要订阅和取消订阅
+        _redis.init_notify_handler(std::bind(&ChatService::handleRedisSubcribeMessage, this, std::placeholders::_1));
+        _redis.subscribe_node(_nodeId);
+        // 设置控制通道消息回调，订阅在线状态变更通知
+        _redis.init_control_handler(std::bind(&ChatService::handleRedisControlMessage, this, std::placeholders::_1, std::placeholders::_2));
+        // 设置订阅连接重连和消息无法送达的回调
+        _redis.init_reconnect_handler(std::bind(&ChatService::handleRedisReconnect, this));
+        _redis.init_undelivered_handler(std::bind(&ChatService::handleRedisUndelivered, this, std::placeholders::_1, std::placeholders::_2));
+        _redis.subscribe(PresenceService::channel());
+        _redis.subscribe(kGroupChannel);
+        _redis.subscribe(kFriendChannel);
+        // 刷新本服务器的心跳，其它服务器据此判断位置目录中的记录是否有效
+        _presence.start();
     }
 }
 
-// 服务器异常，业务重置方法
+// 停止验证线程池
+void ChatService::stopAuth()
+{
+    _authStopped = true;
+    _authPool.stop();
+}
+
+// 服务器退出
 void ChatService::reset()
 {
-    // 把online状态的用户，设置成offline
-    _userModel.resetState();
+    // 订阅线程会回调业务对象，在单例析构之前停止，发送线程把剩余的通知发完再退出
+    // 没有送达的路由通道消息交给undelivered回调存入离线消息队列
+    _redis.stop();
+
+    // 从位置目录删除本服务器上的用户，通知所有服务器丢弃缓存的在线状态
+    _presence.shutdown(_userConnMap.userIds());
+
+    // 最后把还在队列中的离线消息写入数据库，包括发送线程退出时交回的消息
+    _offLineMsgWriter.flush();
 }
 
-// 获取消息对应的处理器
-MsgHandler ChatService::getHandler(int msgid)
+// 调用消息对应的处理器
+void ChatService::dispatch(int msgid, const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time)
 {
-    std::unordered_map<int, MsgHandler>::iterator it =
-        _msgHandlerMap.find(msgid);
-    if (it == _msgHandlerMap.end())
+    MsgHandler handler = (msgid > 0 && msgid < MSG_TYPE_MAX) ? _handlerTable.handlers[msgid] : nullptr;
+    if (handler == nullptr)
     {
-        // 返回一个默认的处理器 空操作
-        return [=](const muduo::net::TcpConnectionPtr &conn,
-                   json &js, muduo::Timestamp time)
+        // 默认的处理器 空操作
+        _unknownMessages->add();
+        LOG_ERROR << "msgid:" << msgid << " can not find handler!";
+        return;
+    }
+    // 登录验证期间暂存后续的消息，保证同一个连接的消息按收到的顺序处理
+    ConnContextPtr context = getConnContext(conn);
+    if (context != nullptr && context->authPending)
+    {
+        if (context->deferred.size() >= kMaxDeferredMessages)
         {
-            LOG_ERROR << "msgid:" << msgid << " can not find handler!";
-        };
+            LOG_ERROR << "too many messages during login, drop msgid:" << msgid;
+            return;
+        }
+        context->deferred.push_back(DeferredMessage{msgid, std::move(js), time});
+        return;
     }
-    else
+    ScopedLatency latency(_handlerLatency[msgid]);
+    RequestTrace trace(msgid);
+    (this->*handler)(conn, js, time);
+}
+
+// 设置在连接所属的业务线程中执行任务的方法
+void ChatService::setConnExecutor(ConnExecutor executor)
+{
+    _connExecutor = std::move(executor);
+}
+
+// 注册业务层的指标，缓存、离线消息和redis已经维护的统计信息在抓取时读取
+void ChatService::registerMetrics()
+{
+    Metrics *metrics = Metrics::instance();
+    for (int msgid = 0; msgid < MSG_TYPE_MAX; ++msgid)
     {
-        return _msgHandlerMap[msgid];
+        _handlerLatency[msgid] = _handlerTable.handlers[msgid] == nullptr
+                                     ? nullptr
+                                     : metrics->histogram("chat_handler_latency_us", "Business handler run time by message type.",
+                                                          "msgid=\"" + std::to_string(msgid) + "\"");
     }
+    _unknownMessages = metrics->counter("chat_unknown_messages_total", "Messages without a registered handler.");
+    _authLatency = metrics->histogram("chat_auth_latency_us", "Credential query and password verification time on a cache miss.");
+    _authRejected = metrics->counter("chat_auth_rejected_total", "Logins and registrations rejected because the auth queue was full.");
+
+    metrics->addCollector([this](MetricsWriter &writer)
+                          {
+        writer.gauge("chat_online_users", "Users logged in on this server.", _userConnMap.size());
+
+        PresenceCacheStats presence = _presence.getPresenceCacheStats();
+        writer.counter("chat_cache_hits_total", "Local cache hits.", presence.hits, "cache=\"presence\"");
+        writer.counter("chat_cache_misses_total", "Local cache misses.", presence.misses, "cache=\"presence\"");
+        GroupCacheStats group = _groupCache.getStats();
+        writer.counter("chat_cache_hits_total", "Local cache hits.", group.hits, "cache=\"group\"");
+        writer.counter("chat_cache_misses_total", "Local cache misses.", group.misses, "cache=\"group\"");
+        CredentialCacheStats credential = _credentialCache.getStats();
+        writer.counter("chat_cache_hits_total", "Local cache hits.", credential.hits, "cache=\"credential\"");
+        writer.counter("chat_cache_misses_total", "Local cache misses.", credential.misses, "cache=\"credential\"");
+        writer.gauge("chat_auth_pending", "Logins and registrations waiting for or running on the auth pool.", _pendingAuth.load());
+        writer.gauge("chat_auth_task_cost_us", "Moving average run time of one auth pool task.", _authCostUs.load());
+        FriendCacheStats friends = _friendCache.getStats();
+        writer.counter("chat_cache_hits_total", "Local cache hits.", friends.hits, "cache=\"friend\"");
+        writer.counter("chat_cache_misses_total", "Local cache misses.", friends.misses, "cache=\"friend\"");
+        ProfileCacheStats profile = _profileCache.getStats();
+        writer.counter("chat_cache_hits_total", "Local cache hits.", profile.hits, "cache=\"profile\"");
+        writer.counter("chat_cache_misses_total", "Local cache misses.", profile.misses, "cache=\"profile\"");
+        LocationCacheStats location = _presence.getLocationCacheStats();
+        writer.counter("chat_cache_hits_total", "Local cache hits.", location.hits, "cache=\"location\"");
+        writer.counter("chat_cache_misses_total", "Local cache misses.", location.misses, "cache=\"location\"");
+
+        OfflineWriterStats offline = _offLineMsgWriter.getStats();
+        writer.counter("chat_offline_rows_total", "Offline messages written to the database.", offline.rows);
+        writer.counter("chat_offline_blocked_total", "Offline writes that waited for room in the queue.", offline.blocked);
+        writer.counter("chat_offline_retried_total", "Offline messages retried one by one after a failed batch.", offline.retried);
+        writer.counter("chat_offline_failed_total", "Offline messages dropped after retries failed.", offline.failed);
+        writer.gauge("chat_offline_pending", "Offline messages waiting to be written.", offline.pending);
+
+        RedisPublishStats publish = _redis.getPublishStats();
+        writer.counter("chat_redis_published_total", "Messages published to redis.", publish.published);
+        writer.counter("chat_redis_publish_failed_total", "Publishes that failed or returned an error.", publish.failed);
+        writer.counter("chat_redis_publish_rejected_total", "Publishes rejected because the queue was full.", publish.rejected);
+        writer.counter("chat_redis_publish_retried_total", "Publishes retried to a node that was not subscribed.", publish.retried);
+        writer.counter("chat_redis_publish_undelivered_total", "Publishes handed back as undelivered.", publish.undelivered);
+        writer.gauge("chat_redis_publish_pending", "Publishes waiting in the sender queue.", publish.pending);
+
+        RedisSubscriberStats subscriber = _redis.getSubscriberStats();
+        writer.counter("chat_redis_messages_total", "Channel messages received from redis.", subscriber.messages);
+        writer.counter("chat_redis_reconnects_total", "Subscriber reconnects.", subscriber.reconnects);
+        writer.gauge("chat_redis_subscriber_connected", "Whether the subscriber connection is up.", subscriber.connected); });
 }
 
 // 处理客户端异常退出
 void ChatService::clientCloseException(const muduo::net::TcpConnectionPtr &conn)
 {
-    User user;
+    // 连接上记录了登录的用户id，不需要遍历连接表查找
+    ConnContextPtr context = getConnContext(conn);
+    if (context == nullptr)
     {
-        std::lock_guard<std::mutex> lock(_connMutex);
-        for (auto it = _userConnMap.begin(); it != _userConnMap.end(); it++)
-        {
-            if (it->second == conn)
-            {
-                // 从map表删除用户的连接信息
-                user.setId(it->first);
-                _userConnMap.erase(it);
-                break;
-            }
-        }
+        return;
     }
+    int userid = context->userid.exchange(-1);
 
-    // 用户注销，相当于就是下线，在redis中取消订阅通道
-    _redis.unsubscribe(user.getId());
-
-    // 更新用户的状态信息
-    if (user.getId() != -1)
+    // 从连接表删除用户的连接信息，用户下线
+    if (userid != -1 && _userConnMap.erase(userid, conn))
     {
-        user.setState("offline");
-        _userModel.updateState(user);
+        _presence.logout(userid);
+        _credentialCache.touch(userid);
     }
 }
 
@@ -95,22 +298,28 @@ void ChatService::clientCloseException(const muduo::net::TcpConnectionPtr &conn)
 void ChatService::loginout(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time)
 {
     int userid = js["id"];
+    ConnContextPtr context = getConnContext(conn);
+    if (context != nullptr)
     {
-        std::lock_guard<std::mutex> lock(_connMutex);
-        auto it = _userConnMap.find(userid);
-        if (it != _userConnMap.end())
-        {
-            _userConnMap.erase(it);
-        }
+        context->userid = -1;
     }
 
-    // 用户注销，相当于就是下线，在redis中取消订阅通道
-    _redis.unsubscribe(userid);
+    // 用户注销，相当于就是下线，只处理这个连接上登录的用户
+    if (_userConnMap.erase(userid, conn))
+    {
+        _presence.logout(userid);
+        _credentialCache.touch(userid);
+    }
+}
 
-    // 更新用户的状态信息
-    User user(userid);
-    user.setState("offline");
-    _userModel.updateState(user);
+// 发送登录失败的响应
+static void sendLoginError(const muduo::net::TcpConnectionPtr &conn, int err, const char *errmsg)
+{
+    json response;
+    response["msgid"] = LOGIN_MSG_ACK;
+    response["errno"] = err;
+    response["errmsg"] = errmsg;
+    ChatCodec::send(conn, LOGIN_MSG_ACK, response);
 }
 
 // 处理登录业务
@@ -119,116 +328,356 @@ void ChatService::login(const muduo::net::TcpConnectionPtr &conn,
 {
     int id = js["id"];
     std::string pwd = js["password"];
-    User user = _userModel.query(id);
-    if (user.getId() == id)
+
+    // 最近验证通过的凭据直接放行，断线重连时不查询数据库也不计算加盐哈希
+    std::string name;
+    if (_credentialCache.verify(id, pwd, name))
+    {
+        finishLogin(conn, js, id, name);
+        return;
+    }
+
+    // 验证密码的计算量很大，投递到有界的验证线程池，排队的请求过多时直接拒绝，客户端稍后重试
+    // 验证期间该连接的后续消息暂存，验证结果交回本线程生效之后再处理
+    ConnContextPtr context = getConnContext(conn);
+    if (context != nullptr)
     {
-        if (user.getPwd() == pwd)
+        context->authPending = true;
+    }
+    if (!submitAuthTask(id, [this, conn, js, id, pwd]() mutable
+                        { authenticate(conn, js, id, pwd); }))
+    {
+        if (context != nullptr)
         {
-            if (user.getState() == "online")
+            context->authPending = false;
+        }
+        sendLoginError(conn, 4, "服务器繁忙，请稍后重试");
+    }
+}
+
+// 在验证线程中查询凭据并验证密码
+void ChatService::authenticate(const muduo::net::TcpConnectionPtr &conn, json &js, int id, const std::string &pwd)
+{
+    // 排队期间客户端已经断开或者服务器正在退出时不再验证，仍然交回业务线程清除验证状态
+    int err = -1;
+    std::string name;
+    if (conn->connected() && !_authStopped)
+    {
+        RequestTrace trace(LOGIN_MSG);
+        User user;
+        bool verified = false;
+        {
+            ScopedLatency latency(_authLatency);
             {
-                // 该账号已经登录，不允许重复登录
-                json response;
-                response["msgid"] = LOGIN_MSG_ACK;
-                response["errno"] = 3;
-                response["errmsg"] = "该账号已经登录，请重新输入新账号";
-                conn->send(response.dump());
+                TRACE_SPAN("credential_query");
+                user = _userModel.queryCredential(id);
             }
-            else
+            if (user.getId() == id)
             {
-                // 登录成功 记录用户连接信息
+                TRACE_SPAN("password_verify");
+                verified = PasswordHash::verify(pwd, user.getPwd());
+            }
+        }
+        // 1 用户名不存在，2 用户名或密码错误
+        err = user.getId() != id ? 1 : (verified ? 0 : 2);
+        if (err == 0)
+        {
+            // 旧版本存储的明文密码和迭代次数与当前设置不同的哈希，验证通过后重新计算
+            if (PasswordHash::needsRehash(user.getPwd()))
+            {
+                TRACE_SPAN("password_upgrade");
+                std::string record = PasswordHash::hash(pwd);
+                if (!record.empty())
                 {
-                    std::lock_guard<std::mutex> lock(_connMutex);
-                    _userConnMap.insert({id, conn});
+                    _userModel.updatePassword(id, record);
                 }
+            }
+            _credentialCache.put(id, user.getName(), pwd);
+            name = user.getName();
+        }
+    }
 
-                // id用户登录成功以后，向redis订阅channel(id)
-                _redis.subscribe(id);
+    // 登录的后续处理和该连接的其它消息在同一个业务线程中串行执行
+    runInConnThread(conn, [this, conn, js, id, name, err]() mutable
+                    { completeAuth(conn, js, id, name, err); });
+}
 
-                // 登录成功 更新用户状态信息  state offline=>online
-                user.setState("online");
-                _userModel.updateState(user);
+// 在连接所属的业务线程中执行任务
+void ChatService::runInConnThread(const muduo::net::TcpConnectionPtr &conn, std::function<void()> task)
+{
+    if (_connExecutor)
+    {
+        _connExecutor(conn, std::move(task));
+    }
+    else
+    {
+        task();
+    }
+}
 
-                json response;
-                response["msgid"] = LOGIN_MSG_ACK;
-                response["errno"] = 0;
-                response["id"] = user.getId();
-                response["name"] = user.getName();
-                // 查询该用户是否有离线消息
-                std::vector<std::string> vec = _offLineMsgModel.query(id);
-                if (!vec.empty())
-                {
-                    response["offLineMsg"] = vec;
-                    // 读取该用户的离线消息后，把该用户的所有离线消息删除掉
-                    _offLineMsgModel.remove(id);
-                }
-                // 查询该用户的好友信息并返回
-                std::vector<User> userVec = _friendModel.query(id);
-                if (!userVec.empty())
-                {
-                    std::vector<std::string> vec2;
-                    for (User &user : userVec)
-                    {
-                        json js;
-                        js["id"] = user.getId();
-                        js["name"] = user.getName();
-                        js["state"] = user.getState();
-                        vec2.push_back(js.dump());
-                    }
+// 在连接所属的业务线程中应用验证结果
+void ChatService::completeAuth(const muduo::net::TcpConnectionPtr &conn, json &js, int id, const std::string &name, int err)
+{
+    if (!conn->connected())
+    {
+        resumeDeferred(conn);
+        return;
+    }
 
-                    // response["friends"] = js.parse(userVec);
-                    response["friends"] = vec2;
-                }
+    if (err == 1)
+    {
+        // 用户名不存在
+        sendLoginError(conn, 1, "用户名不存在");
+    }
+    else if (err == 2)
+    {
+        // 登录失败吗，用户名或密码错误
+        sendLoginError(conn, 2, "用户名或密码错误");
+    }
+    else if (err == 0)
+    {
+        RequestTrace trace(LOGIN_MSG);
+        finishLogin(conn, js, id, name);
+    }
+    resumeDeferred(conn);
+}
+
+// 清除连接的验证状态，按收到的顺序处理验证期间暂存的消息
+void ChatService::resumeDeferred(const muduo::net::TcpConnectionPtr &conn)
+{
+    ConnContextPtr context = getConnContext(conn);
+    if (context == nullptr)
+    {
+        return;
+    }
+    context->authPending = false;
+    std::vector<DeferredMessage> deferred;
+    deferred.swap(context->deferred);
+    // 连接已经断开时直接丢弃
+    if (!conn->connected())
+    {
+        return;
+    }
+    // 其中再次出现的登录或注册请求会重新暂存之后的消息
+    for (DeferredMessage &message : deferred)
+    {
+        try
+        {
+            dispatch(message.msgid, conn, message.js, message.time);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_INFO << "handle error:" << e.what() << " " << message.js.dump();
+        }
+    }
+}
+
+// 投递验证任务，排队的任务数或者预计的排队时间超过上限时返回false
+bool ChatService::submitAuthTask(size_t key, std::function<void()> task)
+{
+    long long pending = _pendingAuth.fetch_add(1);
+    long long expectedWaitUs = pending * _authCostUs.load() / _authThreads;
+    if (pending >= kMaxPendingAuth || expectedWaitUs > kMaxAuthWaitUs)
+    {
+        --_pendingAuth;
+        _authRejected->add();
+        return false;
+    }
+    _authPool.dispatch(key, [this, task = std::move(task)]()
+                       {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        task();
+        updateAuthCost(begin);
+        --_pendingAuth; });
+    return true;
+}
+
+// 用一个验证任务的实际耗时更新平均耗时的估计
+void ChatService::updateAuthCost(std::chrono::steady_clock::time_point begin)
+{
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+    // 指数移动平均，多个验证线程同时更新时偶尔丢失一次样本，不影响估计
+    long long cost = _authCostUs.load();
+    _authCostUs = cost == 0 ? us : cost + (us - cost) / 8;
+}
 
-                // 查询用户的群组信息
-                std::vector<Group> groupuserVec = _groupModel.queryGroups(id);
-                if (!groupuserVec.empty())
+// 密码验证通过，记录用户的连接和在线状态，返回好友、群组和离线消息
+void ChatService::finishLogin(const muduo::net::TcpConnectionPtr &conn, json &js, int id, const std::string &name)
+{
+    // 本服务器上的重复登录由连接表判断，其它服务器上的由redis位置目录判断
+    bool loggedIn = !_userConnMap.insert(id, conn);
+    if (!loggedIn && !_presence.login(id))
+    {
+        // 用户在其它服务器上在线，本服务器缓存的凭据按下线处理
+        _userConnMap.erase(id, conn);
+        _credentialCache.touch(id);
+        loggedIn = true;
+    }
+    if (loggedIn)
+    {
+        // 该账号已经登录，不允许重复登录
+        sendLoginError(conn, 3, "该账号已经登录，请重新输入新账号");
+    }
+    else
+    {
+        // 登录成功 连接表和位置目录都已经记录，在连接上记录登录的用户
+        ConnContextPtr context = getConnContext(conn);
+        if (context != nullptr)
+        {
+            context->userid = id;
+        }
+        // 验证期间连接可能已经断开，断开的清理已经执行过时由这里让用户下线
+        if (!conn->connected())
+        {
+            if (context == nullptr || context->userid.exchange(-1) == id)
+            {
+                _userConnMap.erase(id, conn);
+                _presence.logout(id);
+                _credentialCache.touch(id);
+            }
+            return;
+        }
+
+        json response;
+        response["msgid"] = LOGIN_MSG_ACK;
+        response["errno"] = 0;
+        response["id"] = id;
+        response["name"] = name;
+        // 查询该用户是否有离线消息，先等待队列中写给该用户还没落库的离线消息写入
+        {
+            TRACE_SPAN("offline_flush");
+            _offLineMsgWriter.flush(id);
+        }
+        // 支持分页同步的客户端，登录响应之后再分页推送离线消息，登录耗时和离线消息的数量无关
+        bool offlineSync = js.contains("offlineSync") && js["offlineSync"].get<bool>();
+        if (offlineSync)
+        {
+            response["offlineSync"] = true;
+        }
+        else
+        {
+            TRACE_SPAN("offline_query");
+            std::vector<std::string> vec = _offLineMsgModel.query(id);
+            if (!vec.empty())
+            {
+                response["offLineMsg"] = vec;
+                // 读取该用户的离线消息后，把该用户的所有离线消息删除掉
+                _offLineMsgModel.remove(id);
+            }
+        }
+        // 查询该用户的好友信息并返回，好友id和用户名都优先使用本地缓存
+        FriendList friends;
+        {
+            TRACE_SPAN("friend_query");
+            friends = getFriends(id);
+        }
+        // 客户端带上了已有好友列表的版本号时，只返回之后新增的好友，版本号比当前的还新说明客户端的列表无效，返回全部好友
+        bool hasVersion = js.contains("friendsVersion");
+        long long knownVersion = hasVersion ? js["friendsVersion"].get<long long>() : 0;
+        bool friendsDelta = hasVersion && knownVersion >= 0 && knownVersion <= friends->version();
+        response["friendsVersion"] = friends->version();
+        if (hasVersion)
+        {
+            response["friendsDelta"] = friendsDelta;
+        }
+        if (!friends->ids.empty())
+        {
+            TRACE_SPAN("friend_json");
+            size_t begin = friendsDelta
+                               ? std::upper_bound(friends->seqs.begin(), friends->seqs.end(), knownVersion) - friends->seqs.begin()
+                               : 0;
+            std::vector<int> friendIds(friends->ids.begin() + begin, friends->ids.end());
+            std::vector<std::string> names = getUserNames(friendIds);
+            // 好友的在线状态从在线状态服务查询，数据库中的state字段不再维护
+            std::unordered_set<int> online = _presence.onlineUsers(friends->ids);
+            std::vector<std::string> vec2;
+            for (size_t i = 0; i < friendIds.size(); ++i)
+            {
+                json js;
+                js["id"] = friendIds[i];
+                js["name"] = names[i];
+                js["state"] = online.count(friendIds[i]) ? "online" : "offline";
+                vec2.push_back(js.dump());
+            }
+            if (!vec2.empty())
+            {
+                response["friends"] = vec2;
+            }
+            if (friendsDelta)
+            {
+                // 客户端已有的好友只需要更新在线状态
+                std::vector<int> onlineFriends;
+                for (int friendid : friends->ids)
                 {
-                    // group:[{groupid:[xxx, xxx, xxx, xxx]}]
-                    std::vector<std::string> groupV;
-                    for (Group &group : groupuserVec)
+                    if (online.count(friendid))
                     {
-                        json grpjson;
-                        grpjson["id"] = group.getId();
-                        grpjson["groupname"] = group.getName();
-                        grpjson["groupdesc"] = group.getDesc();
-                        std::vector<std::string> userV;
-                        for (GroupUser &user : group.getUsers())
-                        {
-                            json js;
-                            js["id"] = user.getId();
-                            js["name"] = user.getName();
-                            js["state"] = user.getState();
-                            js["role"] = user.getRole();
-                            userV.push_back(js.dump());
-                        }
-                        grpjson["users"] = userV;
-                        groupV.push_back(grpjson.dump());
+                        onlineFriends.push_back(friendid);
                     }
-
-                    response["groups"] = groupV;
                 }
+                response["onlineFriends"] = onlineFriends;
+            }
+        }
 
-                conn->send(response.dump());
+        // 查询用户的群组信息，客户端设置了lazyGroups时不返回群组成员
+        bool lazyGroups = js.contains("lazyGroups") && js["lazyGroups"].get<bool>();
+        std::vector<Group> groupuserVec;
+        {
+            TRACE_SPAN("group_query");
+            groupuserVec = _groupModel.queryGroups(id, !lazyGroups);
+        }
+        if (!groupuserVec.empty())
+        {
+            TRACE_SPAN("group_json");
+            // 所有群组成员的在线状态合并成一次查询
+            std::vector<int> memberIds;
+            for (Group &group : groupuserVec)
+            {
+                for (GroupUser &user : group.getUsers())
+                {
+                    memberIds.push_back(user.getId());
+                }
+            }
+            std::unordered_set<int> online = _presence.onlineUsers(memberIds);
+            // group:[{groupid:[xxx, xxx, xxx, xxx]}]
+            std::vector<std::string> groupV;
+            for (Group &group : groupuserVec)
+            {
+                json grpjson;
+                grpjson["id"] = group.getId();
+                grpjson["groupname"] = group.getName();
+                grpjson["groupdesc"] = group.getDesc();
+                std::vector<std::string> userV;
+                for (GroupUser &user : group.getUsers())
+                {
+                    json js;
+                    js["id"] = user.getId();
+                    js["name"] = user.getName();
+                    js["state"] = online.count(user.getId()) ? "online" : "offline";
+                    js["role"] = user.getRole();
+                    userV.push_back(js.dump());
+                }
+                if (!lazyGroups)
+                {
+                    grpjson["users"] = userV;
+                }
+                groupV.push_back(grpjson.dump());
             }
+
+            response["groups"] = groupV;
         }
-        else
+
         {
-            // 登录失败吗，用户名或密码错误
-            json response;
-            response["msgid"] = LOGIN_MSG_ACK;
-            response["errno"] = 2;
-            response["errmsg"] = "用户名或密码错误";
-            conn->send(response.dump());
+            TRACE_SPAN("send_response");
+            ChatCodec::send(conn, LOGIN_MSG_ACK, response);
+        }
+
+        if (offlineSync)
+        {
+            // 推送第一页离线消息，客户端确认之后再推送下一页
+            sendOfflinePage(conn, id, 0);
         }
-    }
-    else
-    {
-        // 用户名不存在
-        json response;
-        response["msgid"] = LOGIN_MSG_ACK;
-        response["errno"] = 1;
-        response["errmsg"] = "用户名不存在";
-        conn->send(response.dump());
     }
 
     LOG_INFO << "do login service!!!";
@@ -240,26 +689,49 @@ void ChatService::reg(const muduo::net::TcpConnectionPtr &conn,
 {
     std::string name = js["name"];
     std::string pwd = js["password"];
-    User user;
-    user.setName(name);
-    user.setPwd(pwd);
-    bool state = _userModel.insert(user);
-    if (state)
+    // 密码只存储加盐哈希，计算量很大，和登录验证一样投递到验证线程池
+    // 注册期间该连接的后续消息暂存，响应在连接所属的业务线程中发送
+    auto task = [this, conn, name, pwd]()
     {
-        // 注册成功
-        json response;
-        response["msgid"] = REG_MSG_ACK;
-        response["errno"] = 0;
-        response["id"] = user.getId();
-        conn->send(response.dump());
+        User user;
+        user.setName(name);
+        user.setPwd(PasswordHash::hash(pwd));
+        bool state = !user.getPwd().empty() && _userModel.insert(user);
+        int id = user.getId();
+        runInConnThread(conn, [this, conn, state, id]()
+                        {
+            json response;
+            response["msgid"] = REG_MSG_ACK;
+            if (state)
+            {
+                // 注册成功
+                response["errno"] = 0;
+                response["id"] = id;
+            }
+            else
+            {
+                // 注册失败
+                response["errno"] = 1;
+            }
+            ChatCodec::send(conn, REG_MSG_ACK, response);
+            resumeDeferred(conn); });
+    };
+    ConnContextPtr context = getConnContext(conn);
+    if (context != nullptr)
+    {
+        context->authPending = true;
     }
-    else
+    if (!submitAuthTask(reinterpret_cast<size_t>(conn.get()), std::move(task)))
     {
-        // 注册失败
+        if (context != nullptr)
+        {
+            context->authPending = false;
+        }
+        // 服务器繁忙，注册失败
         json response;
         response["msgid"] = REG_MSG_ACK;
         response["errno"] = 1;
-        conn->send(response.dump());
+        ChatCodec::send(conn, REG_MSG_ACK, response);
     }
 
     // LOG_INFO << "do reg service!!!";
@@ -269,28 +741,28 @@ void ChatService::reg(const muduo::net::TcpConnectionPtr &conn,
 void ChatService::oneChat(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time)
 {
     int toid = js["to"];
-    bool userState = false;
+    EncodedMessagePtr message;
     {
-        std::lock_guard<std::mutex> lock(_connMutex);
-        auto it = _userConnMap.find(toid);
-        if (it != _userConnMap.end())
-        {
-            // toid在线，转发消息 服务器主动推送消息给toid用户
-            it->second->send(js.dump());
-            return;
-        }
+        TRACE_SPAN("encode");
+        message = ChatCodec::encode(ONE_CHAT_MSG, std::move(js));
+    }
+    muduo::net::TcpConnectionPtr toConn = _userConnMap.find(toid);
+    if (toConn != nullptr)
+    {
+        // toid在线，转发消息 服务器主动推送消息给toid用户
+        ChatCodec::send(toConn, message);
+        return;
     }
 
-    // 查询toid是否在线
-    User user = _userModel.query(toid);
-    if (user.getState() == "online")
+    // 查询toid是否登录在其它服务器上，redis发送队列满时和对方不在线一样存储离线消息
+    std::string node = _presence.findUserNode(toid);
+    if (!node.empty() && node != _nodeId && forwardToNode(node, {toid}, message))
     {
-        _redis.publish(toid, js.dump());
         return;
     }
 
     // toid 不在线，存储离线消息
-    _offLineMsgModel.insert(toid, js.dump());
+    _offLineMsgWriter.write(toid, sharedPayload(message));
 }
 
 // 添加好友业务 msgid id friendid
@@ -299,8 +771,13 @@ void ChatService::addFriend(const muduo::net::TcpConnectionPtr &conn, json &js,
     int userid = js["id"];
     int friendid = js["friendid"];
 
-    // 存储好友信息
-    _friendModel.insert(userid, friendid);
+    // 存储好友信息，更新本地的好友列表缓存，并通知集群中的其它服务器
+    long long seq = _friendModel.insert(userid, friendid);
+    if (seq > 0)
+    {
+        _friendCache.addFriend(userid, friendid, seq);
+        _redis.publish(kFriendChannel, std::to_string(userid) + ":" + std::to_string(friendid) + ":" + std::to_string(seq));
+    }
 }
 
 // 创建群组业务
@@ -315,8 +792,11 @@ void ChatService::createGroup(const muduo::net::TcpConnectionPtr &conn, json &js
     Group group(-1, name, desc);
     if (_groupModel.createGroup(group))
     {
-        // 存储群组创建人信息
-        _groupModel.addGroup(userid, group.getId(), "creator");
+        // 存储群组创建人信息，写入成功后才更新群组成员缓存
+        if (_groupModel.addGroup(userid, group.getId(), "creator"))
+        {
+            addGroupMember(group.getId(), userid);
+        }
     }
 }
 
@@ -325,7 +805,11 @@ void ChatService::addGroup(const muduo::net::TcpConnectionPtr &conn, json &js, m
 {
     int userid = js["id"];
     int groupid = js["groupid"];
-    _groupModel.addGroup(userid, groupid, "normal");
+    // 写入失败(例如重复加入或群组不存在)时不更新缓存，也不通知其它服务器
+    if (_groupModel.addGroup(userid, groupid, "normal"))
+    {
+        addGroupMember(groupid, userid);
+    }
 }
 
 // 群组聊天业务
@@ -333,43 +817,351 @@ void ChatService::groupChat(const muduo::net::TcpConnectionPtr &conn, json &js,
 {
     int userid = js["id"];
     int groupid = js["groupid"];
-    std::vector<int> useridVec = _groupModel.queryGroupUsers(userid, groupid);
-    std::lock_guard<std::mutex> lock(_connMutex);
-    for (int id : useridVec)
+    GroupMembers members = getGroupMembers(groupid);
+    // 群消息只序列化一次，本地转发、redis发布和离线存储共享同一份数据
+    EncodedMessagePtr message;
     {
-        auto it = _userConnMap.find(id);
-        if (it != _userConnMap.end())
+        TRACE_SPAN("encode");
+        message = ChatCodec::encode(GROUP_CHAT_MSG, std::move(js));
+    }
+
+    // 批量查询连接表只区分出本服务器上在线的成员(群消息不用转发给自己)
+    // 查询状态、redis发布和存储离线消息都会阻塞，不在连接表的锁内进行
+    std::vector<muduo::net::TcpConnectionPtr> localConns;
+    std::vector<int> remoteIds;
+    _userConnMap.findMany(*members, userid, localConns, remoteIds);
+
+    // 转发群消息
+    {
+        TRACE_SPAN("local_send");
+        for (const muduo::net::TcpConnectionPtr &memberConn : localConns)
         {
-            // 转发群消息
-            it->second->send(js.dump());
+            ChatCodec::send(memberConn, message);
+        }
+    }
+
+    // 其它服务器上的在线成员按所在服务器分组，每个服务器只发布一次，消息内容只携带一份
+    std::unordered_map<std::string, std::vector<int>> byNode;
+    std::vector<int> offlineIds;
+    _presence.findUserNodes(remoteIds, byNode, offlineIds);
+    for (auto &item : byNode)
+    {
+        // redis发送队列满时和不在线一样存储离线消息
+        if (item.first == _nodeId || !forwardToNode(item.first, item.second, message))
+        {
+            offlineIds.insert(offlineIds.end(), item.second.begin(), item.second.end());
+        }
+    }
+
+    std::vector<OfflineMessage> offlineMsgs;
+    offlineMsgs.reserve(offlineIds.size());
+    for (int id : offlineIds)
+    {
+        offlineMsgs.push_back(OfflineMessage{id, sharedPayload(message)});
+    }
+    // 存储离线群消息，所有离线成员合并成一次批量写入
+    _offLineMsgWriter.write(std::move(offlineMsgs));
+}
+
+// 客户端确认收到一页离线消息 msgid cursor
+void ChatService::offlineMsgAck(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time)
+{
+    // 只能确认当前连接上登录用户的离线消息
+    ConnContextPtr context = getConnContext(conn);
+    int userid = context != nullptr ? context->userid.load() : -1;
+    if (userid == -1)
+    {
+        return;
+    }
+    long long cursor = js["cursor"];
+
+    // 客户端已经收到cursor及之前的消息，从数据库删除，然后推送下一页
+    _offLineMsgModel.remove(userid, cursor);
+    sendOfflinePage(conn, userid, cursor);
+}
+
+// 查询群组成员 msgid groupid
+void ChatService::queryGroupUsers(const muduo::net::TcpConnectionPtr &conn, json &js, muduo::Timestamp time)
+{
+    ConnContextPtr context = getConnContext(conn);
+    int userid = context != nullptr ? context->userid.load() : -1;
+    if (userid == -1)
+    {
+        return;
+    }
+    int groupid = js["groupid"].get<int>();
+
+    json response;
+    response["msgid"] = QUERY_GROUP_USERS_MSG_ACK;
+    response["groupid"] = groupid;
+    // 只有群组成员可以查询成员列表
+    GroupMembers members = getGroupMembers(groupid);
+    if (!std::binary_search(members->begin(), members->end(), userid))
+    {
+        response["errno"] = 1;
+        response["errmsg"] = "not a member of this group!";
+        ChatCodec::send(conn, QUERY_GROUP_USERS_MSG_ACK, response);
+        return;
+    }
+
+    std::vector<GroupUser> users = _groupModel.queryGroupUserInfos(groupid);
+    std::vector<int> userids;
+    for (GroupUser &user : users)
+    {
+        userids.push_back(user.getId());
+    }
+    std::unordered_set<int> online = _presence.onlineUsers(userids);
+    std::vector<std::string> userV;
+    for (GroupUser &user : users)
+    {
+        json userjs;
+        userjs["id"] = user.getId();
+        userjs["name"] = user.getName();
+        userjs["state"] = online.count(user.getId()) ? "online" : "offline";
+        userjs["role"] = user.getRole();
+        userV.push_back(userjs.dump());
+    }
+    response["errno"] = 0;
+    response["users"] = userV;
+    ChatCodec::send(conn, QUERY_GROUP_USERS_MSG_ACK, response);
+}
+
+// 推送userid在afterSeq之后的一页离线消息
+void ChatService::sendOfflinePage(const muduo::net::TcpConnectionPtr &conn, int userid, long long afterSeq)
+{
+    TRACE_SPAN("offline_page");
+    // 多查一条，判断后面是否还有消息
+    std::vector<OfflineRecord> records = _offLineMsgModel.query(userid, afterSeq, kOfflinePageSize + 1);
+    if (records.empty())
+    {
+        return;
+    }
+
+    std::vector<std::string> msgs;
+    size_t bytes = 0;
+    long long cursor = afterSeq;
+    for (size_t i = 0; i < records.size() && i < static_cast<size_t>(kOfflinePageSize); ++i)
+    {
+        // 至少推送一条，避免单条超大的消息卡住同步
+        if (!msgs.empty() && bytes + records[i].msg.size() > kOfflinePageBytes)
+        {
+            break;
+        }
+        bytes += records[i].msg.size();
+        cursor = records[i].seq;
+        msgs.push_back(std::move(records[i].msg));
+    }
+
+    json response;
+    response["msgid"] = OFFLINE_MSG_PAGE;
+    response["msgs"] = msgs;
+    response["cursor"] = cursor;
+    response["more"] = msgs.size() < records.size();
+    ChatCodec::send(conn, OFFLINE_MSG_PAGE, response);
+}
+
+// 处理本服务器路由通道上收到的消息
+void ChatService::handleRedisSubcribeMessage(std::string_view msg)
+{
+    int msgid = 0;
+    std::vector<int> userids;
+    size_t offset = 0;
+    if (!decodeEnvelopeHeader(msg, msgid, userids, offset))
+    {
+        LOG_ERROR << "invalid forwarded message, length:" << msg.size();
+        return;
+    }
+    // msg直接指向redis的响应，消息内容只拷贝一次，编码后由所有本地接收者共享
+    EncodedMessagePtr message = ChatCodec::encode(msgid, std::string(msg.substr(offset)));
+
+    std::vector<OfflineMessage> offlineMsgs;
+    for (int userid : userids)
+    {
+        muduo::net::TcpConnectionPtr conn = _userConnMap.find(userid);
+        if (conn != nullptr)
+        {
+            ChatCodec::send(conn, message);
         }
         else
         {
-            // 查询toid是否在线
-            User user = _userModel.query(id);
-            if (user.getState() == "online")
-            {
-                _redis.publish(id, js.dump());
-            }
-            else
-            {
-                // 存储离线群消息
-                _offLineMsgModel.insert(id, js.dump());
-            }
+            // 用户在转发途中下线，存储该用户的离线消息
+            offlineMsgs.push_back(OfflineMessage{userid, sharedPayload(message)});
         }
     }
+    _offLineMsgWriter.write(std::move(offlineMsgs));
 }
 
-void ChatService::handleRedisSubcribeMessage(int userid, std::string msg)
+// 处理redis订阅连接重连
+void ChatService::handleRedisReconnect()
 {
-    std::lock_guard<std::mutex> lock(_connMutex);
-    auto it = _userConnMap.find(userid);
-    if (it != _userConnMap.end())
+    // 断开期间可能错过了在线状态、群组成员和好友关系的变更通知，丢弃本地缓存重新加载
+    _groupCache.clear();
+    _friendCache.clear();
+
+    // redis可能已经重启，重新登记本服务器的心跳和所有在线用户的位置
+    std::vector<int> userids = _userConnMap.userIds();
+    _presence.resync(userids);
+    LOG_INFO << "redis subscriber reconnected, re-registered " << userids.size() << " users";
+}
+
+// 处理无法送达其它服务器的消息
+void ChatService::handleRedisUndelivered(const std::string &header, std::shared_ptr<const std::string> payload)
+{
+    int msgid = 0;
+    std::vector<int> userids;
+    size_t offset = 0;
+    if (!decodeEnvelopeHeader(header, msgid, userids, offset))
     {
-        it->second->send(msg);
         return;
     }
+    // 目标服务器长时间没有订阅路由通道，可能已经宕机，为接收者存储离线消息，消息内容仍然共享同一份
+    std::vector<OfflineMessage> offlineMsgs;
+    for (int userid : userids)
+    {
+        offlineMsgs.push_back(OfflineMessage{userid, payload});
+    }
+    _offLineMsgWriter.write(std::move(offlineMsgs));
+}
 
-    // 存储该用户的离线消息
-    _offLineMsgModel.insert(userid, msg);
+// 处理redis控制通道上其它服务器发来的通知
+void ChatService::handleRedisControlMessage(std::string channel, std::string msg)
+{
+    if (channel == PresenceService::channel())
+    {
+        _presence.handleControlMessage(msg);
+    }
+    else if (channel == kGroupChannel)
+    {
+        // 消息格式为 groupid:userid，表示userid加入了groupid
+        size_t idx = msg.find(':');
+        if (idx == std::string::npos)
+        {
+            LOG_ERROR << "invalid group message:" << msg;
+            return;
+        }
+        _groupCache.addMember(atoi(msg.substr(0, idx).c_str()), atoi(msg.substr(idx + 1).c_str()));
+    }
+    else if (channel == kFriendChannel)
+    {
+        // 消息格式为 userid:friendid:seq，表示userid添加了好友friendid
+        size_t idx = msg.find(':');
+        size_t seqIdx = idx == std::string::npos ? std::string::npos : msg.find(':', idx + 1);
+        if (seqIdx == std::string::npos)
+        {
+            LOG_ERROR << "invalid friend message:" << msg;
+            return;
+        }
+        _friendCache.addFriend(atoi(msg.substr(0, idx).c_str()), atoi(msg.substr(idx + 1, seqIdx - idx - 1).c_str()),
+                               atoll(msg.substr(seqIdx + 1).c_str()));
+    }
+}
+
+// 通过node服务器的路由通道转发消息
+bool ChatService::forwardToNode(const std::string &node, const std::vector<int> &userids, const EncodedMessagePtr &message)
+{
+    TRACE_SPAN("forward_to_node");
+    // 消息内容和本地转发、离线存储共享同一份数据，发布时只追加一个很短的头部
+    return _redis.publish_node(node, encodeEnvelopeHeader(message->msgid(), userids), sharedPayload(message));
+}
+
+// 设置离线消息的持久化方式
+void ChatService::setOfflineDurability(EnOfflineDurability durability)
+{
+    _offLineMsgWriter.setDurability(durability);
+}
+
+// 获取离线消息写入的统计信息
+OfflineWriterStats ChatService::getOfflineWriterStats()
+{
+    return _offLineMsgWriter.getStats();
+}
+
+// 获取在线状态缓存的统计信息
+PresenceCacheStats ChatService::getPresenceCacheStats()
+{
+    return _presence.getPresenceCacheStats();
+}
+
+// 获取群组的成员列表，优先使用本地的群组成员缓存
+GroupMembers ChatService::getGroupMembers(int groupid)
+{
+    TRACE_SPAN("group_members");
+    GroupMembers members = _groupCache.get(groupid);
+    if (members == nullptr)
+    {
+        long long version = _groupCache.version();
+        members = _groupCache.put(groupid, _groupModel.queryGroupMembers(groupid), version);
+    }
+    return members;
+}
+
+// 获取用户的好友列表，优先使用本地的好友列表缓存
+FriendList ChatService::getFriends(int userid)
+{
+    FriendList friends = _friendCache.get(userid);
+    if (friends == nullptr)
+    {
+        long long version = _friendCache.version();
+        friends = _friendCache.put(userid, _friendModel.queryIds(userid), version);
+    }
+    return friends;
+}
+
+// 批量获取用户名，和userids一一对应，优先使用本地的用户资料缓存
+std::vector<std::string> ChatService::getUserNames(const std::vector<int> &userids)
+{
+    std::vector<std::string> names;
+    std::vector<int> missing;
+    _profileCache.get(userids, names, missing);
+    if (missing.empty())
+    {
+        return names;
+    }
+    // 未命中的用户一次从数据库加载并回填缓存
+    std::unordered_map<int, std::string> loaded;
+    for (User &user : _userModel.queryNames(missing))
+    {
+        _profileCache.put(user.getId(), user.getName());
+        loaded[user.getId()] = user.getName();
+    }
+    for (size_t i = 0; i < userids.size(); ++i)
+    {
+        auto it = loaded.find(userids[i]);
+        if (it != loaded.end())
+        {
+            names[i] = it->second;
+        }
+    }
+    return names;
+}
+
+// 记录群组加入了新成员，并通知集群中的其它服务器
+void ChatService::addGroupMember(int groupid, int userid)
+{
+    _groupCache.addMember(groupid, userid);
+    _redis.publish(kGroupChannel, std::to_string(groupid) + ":" + std::to_string(userid));
+}
+
+// 获取群组成员缓存的统计信息
+GroupCacheStats ChatService::getGroupCacheStats()
+{
+    return _groupCache.getStats();
+}
+
+// 获取redis发布的统计信息
+RedisPublishStats ChatService::getRedisPublishStats()
+{
+    return _redis.getPublishStats();
+}
+
+// 获取位置缓存的统计信息
+LocationCacheStats ChatService::getLocationCacheStats()
+{
+    return _presence.getLocationCacheStats();
+}
+
+// 获取redis订阅的统计信息
+RedisSubscriberStats ChatService::getRedisSubscriberStats()
+{
+    return _redis.getSubscriberStats();
 }
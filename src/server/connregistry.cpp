@@ -0,0 +1,127 @@
+#include "connregistry.hpp"
+
+ConnRegistry::ConnRegistry(int shardCount)
+{
+    size_t count = 1;
+    while (count < static_cast<size_t>(shardCount))
+    {
+        count <<= 1;
+    }
+    _mask = count - 1;
+    for (size_t i = 0; i < count; ++i)
+    {
+        _shards.emplace_back(new Shard());
+    }
+}
+
+size_t ConnRegistry::shardIndex(int userid)
+{
+    // 用户id是自增的，打散一下让相邻的用户落到不同的分片
+    return (static_cast<uint32_t>(userid) * 2654435761u) & _mask;
+}
+
+ConnRegistry::Shard &ConnRegistry::shardOf(int userid)
+{
+    return *_shards[shardIndex(userid)];
+}
+
+// 查询用户的连接
+muduo::net::TcpConnectionPtr ConnRegistry::find(int userid)
+{
+    Shard &shard = shardOf(userid);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.conns.find(userid);
+    if (it == shard.conns.end())
+    {
+        return nullptr;
+    }
+    return it->second;
+}
+
+// 记录用户的连接
+bool ConnRegistry::insert(int userid, const muduo::net::TcpConnectionPtr &conn)
+{
+    Shard &shard = shardOf(userid);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.conns.insert({userid, conn}).second;
+}
+
+// 只在用户当前的连接是conn时删除
+bool ConnRegistry::erase(int userid, const muduo::net::TcpConnectionPtr &conn)
+{
+    Shard &shard = shardOf(userid);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.conns.find(userid);
+    if (it == shard.conns.end() || it->second != conn)
+    {
+        return false;
+    }
+    shard.conns.erase(it);
+    return true;
+}
+
+// 批量查询
+void ConnRegistry::findMany(const std::vector<int> &userids, int exclude,
+                            std::vector<muduo::net::TcpConnectionPtr> &found,
+                            std::vector<int> &missing)
+{
+    // 先按分片把用户id分组，再逐个分片加锁查询
+    std::vector<std::vector<int>> buckets(_shards.size());
+    for (int userid : userids)
+    {
+        if (userid == exclude)
+        {
+            continue;
+        }
+        buckets[shardIndex(userid)].push_back(userid);
+    }
+
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        if (buckets[i].empty())
+        {
+            continue;
+        }
+        Shard &shard = *_shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (int userid : buckets[i])
+        {
+            auto it = shard.conns.find(userid);
+            if (it != shard.conns.end())
+            {
+                found.push_back(it->second);
+            }
+            else
+            {
+                missing.push_back(userid);
+            }
+        }
+    }
+}
+
+// 在线用户的数量
+size_t ConnRegistry::size()
+{
+    size_t total = 0;
+    for (auto &shard : _shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->conns.size();
+    }
+    return total;
+}
+
+// 所有在线用户的id
+std::vector<int> ConnRegistry::userIds()
+{
+    std::vector<int> ids;
+    for (auto &shard : _shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (auto &item : shard->conns)
+        {
+            ids.push_back(item.first);
+        }
+    }
+    return ids;
+}
@@ -0,0 +1,75 @@
+#include "credentialcache.hpp"
+#include "passwordhash.hpp"
+
+CredentialCache::CredentialCache(std::chrono::seconds ttl, size_t maxUsers)
+    : _ttl(ttl), _maxUsers(maxUsers), _hits(0), _misses(0)
+{
+}
+
+// 验证用户的密码
+bool CredentialCache::verify(int userid, const std::string &password, std::string &name)
+{
+    // HMAC在锁外计算
+    std::string fingerprint = PasswordHash::fingerprint(password);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(userid);
+    if (it == _entries.end())
+    {
+        ++_misses;
+        return false;
+    }
+    if (it->second.expire < std::chrono::steady_clock::now())
+    {
+        _entries.erase(it);
+        ++_misses;
+        return false;
+    }
+    // 密码不匹配按未命中处理，由数据库中的记录决定结果
+    if (!PasswordHash::equals(fingerprint, it->second.fingerprint))
+    {
+        ++_misses;
+        return false;
+    }
+    ++_hits;
+    // 用户重新登录，下线之前不再过期
+    it->second.expire = std::chrono::steady_clock::time_point::max();
+    name = it->second.name;
+    return true;
+}
+
+// 放入验证通过的凭据
+void CredentialCache::put(int userid, const std::string &name, const std::string &password)
+{
+    // 验证通过的用户马上登录，下线之前不过期
+    Entry entry{name, PasswordHash::fingerprint(password), std::chrono::steady_clock::time_point::max()};
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_entries.size() >= _maxUsers && _entries.find(userid) == _entries.end() && !_entries.empty())
+    {
+        // 超过容量上限，淘汰一个用户，下次登录时重新验证
+        _entries.erase(_entries.begin());
+    }
+    _entries[userid] = std::move(entry);
+}
+
+// 用户下线，缓存的凭据从现在开始计算过期时间
+void CredentialCache::touch(int userid)
+{
+    std::chrono::steady_clock::time_point expire = std::chrono::steady_clock::now() + _ttl;
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(userid);
+    if (it != _entries.end())
+    {
+        it->second.expire = expire;
+    }
+}
+
+// 获取缓存的统计信息
+CredentialCacheStats CredentialCache::getStats()
+{
+    CredentialCacheStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    std::lock_guard<std::mutex> lock(_mutex);
+    stats.users = _entries.size();
+    return stats;
+}
@@ -0,0 +1,223 @@
+#include "connectionpool.hpp"
+#include "trace.hpp"
+#include <muduo/base/Logging.h>
+#include <thread>
+#include <functional>
+#include <vector>
+
+// 连接池配置信息
+static const int kInitSize = 4;             // 最小连接量
+static const int kMaxSize = 32;             // 最大连接量
+static const int kMaxIdleTime = 60;         // 最大空闲时间(s)
+static const int kConnectionTimeout = 1000; // 获取连接超时时间(ms)
+static const int kHealthCheckTime = 30000;  // 空闲超过30s的连接取出时先ping
+
+// 获取连接池对象实例 线程安全的懒汉单例
+ConnectionPool *ConnectionPool::instance()
+{
+    static ConnectionPool pool;
+    return &pool;
+}
+
+ConnectionPool::ConnectionPool()
+    : _initSize(kInitSize),
+      _maxSize(kMaxSize),
+      _maxIdleTime(kMaxIdleTime),
+      _connectionTimeout(kConnectionTimeout),
+      _healthCheckTime(kHealthCheckTime),
+      _connectionCnt(0),
+      _hits(0), _misses(0), _timeouts(0),
+      _created(0), _destroyed(0),
+      _totalWaitUs(0), _maxWaitUs(0)
+{
+    registerMetrics();
+
+    // 创建初始数量的连接
+    for (int i = 0; i < _initSize; ++i)
+    {
+        MySQL *p = createConnection();
+        if (p != nullptr)
+        {
+            _connectionQue.push(p);
+            ++_connectionCnt;
+        }
+    }
+
+    // 启动一个定时线程，扫描超过maxIdleTime时间的空闲连接，进行连接回收
+    std::thread scanner(std::bind(&ConnectionPool::scannerConnectionTask, this));
+    scanner.detach();
+}
+
+// 注册连接池的指标
+void ConnectionPool::registerMetrics()
+{
+    Metrics *metrics = Metrics::instance();
+    _waitLatency = metrics->histogram("chat_mysql_pool_wait_us", "Time spent acquiring a mysql connection.");
+    metrics->addCollector([this](MetricsWriter &writer)
+                          {
+        ConnectionPoolStats stats = this->getStats();
+        writer.counter("chat_mysql_pool_hits_total", "Acquires served by an idle connection.", stats.hits);
+        writer.counter("chat_mysql_pool_misses_total", "Acquires that had to create or wait for a connection.", stats.misses);
+        writer.counter("chat_mysql_pool_timeouts_total", "Acquires that timed out.", stats.timeouts);
+        writer.counter("chat_mysql_pool_created_total", "Connections created.", stats.created);
+        writer.counter("chat_mysql_pool_destroyed_total", "Idle connections closed by the scanner.", stats.destroyed);
+        writer.gauge("chat_mysql_pool_max_wait_us", "Longest connection acquire time.", stats.maxWaitUs);
+        writer.gauge("chat_mysql_pool_connections", "Idle connections in the pool.", stats.idle, "state=\"idle\"");
+        writer.gauge("chat_mysql_pool_connections", "Connections leased to callers.", stats.total - stats.idle, "state=\"active\""); });
+}
+
+// 创建一条新的连接，失败返回nullptr
+MySQL *ConnectionPool::createConnection()
+{
+    MySQL *p = new MySQL();
+    if (!p->connect())
+    {
+        delete p;
+        return nullptr;
+    }
+    p->refreshAliveTime();
+    ++_created;
+    return p;
+}
+
+// 从连接池中获取一个可用连接
+std::shared_ptr<MySQL> ConnectionPool::getConnection()
+{
+    TRACE_SPAN("db_pool_wait");
+    auto begin = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    if (_connectionQue.empty())
+    {
+        ++_misses;
+        if (_connectionCnt < _maxSize)
+        {
+            // 还没有达到最大连接量，先占住名额，在锁外建立连接
+            ++_connectionCnt;
+            lock.unlock();
+            MySQL *p = createConnection();
+            if (p != nullptr)
+            {
+                recordWait(begin);
+                return lease(p);
+            }
+            lock.lock();
+            --_connectionCnt;
+        }
+
+        // 连接已经用完，等待其它线程归还连接
+        if (!_cv.wait_for(lock, std::chrono::milliseconds(_connectionTimeout),
+                          [&]() -> bool
+                          { return !_connectionQue.empty(); }))
+        {
+            ++_timeouts;
+            LOG_ERROR << "get mysql connection timeout!";
+            return nullptr;
+        }
+    }
+    else
+    {
+        ++_hits;
+    }
+
+    MySQL *p = _connectionQue.front();
+    _connectionQue.pop();
+    lock.unlock();
+
+    // 空闲太久的连接可能已经被mysql server断开，交给业务前先检测
+    if (p->getAliveTime() >= _healthCheckTime && !p->ping())
+    {
+        LOG_INFO << "mysql connection health check fail, reconnect!";
+        delete p;
+        ++_destroyed;
+        p = createConnection();
+        if (p == nullptr)
+        {
+            std::lock_guard<std::mutex> guard(_queueMutex);
+            --_connectionCnt;
+            return nullptr;
+        }
+    }
+
+    recordWait(begin);
+    return lease(p);
+}
+
+// 把连接包装成智能指针，析构时归还连接池
+std::shared_ptr<MySQL> ConnectionPool::lease(MySQL *conn)
+{
+    return std::shared_ptr<MySQL>(conn, [this](MySQL *p)
+                                  {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        p->refreshAliveTime();
+        _connectionQue.push(p);
+        _cv.notify_one(); });
+}
+
+// 记录一次获取连接的耗时
+void ConnectionPool::recordWait(std::chrono::steady_clock::time_point begin)
+{
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+    _totalWaitUs += us;
+    _waitLatency->observe(us);
+    long long prev = _maxWaitUs.load();
+    while (us > prev && !_maxWaitUs.compare_exchange_weak(prev, us))
+    {
+    }
+}
+
+// 扫描超过最大空闲时间的多余连接，进行回收
+void ConnectionPool::scannerConnectionTask()
+{
+    for (;;)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(_maxIdleTime));
+
+        std::vector<MySQL *> expired;
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            // 队头的连接空闲时间最长，没超时的话后面的也不会超时
+            while (_connectionCnt > _initSize && !_connectionQue.empty())
+            {
+                MySQL *p = _connectionQue.front();
+                if (p->getAliveTime() < _maxIdleTime * 1000)
+                {
+                    break;
+                }
+                _connectionQue.pop();
+                --_connectionCnt;
+                expired.push_back(p);
+            }
+        }
+        // 关闭连接涉及网络交互，放在锁外进行
+        for (MySQL *p : expired)
+        {
+            delete p;
+            ++_destroyed;
+        }
+
+        ConnectionPoolStats stats = getStats();
+        LOG_INFO << "mysql pool total:" << stats.total << " idle:" << stats.idle
+                 << " hits:" << stats.hits << " misses:" << stats.misses
+                 << " timeouts:" << stats.timeouts
+                 << " maxWaitUs:" << stats.maxWaitUs;
+    }
+}
+
+// 获取连接池的统计信息
+ConnectionPoolStats ConnectionPool::getStats()
+{
+    ConnectionPoolStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    stats.timeouts = _timeouts;
+    stats.created = _created;
+    stats.destroyed = _destroyed;
+    stats.totalWaitUs = _totalWaitUs;
+    stats.maxWaitUs = _maxWaitUs;
+    std::lock_guard<std::mutex> lock(_queueMutex);
+    stats.idle = _connectionQue.size();
+    stats.total = _connectionCnt;
+    return stats;
+}
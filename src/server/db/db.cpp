@@ -1,4 +1,5 @@
 #include "db.h"
+#include "trace.hpp"
 #include <muduo/base/Logging.h>
 
 // 数据库配置信息
@@ -13,11 +14,14 @@ static std::string dbname = "chat";
 MySQL::MySQL()
 {
     _conn = mysql_init(nullptr);
+    refreshAliveTime();
 }
 
 // 释放数据库连接资源
 MySQL::~MySQL()
 {
+    // 预处理语句必须在关闭连接之前释放
+    _statements.clear();
     if (_conn != nullptr)
         mysql_close(_conn);
 }
@@ -46,6 +50,12 @@ bool MySQL::connect()
 // 更新操作
 bool MySQL::update(std::string sql)
 {
+    // sql中拼接了参数值，不能按sql缓存，直接执行的更新语句共用一个指标，只在第一次调用时查找
+    static Histogram *histogram = Metrics::instance()->histogram(
+        "chat_db_query_latency_us", "Database statement run time.", "query=\"raw_update\"");
+    ScopedLatency latency(histogram);
+    static const char *spanName = Trace::intern("db:raw_update");
+    TraceSpan span(spanName);
     if (mysql_query(_conn, sql.c_str()))
     {
         LOG_INFO << __FILE__ << ":" << __LINE__ << ":"
@@ -58,6 +68,12 @@ bool MySQL::update(std::string sql)
 // 查询操作
 MYSQL_RES *MySQL::query(std::string sql)
 {
+    // 直接执行的查询语句共用一个指标，只在第一次调用时查找
+    static Histogram *histogram = Metrics::instance()->histogram(
+        "chat_db_query_latency_us", "Database statement run time.", "query=\"raw_query\"");
+    ScopedLatency latency(histogram);
+    static const char *spanName = Trace::intern("db:raw_query");
+    TraceSpan span(spanName);
     if (mysql_query(_conn, sql.c_str()))
     {
         LOG_INFO << __FILE__ << ":" << __LINE__ << ":"
@@ -67,7 +83,51 @@ MYSQL_RES *MySQL::query(std::string sql)
     return mysql_use_result(_conn);
 }
 
+// 获取预处理语句
+Statement *MySQL::prepare(const std::string &sql)
+{
+    auto it = _statements.find(sql);
+    if (it != _statements.end())
+    {
+        if (!it->second->broken())
+        {
+            return it->second.get();
+        }
+        // 上次执行失败的语句重新预处理
+        _statements.erase(it);
+    }
+
+    std::unique_ptr<Statement> stmt(new Statement(_conn));
+    if (!stmt->prepare(sql))
+    {
+        return nullptr;
+    }
+    Statement *p = stmt.get();
+    _statements.emplace(sql, std::move(stmt));
+    return p;
+}
+
 MYSQL *MySQL::getConnection()
 {
     return this->_conn;
 }
+
+// 检测连接是否可用
+bool MySQL::ping()
+{
+    return mysql_ping(_conn) == 0;
+}
+
+// 刷新连接进入空闲状态的起始时间点
+void MySQL::refreshAliveTime()
+{
+    _alivetime = std::chrono::steady_clock::now();
+}
+
+// 返回连接空闲的时长(ms)
+long long MySQL::getAliveTime()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - _alivetime)
+        .count();
+}
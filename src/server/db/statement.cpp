@@ -0,0 +1,301 @@
+#include "statement.hpp"
+#include "trace.hpp"
+#include <muduo/base/Logging.h>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+// 字符串结果列的初始缓冲区大小，更长的值在fetch时扩容
+static const size_t kInitColumnLen = 256;
+
+// 判断结果列是否按整数绑定
+static bool isIntegerType(enum_field_types type)
+{
+    return type == MYSQL_TYPE_TINY || type == MYSQL_TYPE_SHORT || type == MYSQL_TYPE_INT24 ||
+           type == MYSQL_TYPE_LONG || type == MYSQL_TYPE_LONGLONG;
+}
+
+Statement::Statement(MYSQL *conn)
+    : _conn(conn), _stmt(nullptr), _broken(false), _hasResult(false),
+      _latency(nullptr), _errors(nullptr), _spanName(nullptr)
+{
+}
+
+Statement::~Statement()
+{
+    if (_stmt != nullptr)
+    {
+        if (_hasResult)
+        {
+            mysql_stmt_free_result(_stmt);
+        }
+        mysql_stmt_close(_stmt);
+    }
+}
+
+// 预处理sql，准备参数和结果列的绑定
+bool Statement::prepare(const std::string &sql)
+{
+    _sql = sql;
+    std::string labels = "query=\"" + metricName(sql) + "\"";
+    _latency = Metrics::instance()->histogram("chat_db_query_latency_us", "Database statement run time.", labels);
+    _errors = Metrics::instance()->counter("chat_db_query_errors_total", "Database statements that failed.", labels);
+    _spanName = Trace::intern("db:" + metricName(sql));
+    _stmt = mysql_stmt_init(_conn);
+    if (_stmt == nullptr)
+    {
+        LOG_ERROR << "mysql_stmt_init fail!";
+        _broken = true;
+        return false;
+    }
+    if (mysql_stmt_prepare(_stmt, sql.c_str(), sql.size()))
+    {
+        LOG_ERROR << __FILE__ << ":" << __LINE__ << ":" << sql
+                  << "预处理失败! " << mysql_stmt_error(_stmt);
+        _broken = true;
+        return false;
+    }
+
+    // 参数绑定，值在bindXXX时填入
+    size_t paramCount = mysql_stmt_param_count(_stmt);
+    _params.resize(paramCount);
+    _paramValues.resize(paramCount);
+    memset(_params.data(), 0, sizeof(MYSQL_BIND) * paramCount);
+
+    // 结果列绑定，整数列绑定为long long，其余的列按字符串接收
+    MYSQL_RES *meta = mysql_stmt_result_metadata(_stmt);
+    if (meta != nullptr)
+    {
+        unsigned int fieldCount = mysql_num_fields(meta);
+        MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+        _results.resize(fieldCount);
+        _columns.resize(fieldCount);
+        memset(_results.data(), 0, sizeof(MYSQL_BIND) * fieldCount);
+        for (unsigned int i = 0; i < fieldCount; ++i)
+        {
+            Column &column = _columns[i];
+            MYSQL_BIND &bind = _results[i];
+            column.isString = !isIntegerType(fields[i].type);
+            column.intValue = 0;
+            column.length = 0;
+            if (column.isString)
+            {
+                column.buffer.resize(kInitColumnLen);
+                bind.buffer_type = MYSQL_TYPE_STRING;
+                bind.buffer = column.buffer.data();
+                bind.buffer_length = column.buffer.size();
+            }
+            else
+            {
+                bind.buffer_type = MYSQL_TYPE_LONGLONG;
+                bind.buffer = &column.intValue;
+            }
+            bind.length = &column.length;
+            bind.is_null = &bind.is_null_value;
+            bind.error = &bind.error_value;
+        }
+        mysql_free_result(meta);
+
+        if (mysql_stmt_bind_result(_stmt, _results.data()))
+        {
+            LOG_ERROR << __FILE__ << ":" << __LINE__ << ":" << sql
+                      << "绑定结果失败! " << mysql_stmt_error(_stmt);
+            _broken = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+// 绑定整数参数
+void Statement::bindInt(int index, long long value)
+{
+    Param &param = _paramValues[index];
+    param.intValue = value;
+    MYSQL_BIND &bind = _params[index];
+    bind.buffer_type = MYSQL_TYPE_LONGLONG;
+    bind.buffer = &param.intValue;
+    bind.buffer_length = 0;
+    bind.length = nullptr;
+}
+
+// 绑定字符串参数，不拷贝数据
+void Statement::bindString(int index, const char *data, size_t len)
+{
+    Param &param = _paramValues[index];
+    param.length = len;
+    MYSQL_BIND &bind = _params[index];
+    bind.buffer_type = MYSQL_TYPE_STRING;
+    bind.buffer = const_cast<char *>(data);
+    bind.buffer_length = len;
+    bind.length = &param.length;
+}
+
+void Statement::bindString(int index, const std::string &value)
+{
+    bindString(index, value.data(), value.size());
+}
+
+// 执行语句
+bool Statement::execute()
+{
+    if (_hasResult)
+    {
+        // 释放上一次执行没有读完的结果集
+        mysql_stmt_free_result(_stmt);
+        _hasResult = false;
+    }
+    ScopedLatency latency(_latency);
+    TraceSpan span(_spanName);
+    if (!_params.empty() && mysql_stmt_bind_param(_stmt, _params.data()))
+    {
+        _errors->add();
+        LOG_ERROR << __FILE__ << ":" << __LINE__ << ":" << _sql
+                  << "绑定参数失败! " << mysql_stmt_error(_stmt);
+        return false;
+    }
+    if (mysql_stmt_execute(_stmt))
+    {
+        _errors->add();
+        LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << _sql
+                 << "执行失败! " << mysql_stmt_error(_stmt);
+        _broken = true;
+        return false;
+    }
+    if (!_results.empty())
+    {
+        // 结果集全部读到客户端，连接可以继续执行其它语句
+        if (mysql_stmt_store_result(_stmt))
+        {
+            _errors->add();
+            LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << _sql
+                     << "读取结果失败! " << mysql_stmt_error(_stmt);
+            _broken = true;
+            return false;
+        }
+        _hasResult = true;
+    }
+    return true;
+}
+
+// 移动到结果集的下一行
+bool Statement::fetch()
+{
+    if (!_hasResult)
+    {
+        return false;
+    }
+    int ret = mysql_stmt_fetch(_stmt);
+    if (ret == 0)
+    {
+        return true;
+    }
+    if (ret != MYSQL_DATA_TRUNCATED)
+    {
+        if (ret != MYSQL_NO_DATA)
+        {
+            LOG_ERROR << __FILE__ << ":" << __LINE__ << ":" << _sql
+                      << "读取结果失败! " << mysql_stmt_error(_stmt);
+        }
+        return false;
+    }
+
+    // 字符串列超过了缓冲区大小，扩容后重新读取这一列，新的缓冲区继续用于后面的行
+    for (size_t i = 0; i < _columns.size(); ++i)
+    {
+        Column &column = _columns[i];
+        MYSQL_BIND &bind = _results[i];
+        if (!column.isString || column.length <= column.buffer.size())
+        {
+            continue;
+        }
+        column.buffer.resize(column.length);
+        bind.buffer = column.buffer.data();
+        bind.buffer_length = column.buffer.size();
+        mysql_stmt_fetch_column(_stmt, &bind, i, 0);
+    }
+    mysql_stmt_bind_result(_stmt, _results.data());
+    return true;
+}
+
+// 当前行的列是否为NULL
+bool Statement::isNull(int column)
+{
+    return _results[column].is_null_value;
+}
+
+// 读取整数列
+long long Statement::getInt(int column)
+{
+    Column &col = _columns[column];
+    if (isNull(column))
+    {
+        return 0;
+    }
+    if (col.isString)
+    {
+        return atoll(std::string(col.buffer.data(), col.length).c_str());
+    }
+    return col.intValue;
+}
+
+// 读取字符串列
+std::string Statement::getString(int column)
+{
+    Column &col = _columns[column];
+    if (isNull(column))
+    {
+        return std::string();
+    }
+    if (!col.isString)
+    {
+        return std::to_string(col.intValue);
+    }
+    return std::string(col.buffer.data(), col.length);
+}
+
+// insert语句生成的自增id
+unsigned long long Statement::insertId()
+{
+    return mysql_stmt_insert_id(_stmt);
+}
+
+// 受影响的行数
+unsigned long long Statement::affectedRows()
+{
+    return mysql_stmt_affected_rows(_stmt);
+}
+
+// sql在指标中的名字，语句类型加表名，批量insert等只有参数个数不同的sql使用同一个名字
+std::string Statement::metricName(const std::string &sql)
+{
+    std::vector<std::string> words;
+    std::string word;
+    for (size_t i = 0; i <= sql.size() && words.size() < 8; ++i)
+    {
+        char c = i < sql.size() ? sql[i] : ' ';
+        if (isalnum(static_cast<unsigned char>(c)) || c == '_')
+        {
+            word.push_back(tolower(static_cast<unsigned char>(c)));
+        }
+        else if (!word.empty())
+        {
+            words.push_back(std::move(word));
+            word.clear();
+        }
+    }
+    if (words.empty())
+    {
+        return "unknown";
+    }
+    // 表名是update后面，或者第一个from、into后面的单词
+    std::string table;
+    for (size_t i = 0; i + 1 < words.size() && table.empty(); ++i)
+    {
+        if ((i == 0 && words[i] == "update") || words[i] == "from" || words[i] == "into")
+        {
+            table = words[i + 1];
+        }
+    }
+    return table.empty() ? words[0] : words[0] + "_" + table;
+}
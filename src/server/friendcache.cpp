@@ -0,0 +1,113 @@
+#include "friendcache.hpp"
+#include <algorithm>
+
+FriendCache::FriendCache(size_t maxUsers)
+    : _maxUsers(maxUsers), _friendCount(0),
+      _version(0), _hits(0), _misses(0)
+{
+}
+
+// 查询用户的好友列表
+FriendList FriendCache::get(int userid)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _lists.find(userid);
+    if (it == _lists.end())
+    {
+        ++_misses;
+        return nullptr;
+    }
+    ++_hits;
+    return it->second;
+}
+
+// 获取当前的版本号
+long long FriendCache::version()
+{
+    return _version.load();
+}
+
+// 放入从数据库加载的好友列表
+FriendList FriendCache::put(int userid, const std::vector<FriendRecord> &records, long long version)
+{
+    auto list = std::make_shared<FriendListData>();
+    list->ids.reserve(records.size());
+    list->seqs.reserve(records.size());
+    for (const FriendRecord &record : records)
+    {
+        list->ids.push_back(record.friendid);
+        list->seqs.push_back(record.seq);
+    }
+    FriendList value = std::move(list);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (version != _version.load())
+    {
+        return value;
+    }
+    auto it = _lists.find(userid);
+    if (it != _lists.end())
+    {
+        _friendCount -= it->second->ids.size();
+        _lists.erase(it);
+    }
+    else if (_lists.size() >= _maxUsers && !_lists.empty())
+    {
+        // 超过容量上限，淘汰一个用户，下次使用时重新从数据库加载
+        _friendCount -= _lists.begin()->second->ids.size();
+        _lists.erase(_lists.begin());
+    }
+    _friendCount += value->ids.size();
+    _lists.emplace(userid, value);
+    return value;
+}
+
+// 用户添加了好友
+void FriendCache::addFriend(int userid, int friendid, long long seq)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    // 正在从数据库加载的好友列表可能不包含该好友，让它们放弃写入缓存
+    ++_version;
+    auto it = _lists.find(userid);
+    if (it == _lists.end())
+    {
+        return;
+    }
+    // 本服务器和控制通道的通知可能重复，已经在列表中的好友不再添加
+    const FriendListData &old = *it->second;
+    if (std::find(old.ids.begin(), old.ids.end(), friendid) != old.ids.end())
+    {
+        return;
+    }
+    // 不同服务器发出的通知可能乱序到达，按序号插入到有序的位置，列表的版本号仍然是最大的序号
+    // friend表的序号全局自增，同一个用户的序号不连续，不能按序号判断通知是否丢失
+    // 订阅连接断开期间丢失的通知，由重连后整体丢弃缓存处理
+    size_t pos = std::upper_bound(old.seqs.begin(), old.seqs.end(), seq) - old.seqs.begin();
+    // 写时拷贝，正在组装登录响应的线程仍然使用旧的好友列表
+    auto list = std::make_shared<FriendListData>(old);
+    list->ids.insert(list->ids.begin() + pos, friendid);
+    list->seqs.insert(list->seqs.begin() + pos, seq);
+    it->second = std::move(list);
+    ++_friendCount;
+}
+
+// 丢弃所有缓存
+void FriendCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_version;
+    _lists.clear();
+    _friendCount = 0;
+}
+
+// 获取缓存的统计信息
+FriendCacheStats FriendCache::getStats()
+{
+    FriendCacheStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    std::lock_guard<std::mutex> lock(_mutex);
+    stats.users = _lists.size();
+    stats.friends = _friendCount;
+    return stats;
+}
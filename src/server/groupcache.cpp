@@ -0,0 +1,106 @@
+#include "groupcache.hpp"
+#include <algorithm>
+
+GroupCache::GroupCache(size_t maxGroups)
+    : _maxGroups(maxGroups), _memberCount(0),
+      _version(0), _hits(0), _misses(0)
+{
+}
+
+// 查询群组的成员列表
+GroupMembers GroupCache::get(int groupid)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _groups.find(groupid);
+    if (it == _groups.end())
+    {
+        ++_misses;
+        return nullptr;
+    }
+    ++_hits;
+    return it->second;
+}
+
+// 获取当前的版本号
+long long GroupCache::version()
+{
+    return _version.load();
+}
+
+// 放入从数据库加载的成员列表
+GroupMembers GroupCache::put(int groupid, std::vector<int> members, long long version)
+{
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+    members.shrink_to_fit();
+    GroupMembers value = std::make_shared<const std::vector<int>>(std::move(members));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (version != _version.load())
+    {
+        return value;
+    }
+    auto it = _groups.find(groupid);
+    if (it != _groups.end())
+    {
+        _memberCount -= it->second->size();
+        _groups.erase(it);
+    }
+    else if (_groups.size() >= _maxGroups && !_groups.empty())
+    {
+        // 超过容量上限，淘汰一个群组，下次使用时重新从数据库加载
+        _memberCount -= _groups.begin()->second->size();
+        _groups.erase(_groups.begin());
+    }
+    _memberCount += value->size();
+    _groups.emplace(groupid, value);
+    return value;
+}
+
+// 群组加入新成员
+void GroupCache::addMember(int groupid, int userid)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    // 正在从数据库加载的成员列表可能不包含该成员，让它们放弃写入缓存
+    ++_version;
+    auto it = _groups.find(groupid);
+    if (it == _groups.end())
+    {
+        return;
+    }
+    const std::vector<int> &old = *it->second;
+    auto pos = std::lower_bound(old.begin(), old.end(), userid);
+    if (pos != old.end() && *pos == userid)
+    {
+        return;
+    }
+    // 写时拷贝，正在转发群消息的线程仍然使用旧的成员列表
+    auto members = std::make_shared<std::vector<int>>();
+    members->reserve(old.size() + 1);
+    members->insert(members->end(), old.begin(), pos);
+    members->push_back(userid);
+    members->insert(members->end(), pos, old.end());
+    it->second = std::move(members);
+    ++_memberCount;
+}
+
+// 丢弃所有缓存
+void GroupCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_version;
+    _groups.clear();
+    _memberCount = 0;
+}
+
+// 获取缓存的统计信息
+GroupCacheStats GroupCache::getStats()
+{
+    GroupCacheStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    std::lock_guard<std::mutex> lock(_mutex);
+    stats.groups = _groups.size();
+    stats.members = _memberCount;
+    return stats;
+}
@@ -0,0 +1,101 @@
+#include "locationcache.hpp"
+
+// 版本号的分段数，同一分段的用户变更时互相放弃加载，分段足够多时冲突很少
+static const int kVersionStripes = 4096;
+
+LocationCache::LocationCache(size_t maxUsers)
+    : _maxUsers(maxUsers),
+      _versions(new std::atomic<long long>[kVersionStripes]),
+      _hits(0), _misses(0)
+{
+    for (int i = 0; i < kVersionStripes; ++i)
+    {
+        _versions[i] = 0;
+    }
+}
+
+// 用户所在分段的版本号
+std::atomic<long long> &LocationCache::versionOf(int userid)
+{
+    return _versions[static_cast<unsigned int>(userid) % kVersionStripes];
+}
+
+// 查询用户所在的服务器
+bool LocationCache::get(int userid, std::string &node)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _nodes.find(userid);
+    if (it == _nodes.end())
+    {
+        ++_misses;
+        return false;
+    }
+    ++_hits;
+    node = it->second;
+    return true;
+}
+
+// 获取用户当前的版本号
+long long LocationCache::version(int userid)
+{
+    return versionOf(userid).load();
+}
+
+// 放入从redis加载的位置
+void LocationCache::put(int userid, const std::string &node, long long version)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (version != versionOf(userid).load())
+    {
+        return;
+    }
+    if (_nodes.size() >= _maxUsers && _nodes.find(userid) == _nodes.end() && !_nodes.empty())
+    {
+        // 超过容量上限，淘汰一个用户，下次使用时重新从redis加载
+        _nodes.erase(_nodes.begin());
+    }
+    _nodes[userid] = node;
+}
+
+// 用户在node服务器上登录
+void LocationCache::set(int userid, const std::string &node)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++versionOf(userid);
+    if (_nodes.size() >= _maxUsers && _nodes.find(userid) == _nodes.end() && !_nodes.empty())
+    {
+        _nodes.erase(_nodes.begin());
+    }
+    _nodes[userid] = node;
+}
+
+// 用户下线
+void LocationCache::erase(int userid)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    // 正在从redis加载的该用户的位置可能已经过期，让它们放弃写入缓存
+    ++versionOf(userid);
+    _nodes.erase(userid);
+}
+
+// 丢弃所有缓存
+void LocationCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int i = 0; i < kVersionStripes; ++i)
+    {
+        ++_versions[i];
+    }
+    _nodes.clear();
+}
+
+// 获取缓存的统计信息
+LocationCacheStats LocationCache::getStats()
+{
+    LocationCacheStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    std::lock_guard<std::mutex> lock(_mutex);
+    stats.users = _nodes.size();
+    return stats;
+}
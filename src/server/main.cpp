@@ -1,14 +1,18 @@
 #include "chatserver.hpp"
 #include "chatservice.hpp"
+#include "metricsserver.hpp"
+#include "trace.hpp"
+#include "passwordhash.hpp"
 #include <iostream>
 #include <signal.h>
 using namespace std;
 
-// 处理服务器ctrl+c结束后，重置user的状态信息
-void resetHandler(int)
+// 收到ctrl+c后只设置标志，由事件循环检查后退出，信号处理函数中不能加锁和做网络I/O
+static volatile sig_atomic_t g_quit = 0;
+
+void quitHandler(int)
 {
-    ChatService::instance()->reset();
-    exit(0);
+    g_quit = 1;
 }
 
 int main(int argc, char **argv)
@@ -16,19 +20,55 @@ int main(int argc, char **argv)
 
     if (argc < 3)
     {
-        std::cerr << "command invalid example: ./ChatServer 127.0.0.1 6000" << std::endl;
+        std::cerr << "command invalid example: ./ChatServer 127.0.0.1 6000 [workerThreads] [sync|group] [metricsPort] [slowRequestUs] [pbkdf2Iterations]" << std::endl;
     }
     char *ip = argv[1];
     uint16_t port = atoi(argv[2]);
 
-    signal(SIGINT, resetHandler);
+    signal(SIGINT, quitHandler);
 
     muduo::net::EventLoop loop;
     muduo::net::InetAddress addr(ip, port);
     ChatServer server(&loop, addr, "ChatServer");
+    if (argc > 3)
+    {
+        // 业务线程数量，为0时业务直接在I/O线程中处理
+        server.setWorkerThreadNum(atoi(argv[3]));
+    }
+    if (argc > 4 && std::string(argv[4]) == "sync")
+    {
+        // 离线消息每条同步落库，默认后台攒批提交
+        ChatService::instance()->setOfflineDurability(OFFLINE_DURABILITY_SYNC);
+    }
+
+    // 处理耗时超过阈值的请求输出各阶段的耗时，默认50ms，为0时关闭
+    Trace::setSlowThresholdUs(argc > 6 ? atoll(argv[6]) : Trace::slowThresholdUs());
+
+    // 新生成的密码哈希的迭代次数，已有的记录在用户下次登录时按新的次数重新计算
+    if (argc > 7)
+    {
+        PasswordHash::setIterations(atoi(argv[7]));
+    }
+
+    // 指标抓取服务，默认监听聊天端口+1000，端口为0时不启动
+    uint16_t metricsPort = argc > 5 ? atoi(argv[5]) : port + 1000;
+    std::unique_ptr<MetricsServer> metrics;
+    if (metricsPort != 0)
+    {
+        metrics.reset(new MetricsServer(muduo::net::InetAddress(ip, metricsPort)));
+        metrics->start();
+    }
 
     server.start();
+    loop.runEvery(0.1, [&loop]()
+                  {
+        if (g_quit)
+        {
+            loop.quit();
+        } });
     loop.loop();
 
+    // 事件循环退出后停止线程池，重置业务状态，再正常返回，析构时没有还在运行的业务线程
+    server.stop();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,223 @@
+#include "metrics.hpp"
+#include <algorithm>
+
+// 读取计数器，各分片求和
+long long Counter::value() const
+{
+    long long sum = 0;
+    for (const Shard &shard : _shards)
+    {
+        sum += shard.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// 计算时延所在的桶
+size_t Histogram::bucketIndex(long long value)
+{
+    if (value < kSubCount)
+    {
+        return value < 0 ? 0 : value;
+    }
+    int msb = 63 - __builtin_clzll(static_cast<unsigned long long>(value));
+    if (msb >= kMaxBits)
+    {
+        return kBucketCount - 1;
+    }
+    int shift = msb - kSubBits;
+    return (shift + 1) * kSubCount + ((value >> shift) - kSubCount);
+}
+
+// 桶的上界
+long long Histogram::bucketUpper(size_t index)
+{
+    if (index < static_cast<size_t>(kSubCount))
+    {
+        return index;
+    }
+    int shift = index / kSubCount - 1;
+    long long sub = index % kSubCount + kSubCount;
+    return ((sub + 1) << shift) - 1;
+}
+
+// 记录一次时延
+void Histogram::observe(long long us)
+{
+    _buckets[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(us, std::memory_order_relaxed);
+    long long max = _max.load(std::memory_order_relaxed);
+    while (us > max && !_max.compare_exchange_weak(max, us, std::memory_order_relaxed))
+    {
+    }
+}
+
+// 获取百分位数，读取期间仍在记录，结果是近似值
+long long Histogram::percentile(double p) const
+{
+    long long counts[kBucketCount];
+    long long total = 0;
+    for (size_t i = 0; i < kBucketCount; ++i)
+    {
+        counts[i] = _buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    long long target = static_cast<long long>(p * total);
+    if (target >= total)
+    {
+        target = total - 1;
+    }
+    long long seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i)
+    {
+        seen += counts[i];
+        if (seen > target)
+        {
+            return std::min(bucketUpper(i), max());
+        }
+    }
+    return max();
+}
+
+// 获取同名指标的输出位置，第一次出现时记录HELP和TYPE
+MetricsWriter::Family &MetricsWriter::family(const std::string &name, const std::string &help, const char *type)
+{
+    Family &f = _families[name];
+    if (f.type.empty())
+    {
+        f.help = help;
+        f.type = type;
+    }
+    return f;
+}
+
+void MetricsWriter::appendLine(std::string &out, const std::string &name, const std::string &labels,
+                               long long value)
+{
+    out += name;
+    if (!labels.empty())
+    {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += std::to_string(value);
+    out += '\n';
+}
+
+void MetricsWriter::counter(const std::string &name, const std::string &help, long long value,
+                            const std::string &labels)
+{
+    appendLine(family(name, help, "counter").lines, name, labels, value);
+}
+
+void MetricsWriter::gauge(const std::string &name, const std::string &help, long long value,
+                          const std::string &labels)
+{
+    appendLine(family(name, help, "gauge").lines, name, labels, value);
+}
+
+void MetricsWriter::summary(const std::string &name, const std::string &help, const Histogram &histogram,
+                            const std::string &labels)
+{
+    std::string &lines = family(name, help, "summary").lines;
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    appendLine(lines, name, prefix + "quantile=\"0.5\"", histogram.percentile(0.5));
+    appendLine(lines, name, prefix + "quantile=\"0.99\"", histogram.percentile(0.99));
+    appendLine(lines, name, prefix + "quantile=\"0.999\"", histogram.percentile(0.999));
+    appendLine(lines, name + "_sum", labels, histogram.sum());
+    appendLine(lines, name + "_count", labels, histogram.count());
+}
+
+// 生成完整的文本
+std::string MetricsWriter::str() const
+{
+    std::string out;
+    for (const auto &item : _families)
+    {
+        out += "# HELP " + item.first + " " + item.second.help + "\n";
+        out += "# TYPE " + item.first + " " + item.second.type + "\n";
+        out += item.second.lines;
+    }
+    return out;
+}
+
+// 获取单例对象的接口函数
+Metrics *Metrics::instance()
+{
+    static Metrics metrics;
+    return &metrics;
+}
+
+// 按名字和标签查找指标，没有时注册
+template <typename T>
+T *Metrics::find(std::vector<Entry<T>> &entries, const std::string &name,
+                 const std::string &help, const std::string &labels)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (Entry<T> &entry : entries)
+    {
+        if (entry.name == name && entry.labels == labels)
+        {
+            return entry.metric.get();
+        }
+    }
+    entries.push_back(Entry<T>{name, help, labels, std::unique_ptr<T>(new T())});
+    return entries.back().metric.get();
+}
+
+Counter *Metrics::counter(const std::string &name, const std::string &help, const std::string &labels)
+{
+    return find(_counters, name, help, labels);
+}
+
+Gauge *Metrics::gauge(const std::string &name, const std::string &help, const std::string &labels)
+{
+    return find(_gauges, name, help, labels);
+}
+
+Histogram *Metrics::histogram(const std::string &name, const std::string &help, const std::string &labels)
+{
+    return find(_histograms, name, help, labels);
+}
+
+// 注册回调
+void Metrics::addCollector(Collector collector)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _collectors.push_back(std::move(collector));
+}
+
+// 输出所有指标的文本
+std::string Metrics::render()
+{
+    MetricsWriter writer;
+    std::vector<Collector> collectors;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const Entry<Counter> &entry : _counters)
+        {
+            writer.counter(entry.name, entry.help, entry.metric->value(), entry.labels);
+        }
+        for (const Entry<Gauge> &entry : _gauges)
+        {
+            writer.gauge(entry.name, entry.help, entry.metric->value(), entry.labels);
+        }
+        for (const Entry<Histogram> &entry : _histograms)
+        {
+            writer.summary(entry.name, entry.help, *entry.metric, entry.labels);
+        }
+        collectors = _collectors;
+    }
+    // 回调会读取其它模块的统计信息，不在注册表的锁内调用
+    for (const Collector &collector : collectors)
+    {
+        collector(writer);
+    }
+    return writer.str();
+}
@@ -0,0 +1,66 @@
+#include "metricsserver.hpp"
+#include "metrics.hpp"
+#include <muduo/base/Logging.h>
+#include <algorithm>
+
+// 请求头的最大长度，超过认为是非法请求
+static const size_t kMaxRequestLen = 8 * 1024;
+
+MetricsServer::MetricsServer(const muduo::net::InetAddress &listenAddr)
+    : _listenAddr(listenAddr), _thread(muduo::net::EventLoopThread::ThreadInitCallback(), "ChatMetrics")
+{
+}
+
+// 启动抓取服务的线程并开始监听
+void MetricsServer::start()
+{
+    muduo::net::EventLoop *loop = _thread.startLoop();
+    loop->runInLoop([this, loop]()
+                    {
+        _server.reset(new muduo::net::TcpServer(loop, _listenAddr, "ChatMetrics"));
+        _server->setMessageCallback(std::bind(&MetricsServer::onMessage, this,
+                                              std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+        _server->start();
+        LOG_INFO << "metrics server listening on " << _server->ipPort(); });
+}
+
+// 收到请求的回调函数
+void MetricsServer::onMessage(const muduo::net::TcpConnectionPtr &conn,
+                              muduo::net::Buffer *buffer,
+                              muduo::Timestamp time)
+{
+    const char *begin = buffer->peek();
+    const char *end = begin + buffer->readableBytes();
+    const char *headerEnd = std::search(begin, end, "\r\n\r\n", "\r\n\r\n" + 4);
+    if (headerEnd == end)
+    {
+        if (buffer->readableBytes() > kMaxRequestLen)
+        {
+            conn->forceClose();
+        }
+        return;
+    }
+
+    // 只处理请求行，GET /metrics 或者 GET / 返回指标，其它路径返回404
+    std::string requestLine(begin, std::find(begin, headerEnd, '\r'));
+    buffer->retrieveAll();
+    std::string status = "200 OK";
+    std::string body;
+    if (requestLine.compare(0, 13, "GET /metrics ") == 0 || requestLine.compare(0, 6, "GET / ") == 0)
+    {
+        body = Metrics::instance()->render();
+    }
+    else
+    {
+        status = "404 Not Found";
+        body = "not found\n";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n";
+    response += body;
+    conn->send(response);
+    conn->shutdown();
+}
@@ -1,42 +1,44 @@
 #include "friendmodel.hpp"
-#include "db.h"
+#include "connectionpool.hpp"
 
 // 添加好友关系
-void FriendModel::insert(int userid, int friendid)
+long long FriendModel::insert(int userid, int friendid)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "insert into friend values(%d, %d)", userid,friendid);
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        mysql.update(sql);
+        Statement *stmt = mysql->prepare("insert into friend(userid, friendid) values(?, ?)");
+        if (stmt != nullptr)
+        {
+            stmt->bindInt(0, userid);
+            stmt->bindInt(1, friendid);
+            if (stmt->execute())
+            {
+                return stmt->insertId();
+            }
+        }
     }
+    return 0;
 }
 
-// 返回用户好友列表
-std::vector<User> FriendModel::query(int userid)
+// 返回用户的好友id和序号
+std::vector<FriendRecord> FriendModel::queryIds(int userid)
 {
-        char sql[1024] = {0};
-    sprintf(sql, "select a.id, a.name, a.state from user a \
-    inner join friend b on b.friendid = a.id where b.userid = %d;", userid);
-    MySQL mysql;
-    std::vector<User> vec;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    std::vector<FriendRecord> vec;
+    if (mysql != nullptr)
     {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
+        Statement *stmt = mysql->prepare("select friendid, seq from friend where userid = ? order by seq");
+        if (stmt != nullptr)
         {
-            // 把userid用户的所有离线消息放入vec中返回
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
+            stmt->bindInt(0, userid);
+            if (stmt->execute())
             {
-                User user;
-                user.setId(atoi(row[0]));
-                user.setName(row[1]);
-                user.setState(row[2]);
-                vec.push_back(user);                
+                while (stmt->fetch())
+                {
+                    vec.push_back(FriendRecord{static_cast<int>(stmt->getInt(0)), stmt->getInt(1)});
+                }
             }
-            mysql_free_result(res);
         }
     }
     return vec;
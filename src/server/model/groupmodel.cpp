@@ -1,107 +1,140 @@
 #include "groupmodel.hpp"
-#include "db.h"
+#include "connectionpool.hpp"
 
 bool GroupModel::createGroup(Group &group)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "insert into allgroup(groupname, groupdesc) values('%s', '%s')",
-            group.getName().c_str(), group.getDesc().c_str());
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        if (mysql.update(sql))
+        Statement *stmt = mysql->prepare("insert into allgroup(groupname, groupdesc) values(?, ?)");
+        if (stmt != nullptr)
         {
-            group.setId(mysql_insert_id(mysql.getConnection()));
-            return true;
+            stmt->bindString(0, group.getName());
+            stmt->bindString(1, group.getDesc());
+            if (stmt->execute())
+            {
+                group.setId(stmt->insertId());
+                return true;
+            }
         }
     }
     return false;
 }
 
-void GroupModel::addGroup(int userid, int groupid, std::string role)
+bool GroupModel::addGroup(int userid, int groupid, std::string role)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "insert into groupuser(groupid, userid, grouprole) values(%d, %d, '%s')",
-            groupid, userid, role.c_str());
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        mysql.update(sql);
+        Statement *stmt = mysql->prepare("insert into groupuser(groupid, userid, grouprole) values(?, ?, ?)");
+        if (stmt != nullptr)
+        {
+            stmt->bindInt(0, groupid);
+            stmt->bindInt(1, userid);
+            stmt->bindString(2, role);
+            return stmt->execute();
+        }
     }
+    return false;
 }
 
 // 查询用户所在的群聊
-std::vector<Group> GroupModel::queryGroups(int userid)
+std::vector<Group> GroupModel::queryGroups(int userid, bool withUsers)
 {
     /*
-        1.先根据userid在groupuser表中查询出该用户所属的群组信息
-        2.在根据群组信息，查询属于该群组的所有用户的userid，并且和user表进行多表嵌合查询，查出用户的详情信息
+        用户所在的群组和这些群组的成员通过一条联表查询取出，按群组id排序
+        结果集中同一个群组的行是连续的，遍历一遍即可组装出所有的Group和GroupUser
     */
-    char sql[1024] = {0};
     std::vector<Group> groupVec;
-    sprintf(sql, "select a.id, a.groupname, a.groupdesc from allgroup a inner join groupuser b on a.id=b.groupid where b.userid=%d;", userid);
-
-    MySQL mysql;
-
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
+        Statement *stmt = nullptr;
+        if (withUsers)
+        {
+            stmt = mysql->prepare("select a.id, a.groupname, a.groupdesc, u.id, u.name, m.grouprole \
+from groupuser g inner join allgroup a on a.id = g.groupid \
+inner join groupuser m on m.groupid = g.groupid \
+inner join user u on u.id = m.userid \
+where g.userid = ? order by a.id");
+        }
+        else
+        {
+            stmt = mysql->prepare("select a.id, a.groupname, a.groupdesc from allgroup a inner join groupuser b on a.id = b.groupid where b.userid = ?");
+        }
+
+        if (stmt != nullptr)
         {
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
+            stmt->bindInt(0, userid);
+            if (stmt->execute())
             {
-                Group group;
-                group.setId(atoi(row[0]));
-                group.setName(row[1]);
-                group.setDesc(row[2]);
-                groupVec.push_back(group);
+                while (stmt->fetch())
+                {
+                    int groupid = stmt->getInt(0);
+                    if (groupVec.empty() || groupVec.back().getId() != groupid)
+                    {
+                        groupVec.push_back(Group(groupid, stmt->getString(1), stmt->getString(2)));
+                    }
+                    if (withUsers)
+                    {
+                        GroupUser user;
+                        user.setId(stmt->getInt(3));
+                        user.setName(stmt->getString(4));
+                        user.setRole(stmt->getString(5));
+                        groupVec.back().getUsers().push_back(user);
+                    }
+                }
             }
-            mysql_free_result(res);
         }
+    }
+    return groupVec;
+}
 
-        for (Group &group : groupVec)
+// 查询群组成员的详细信息
+std::vector<GroupUser> GroupModel::queryGroupUserInfos(int groupid)
+{
+    std::vector<GroupUser> userVec;
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
+    {
+        Statement *stmt = mysql->prepare("select a.id, a.name, b.grouprole from user a inner join groupuser b on a.id = b.userid where b.groupid = ?");
+        if (stmt != nullptr)
         {
-            sprintf(sql, "select a.id, a.name, a.state, b.grouprole from user a inner join groupuser b on a.id = b.userid where b.groupid = %d;", group.getId());
-            MYSQL_RES *res = mysql.query(sql);
-            if (res != nullptr)
+            stmt->bindInt(0, groupid);
+            if (stmt->execute())
             {
-                MYSQL_ROW row;
-                while ((row = mysql_fetch_row(res)) != nullptr)
+                while (stmt->fetch())
                 {
                     GroupUser user;
-                    user.setId(atoi(row[0]));
-                    user.setName(row[1]);
-                    user.setState(row[2]);
-                    user.setRole(row[3]);
-                    group.getUsers().push_back(user);
+                    user.setId(stmt->getInt(0));
+                    user.setName(stmt->getString(1));
+                    user.setRole(stmt->getString(2));
+                    userVec.push_back(user);
                 }
-                mysql_free_result(res);
             }
         }
     }
-    return groupVec;
+    return userVec;
 }
 
-// 根据指定的groupid查询群组用户id列表，除userid自己，主要用户群聊业务给群组其它成员群发消息
-std::vector<int> GroupModel::queryGroupUsers(int userid, int groupid)
+// 查询群组的所有成员id，用于加载群组成员缓存
+std::vector<int> GroupModel::queryGroupMembers(int groupid)
 {
-    char sql[1024] = {0};
     std::vector<int> idVec;
-    sprintf(sql, "select userid from groupuser where groupid = %d and userid != %d;", groupid, userid);
-
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
+        Statement *stmt = mysql->prepare("select userid from groupuser where groupid = ?");
+        if (stmt != nullptr)
         {
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
+            stmt->bindInt(0, groupid);
+            if (stmt->execute())
             {
-                idVec.push_back(atoi(row[0]));
+                while (stmt->fetch())
+                {
+                    idVec.push_back(stmt->getInt(0));
+                }
             }
-            mysql_free_result(res);
         }
     }
 
@@ -1,50 +1,184 @@
 #include "offlinemessagemodel.hpp"
-#include "db.h"
+#include "connectionpool.hpp"
+
+// 多行insert每条语句的行数上限，语句按2的幂的行数预处理，每个连接最多缓存7条
+static const size_t kMaxBatchRows = 64;
+// 多行insert每条语句的消息字节数上限，避免超过mysql的max_allowed_packet
+static const size_t kMaxBatchBytes = 512 * 1024;
+
+// rows行的insert语句，rows是2的幂
+static const std::string &batchInsertSql(size_t rows)
+{
+    static const std::vector<std::string> sqls = []()
+    {
+        std::vector<std::string> vec;
+        for (size_t n = 1; n <= kMaxBatchRows; n <<= 1)
+        {
+            std::string sql = "insert into offlinemessage(userid, message) values";
+            for (size_t i = 0; i < n; ++i)
+            {
+                sql += i == 0 ? "(?, ?)" : ",(?, ?)";
+            }
+            vec.push_back(sql);
+        }
+        return vec;
+    }();
+
+    size_t index = 0;
+    while ((static_cast<size_t>(2) << index) <= rows)
+    {
+        ++index;
+    }
+    return sqls[index];
+}
 
 // 存储用户的离线消息
-void OffLineMessageModel::insert(int userid, std::string msg)
+bool OffLineMessageModel::insert(int userid, const std::string &msg)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "insert into offlinemessage values(%d,'%s')",
-            userid, msg.c_str());
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        mysql.update(sql);
+        Statement *stmt = mysql->prepare(batchInsertSql(1));
+        if (stmt != nullptr)
+        {
+            stmt->bindInt(0, userid);
+            stmt->bindString(1, msg);
+            return stmt->execute();
+        }
     }
+    return false;
 }
+
+// 批量存储离线消息
+size_t OffLineMessageModel::insert(const std::vector<OfflineMessage> &msgs)
+{
+    if (msgs.empty())
+    {
+        return 0;
+    }
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql == nullptr)
+    {
+        return 0;
+    }
+
+    size_t begin = 0;
+    while (begin < msgs.size())
+    {
+        // 按行数和字节数上限划出一段，至少一行
+        size_t end = begin;
+        size_t bytes = 0;
+        while (end < msgs.size() && end - begin < kMaxBatchRows &&
+               (end == begin || bytes + msgs[end].msg->size() <= kMaxBatchBytes))
+        {
+            bytes += msgs[end].msg->size();
+            ++end;
+        }
+
+        // 拆成2的幂行数的语句执行，群消息的多行共享同一份消息内容，绑定时不拷贝
+        while (begin < end)
+        {
+            size_t rows = 1;
+            while (rows * 2 <= end - begin)
+            {
+                rows *= 2;
+            }
+            Statement *stmt = mysql->prepare(batchInsertSql(rows));
+            if (stmt == nullptr)
+            {
+                return begin;
+            }
+            for (size_t i = 0; i < rows; ++i)
+            {
+                const OfflineMessage &item = msgs[begin + i];
+                stmt->bindInt(2 * i, item.userid);
+                stmt->bindString(2 * i + 1, *item.msg);
+            }
+            if (!stmt->execute())
+            {
+                return begin;
+            }
+            begin += rows;
+        }
+    }
+    return begin;
+}
+
 // 删除用户的离线消息
 void OffLineMessageModel::remove(int userid)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "delete from offlinemessage where userid = %d",
-            userid);
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        mysql.update(sql);
+        Statement *stmt = mysql->prepare("delete from offlinemessage where userid = ?");
+        if (stmt != nullptr)
+        {
+            stmt->bindInt(0, userid);
+            stmt->execute();
+        }
     }
 }
 // 查询用户的离线消息
 std::vector<std::string> OffLineMessageModel::query(int userid)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "select message from offlinemessage where userid = %d", userid);
-    MySQL mysql;
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
     std::vector<std::string> vec;
-    if (mysql.connect())
+    if (mysql != nullptr)
+    {
+        Statement *stmt = mysql->prepare("select message from offlinemessage where userid = ?");
+        if (stmt != nullptr)
+        {
+            stmt->bindInt(0, userid);
+            if (stmt->execute())
+            {
+                // 把userid用户的所有离线消息放入vec中返回
+                while (stmt->fetch())
+                {
+                    vec.push_back(stmt->getString(0));
+                }
+            }
+        }
+    }
+    return vec;
+}
+
+// 分页查询用户seq之后的离线消息
+std::vector<OfflineRecord> OffLineMessageModel::query(int userid, long long afterSeq, int limit)
+{
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    std::vector<OfflineRecord> vec;
+    if (mysql != nullptr)
     {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
+        Statement *stmt = mysql->prepare("select id, message from offlinemessage where userid = ? and id > ? order by id limit ?");
+        if (stmt != nullptr)
         {
-            // 把userid用户的所有离线消息放入vec中返回
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
+            stmt->bindInt(0, userid);
+            stmt->bindInt(1, afterSeq);
+            stmt->bindInt(2, limit);
+            if (stmt->execute())
             {
-                vec.push_back(row[0]);
+                while (stmt->fetch())
+                {
+                    vec.push_back(OfflineRecord{stmt->getInt(0), stmt->getString(1)});
+                }
             }
-            mysql_free_result(res);
         }
     }
     return vec;
 }
+
+// 删除用户seq及之前的离线消息
+void OffLineMessageModel::remove(int userid, long long uptoSeq)
+{
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
+    {
+        Statement *stmt = mysql->prepare("delete from offlinemessage where userid = ? and id <= ?");
+        if (stmt != nullptr)
+        {
+            stmt->bindInt(0, userid);
+            stmt->bindInt(1, uptoSeq);
+            stmt->execute();
+        }
+    }
+}
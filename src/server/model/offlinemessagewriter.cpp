@@ -0,0 +1,211 @@
+#include "offlinemessagewriter.hpp"
+#include <muduo/base/Logging.h>
+#include <functional>
+
+// 批量写入失败后逐条重试时，每条消息的尝试次数
+static const int kMaxRowAttempts = 3;
+
+OfflineMessageWriter::OfflineMessageWriter()
+    : _durability(OFFLINE_DURABILITY_GROUP_COMMIT),
+      _maxBatch(500), _flushInterval(20), _maxPending(100000),
+      _enqueued(0), _flushed(0),
+      _flushRequested(false), _running(true),
+      _rows(0), _batches(0), _blocked(0), _retried(0), _failed(0)
+{
+    _thread = std::thread(std::bind(&OfflineMessageWriter::flushTask, this));
+}
+
+OfflineMessageWriter::~OfflineMessageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cv.notify_one();
+    // 后台线程退出前会把队列中剩余的消息写完
+    _thread.join();
+}
+
+// 设置离线消息的持久化方式
+void OfflineMessageWriter::setDurability(EnOfflineDurability durability)
+{
+    _durability = durability;
+}
+
+// 存储一条离线消息
+void OfflineMessageWriter::write(int userid, std::shared_ptr<const std::string> msg)
+{
+    write(std::vector<OfflineMessage>{OfflineMessage{userid, std::move(msg)}});
+}
+
+// 存储多条离线消息
+void OfflineMessageWriter::write(std::vector<OfflineMessage> msgs)
+{
+    if (msgs.empty())
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    track(msgs);
+    if (_durability == OFFLINE_DURABILITY_GROUP_COMMIT)
+    {
+        // 数据库写入跟不上，队列已满，调用线程等待后台线程取走队列中的消息，反压到业务线程
+        // 不能绕过队列直接写入，否则会先于队列中更早的消息落库，打乱同一个接收者的消息顺序
+        auto hasSpace = [&]() -> bool
+        { return _pending.empty() || _pending.size() + msgs.size() <= _maxPending; };
+        if (!hasSpace())
+        {
+            ++_blocked;
+            _flushRequested = true;
+            _cv.notify_one();
+            _spaceCv.wait(lock, hasSpace);
+        }
+        _pending.insert(_pending.end(), msgs.begin(), msgs.end());
+        _enqueued += msgs.size();
+        // 队列从空变为非空时唤醒后台线程开始计时，达到批量上限时唤醒后台线程立即提交
+        if (_pending.size() == msgs.size() || _pending.size() >= _maxBatch)
+        {
+            _cv.notify_one();
+        }
+        return;
+    }
+    // 同步写入期间接收者登录时同样需要等待这些消息落库
+    lock.unlock();
+    writeBatch(msgs);
+    lock.lock();
+    untrack(msgs);
+}
+
+// 等待调用之前写入的消息全部落库
+void OfflineMessageWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    unsigned long long target = _enqueued;
+    if (_flushed >= target)
+    {
+        return;
+    }
+    _flushRequested = true;
+    _cv.notify_one();
+    _flushedCv.wait(lock, [&]() -> bool
+                    { return _flushed >= target; });
+}
+
+// 等待调用之前写给userid的消息全部落库
+void OfflineMessageWriter::flush(int userid)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_unflushed.find(userid) == _unflushed.end())
+    {
+        return;
+    }
+    // 不等后台线程的刷新间隔，立即提交
+    _flushRequested = true;
+    _cv.notify_one();
+    _flushedCv.wait(lock, [&]() -> bool
+                    { return _unflushed.find(userid) == _unflushed.end(); });
+}
+
+// 记录每个接收者还没有落库的消息条数
+void OfflineMessageWriter::track(const std::vector<OfflineMessage> &msgs)
+{
+    for (const OfflineMessage &msg : msgs)
+    {
+        ++_unflushed[msg.userid];
+    }
+}
+
+// 减少接收者还没有落库的消息条数
+void OfflineMessageWriter::untrack(const std::vector<OfflineMessage> &msgs)
+{
+    for (const OfflineMessage &msg : msgs)
+    {
+        auto it = _unflushed.find(msg.userid);
+        if (it != _unflushed.end() && --it->second == 0)
+        {
+            _unflushed.erase(it);
+        }
+    }
+    _flushedCv.notify_all();
+}
+
+// 后台线程，攒批写入数据库
+void OfflineMessageWriter::flushTask()
+{
+    std::vector<OfflineMessage> batch;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;)
+    {
+        _cv.wait(lock, [&]() -> bool
+                 { return !_pending.empty() || !_running; });
+        if (_pending.empty())
+        {
+            // 停止并且队列中没有消息了
+            break;
+        }
+        // 从第一条消息进入队列开始计时，达到批量上限或者超过刷新间隔就提交
+        _cv.wait_for(lock, std::chrono::milliseconds(_flushInterval), [&]() -> bool
+                     { return _pending.size() >= _maxBatch || _flushRequested || !_running; });
+
+        batch.swap(_pending);
+        unsigned long long target = _enqueued;
+        _flushRequested = false;
+        _spaceCv.notify_all();
+        lock.unlock();
+
+        writeBatch(batch);
+
+        lock.lock();
+        _flushed = target;
+        untrack(batch);
+        batch.clear();
+    }
+}
+
+// 把一批消息写入数据库
+void OfflineMessageWriter::writeBatch(const std::vector<OfflineMessage> &batch)
+{
+    // 一批消息拆成多条语句按顺序执行，遇到失败的语句就停止，返回之前已经写入的条数
+    // 单条多行insert语句失败时整体不写入，从这条语句的第一行开始逐条重试不会重复存储
+    size_t written = _model.insert(batch);
+    _rows += written;
+    ++_batches;
+    if (written == batch.size())
+    {
+        return;
+    }
+
+    LOG_WARN << "write offline messages failed, retry " << batch.size() - written << " messages one by one";
+    _retried += batch.size() - written;
+    for (size_t i = written; i < batch.size(); ++i)
+    {
+        bool success = false;
+        for (int attempt = 0; attempt < kMaxRowAttempts && !success; ++attempt)
+        {
+            success = _model.insert(batch[i].userid, *batch[i].msg);
+        }
+        if (success)
+        {
+            ++_rows;
+        }
+        else
+        {
+            LOG_ERROR << "write offline message failed, drop message to " << batch[i].userid;
+            ++_failed;
+        }
+    }
+}
+
+// 获取统计信息
+OfflineWriterStats OfflineMessageWriter::getStats()
+{
+    OfflineWriterStats stats;
+    stats.rows = _rows;
+    stats.batches = _batches;
+    stats.blocked = _blocked;
+    stats.retried = _retried;
+    stats.failed = _failed;
+    std::lock_guard<std::mutex> lock(_mutex);
+    stats.pending = _pending.size();
+    return stats;
+}
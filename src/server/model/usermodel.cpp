@@ -1,73 +1,133 @@
 #include "usermodel.hpp"
-#include "db.h"
+#include "connectionpool.hpp"
 
-bool UserModel::insert(User &user)
+// 批量查询每条语句的id个数上限，语句按2的幂的个数预处理，每个连接最多缓存7条
+static const size_t kMaxBatchIds = 64;
+
+// 查询n个用户名的语句，n是2的幂
+static const std::string &batchNameSql(size_t n)
 {
+    static const std::vector<std::string> sqls = []()
+    {
+        std::vector<std::string> vec;
+        for (size_t n = 1; n <= kMaxBatchIds; n <<= 1)
+        {
+            std::string sql = "select id, name from user where id in (";
+            for (size_t i = 0; i < n; ++i)
+            {
+                sql += i == 0 ? "?" : ",?";
+            }
+            vec.push_back(sql + ")");
+        }
+        return vec;
+    }();
+
+    size_t index = 0;
+    while ((static_cast<size_t>(2) << index) <= n)
+    {
+        ++index;
+    }
+    return sqls[index];
+}
 
-    char sql[1024] = {0};
-    sprintf(sql, "insert into user(name, password, state) values('%s','%s','%s')",
-            user.getName().c_str(), user.getPwd().c_str(),
-            user.getState().c_str());
-    MySQL mysql;
-    if (mysql.connect())
+bool UserModel::insert(User &user)
+{
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        if (mysql.update(sql))
+        Statement *stmt = mysql->prepare("insert into user(name, password, state) values(?, ?, ?)");
+        if (stmt != nullptr)
         {
-            // 获取插入成功的用户生成的主键id
-            user.setId(mysql_insert_id(mysql.getConnection()));
-            return true;
+            stmt->bindString(0, user.getName());
+            stmt->bindString(1, user.getPwd());
+            stmt->bindString(2, user.getState());
+            if (stmt->execute())
+            {
+                // 获取插入成功的用户生成的主键id
+                user.setId(stmt->insertId());
+                return true;
+            }
         }
     }
     return false;
 }
 
-User UserModel::query(int id)
+// 批量查询用户的id和用户名
+std::vector<User> UserModel::queryNames(const std::vector<int> &ids)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "select * from user where id = %d", id);
-    MySQL mysql;
-    if (mysql.connect())
+    std::vector<User> vec;
+    if (ids.empty())
+    {
+        return vec;
+    }
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql == nullptr)
     {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
+        return vec;
+    }
+    // 拆成2的幂个数的语句执行
+    size_t begin = 0;
+    while (begin < ids.size())
+    {
+        size_t n = 1;
+        while (n * 2 <= ids.size() - begin && n * 2 <= kMaxBatchIds)
+        {
+            n *= 2;
+        }
+        Statement *stmt = mysql->prepare(batchNameSql(n));
+        if (stmt != nullptr)
         {
-            MYSQL_ROW row = mysql_fetch_row(res);
-            if (row != nullptr)
+            for (size_t i = 0; i < n; ++i)
             {
-                User user;
-                user.setId(atoi(row[0]));
-                user.setName(row[1]);
-                user.setPwd(row[2]);
-                user.setState(row[3]);
-                mysql_free_result(res);
-                return user;
+                stmt->bindInt(i, ids[begin + i]);
+            }
+            if (stmt->execute())
+            {
+                while (stmt->fetch())
+                {
+                    vec.push_back(User(stmt->getInt(0), stmt->getString(1)));
+                }
             }
         }
+        begin += n;
     }
-    return User();
+    return vec;
 }
 
-bool UserModel::updateState(User user)
+User UserModel::queryCredential(int id)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "update user set state = '%s' where id = %d", user.getState().c_str(), user.getId());
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        if (mysql.update(sql))
+        Statement *stmt = mysql->prepare("select id, name, password from user where id = ?");
+        if (stmt != nullptr)
         {
-            return true;
+            stmt->bindInt(0, id);
+            if (stmt->execute() && stmt->fetch())
+            {
+                User user;
+                user.setId(stmt->getInt(0));
+                user.setName(stmt->getString(1));
+                user.setPwd(stmt->getString(2));
+                return user;
+            }
         }
     }
-    return false;
+    return User();
 }
 
-void UserModel::resetState()
+bool UserModel::updatePassword(int id, const std::string &password)
 {
-    char sql[1024] = "update user set state = 'offline' where state = 'online'";
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql != nullptr)
     {
-        mysql.update(sql);
+        Statement *stmt = mysql->prepare("update user set password = ? where id = ?");
+        if (stmt != nullptr)
+        {
+            stmt->bindString(0, password);
+            stmt->bindInt(1, id);
+            return stmt->execute();
+        }
     }
+    return false;
 }
@@ -0,0 +1,164 @@
+#include "passwordhash.hpp"
+#include <cstring>
+#include <atomic>
+#include <cstdlib>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+// 哈希记录的前缀、盐和哈希的长度
+static const char *kHashPrefix = "pbkdf2_sha256$";
+static const size_t kSaltLen = 16;
+static const size_t kDigestLen = 32;
+
+// 新生成的哈希记录使用的迭代次数
+static std::atomic<int> g_iterations(PasswordHash::kDefaultIterations);
+
+static std::string toHex(const unsigned char *data, size_t len)
+{
+    static const char *kDigits = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(len * 2);
+    for (size_t i = 0; i < len; ++i)
+    {
+        hex.push_back(kDigits[data[i] >> 4]);
+        hex.push_back(kDigits[data[i] & 0xf]);
+    }
+    return hex;
+}
+
+static bool fromHex(const std::string &hex, std::string &out)
+{
+    if (hex.size() % 2 != 0)
+    {
+        return false;
+    }
+    out.clear();
+    for (size_t i = 0; i < hex.size(); i += 2)
+    {
+        int value = 0;
+        for (size_t j = i; j < i + 2; ++j)
+        {
+            char c = hex[j];
+            int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+            if (digit < 0)
+            {
+                return false;
+            }
+            value = value * 16 + digit;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+    return true;
+}
+
+// PBKDF2-HMAC-SHA256，输出一个摘要长度的密钥
+static bool pbkdf2(const std::string &password, const std::string &salt, int iterations,
+                   unsigned char out[kDigestLen])
+{
+    return PKCS5_PBKDF2_HMAC(password.data(), static_cast<int>(password.size()),
+                             reinterpret_cast<const unsigned char *>(salt.data()), static_cast<int>(salt.size()),
+                             iterations, EVP_sha256(), kDigestLen, out) == 1;
+}
+
+// 解析哈希记录中的迭代次数、盐和哈希，格式不对返回false
+static bool parseRecord(const std::string &record, int &iterations, std::string &salt, std::string &expected)
+{
+    if (record.compare(0, strlen(kHashPrefix), kHashPrefix) != 0)
+    {
+        return false;
+    }
+    size_t iterPos = strlen(kHashPrefix);
+    size_t saltPos = record.find('$', iterPos);
+    size_t hashPos = saltPos == std::string::npos ? std::string::npos : record.find('$', saltPos + 1);
+    if (hashPos == std::string::npos)
+    {
+        return false;
+    }
+    iterations = atoi(record.substr(iterPos, saltPos - iterPos).c_str());
+    return iterations > 0 && fromHex(record.substr(saltPos + 1, hashPos - saltPos - 1), salt) &&
+           fromHex(record.substr(hashPos + 1), expected) && expected.size() == kDigestLen;
+}
+
+// 设置新生成的哈希记录使用的迭代次数
+void PasswordHash::setIterations(int iterations)
+{
+    if (iterations > 0)
+    {
+        g_iterations = iterations;
+    }
+}
+
+// 新生成的哈希记录使用的迭代次数
+int PasswordHash::iterations()
+{
+    return g_iterations;
+}
+
+// 生成随机盐并计算密码的哈希记录
+std::string PasswordHash::hash(const std::string &password)
+{
+    unsigned char salt[kSaltLen];
+    unsigned char digest[kDigestLen];
+    int iterations = g_iterations;
+    if (RAND_bytes(salt, sizeof(salt)) != 1 ||
+        !pbkdf2(password, std::string(reinterpret_cast<const char *>(salt), sizeof(salt)), iterations, digest))
+    {
+        // 生成失败返回空记录，空记录不会被任何密码验证通过
+        return std::string();
+    }
+    return std::string(kHashPrefix) + std::to_string(iterations) + "$" +
+           toHex(salt, sizeof(salt)) + "$" + toHex(digest, sizeof(digest));
+}
+
+// 验证密码和数据库中的记录是否匹配
+bool PasswordHash::verify(const std::string &password, const std::string &record)
+{
+    int iterations = 0;
+    std::string salt;
+    std::string expected;
+    if (!parseRecord(record, iterations, salt, expected))
+    {
+        // 旧版本的明文密码，空记录不匹配任何密码
+        return record.compare(0, strlen(kHashPrefix), kHashPrefix) != 0 && !record.empty() &&
+               equals(password, record);
+    }
+    unsigned char digest[kDigestLen];
+    if (!pbkdf2(password, salt, iterations, digest))
+    {
+        return false;
+    }
+    return equals(std::string(reinterpret_cast<const char *>(digest), sizeof(digest)), expected);
+}
+
+// 记录是否需要重新计算哈希
+bool PasswordHash::needsRehash(const std::string &record)
+{
+    int iterations = 0;
+    std::string salt;
+    std::string expected;
+    return !parseRecord(record, iterations, salt, expected) || iterations != g_iterations;
+}
+
+// 用进程内的随机密钥计算密码的HMAC
+std::string PasswordHash::fingerprint(const std::string &password)
+{
+    static const std::string key = []
+    {
+        unsigned char bytes[kDigestLen];
+        RAND_bytes(bytes, sizeof(bytes));
+        return std::string(reinterpret_cast<const char *>(bytes), sizeof(bytes));
+    }();
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()),
+         reinterpret_cast<const unsigned char *>(password.data()), password.size(), digest, &len);
+    return std::string(reinterpret_cast<const char *>(digest), len);
+}
+
+// 比较时间和内容无关
+bool PasswordHash::equals(const std::string &a, const std::string &b)
+{
+    return a.size() == b.size() && CRYPTO_memcmp(a.data(), b.data(), a.size()) == 0;
+}
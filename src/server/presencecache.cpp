@@ -0,0 +1,216 @@
+#include "presencecache.hpp"
+
+// 每个块保存65536个用户的状态，占用16KB
+static const int kChunkShift = 16;
+static const int kChunkUsers = 1 << kChunkShift;
+// 每个64位的字保存32个用户的状态
+static const int kUsersPerWord = 32;
+static const int kWordsPerChunk = kChunkUsers / kUsersPerWord;
+// 版本号的分段数，同一分段的用户变更时互相放弃回填，分段足够多时冲突很少
+static const int kVersionStripes = 4096;
+
+PresenceCache::PresenceCache(int maxUsers)
+    : _maxUsers(maxUsers),
+      _chunkCount((maxUsers + kChunkUsers - 1) / kChunkUsers),
+      _chunks(new std::atomic<Word *>[_chunkCount]),
+      _allocatedChunks(0),
+      _versions(new std::atomic<long long>[kVersionStripes]),
+      _hits(0), _misses(0)
+{
+    for (int i = 0; i < _chunkCount; ++i)
+    {
+        _chunks[i] = nullptr;
+    }
+    for (int i = 0; i < kVersionStripes; ++i)
+    {
+        _versions[i] = 0;
+    }
+}
+
+PresenceCache::~PresenceCache()
+{
+    for (int i = 0; i < _chunkCount; ++i)
+    {
+        delete[] _chunks[i].load();
+    }
+}
+
+// 获取用户所在的块
+PresenceCache::Word *PresenceCache::getChunk(int userid, bool create)
+{
+    if (userid < 0 || userid >= _maxUsers)
+    {
+        return nullptr;
+    }
+    std::atomic<Word *> &slot = _chunks[userid >> kChunkShift];
+    Word *chunk = slot.load(std::memory_order_acquire);
+    if (chunk != nullptr || !create)
+    {
+        return chunk;
+    }
+
+    Word *fresh = new Word[kWordsPerChunk];
+    for (int i = 0; i < kWordsPerChunk; ++i)
+    {
+        fresh[i].store(0, std::memory_order_relaxed);
+    }
+    // 多个线程同时创建同一个块时，只有一个能成功
+    if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+    {
+        ++_allocatedChunks;
+        return fresh;
+    }
+    delete[] fresh;
+    return chunk;
+}
+
+// 查询用户的在线状态
+EnPresence PresenceCache::get(int userid)
+{
+    Word *chunk = getChunk(userid, false);
+    EnPresence presence = PRESENCE_UNKNOWN;
+    if (chunk != nullptr)
+    {
+        int offset = userid & (kChunkUsers - 1);
+        uint64_t word = chunk[offset / kUsersPerWord].load(std::memory_order_relaxed);
+        presence = static_cast<EnPresence>((word >> (offset % kUsersPerWord * 2)) & 0x3);
+    }
+
+    if (presence == PRESENCE_UNKNOWN)
+    {
+        ++_misses;
+    }
+    else
+    {
+        ++_hits;
+    }
+    return presence;
+}
+
+// 用户所在分段的版本号
+std::atomic<long long> &PresenceCache::versionOf(int userid)
+{
+    return _versions[static_cast<unsigned int>(userid) % kVersionStripes];
+}
+
+// 增加所有分段的版本号
+void PresenceCache::bumpAllVersions()
+{
+    for (int i = 0; i < kVersionStripes; ++i)
+    {
+        ++_versions[i];
+    }
+}
+
+// 获取用户当前的版本号
+long long PresenceCache::version(int userid)
+{
+    return versionOf(userid).load();
+}
+
+// 设置用户的在线状态
+void PresenceCache::set(int userid, EnPresence presence)
+{
+    // 先增加版本号再写入状态，正在回填的旧状态要么看到新版本号放弃，要么被这次写入覆盖
+    ++versionOf(userid);
+    update(userid, presence, nullptr);
+}
+
+// 只在缓存中没有该用户状态、并且加载期间该用户的状态没有变更过时才设置
+void PresenceCache::fill(int userid, EnPresence presence, long long version)
+{
+    std::atomic<long long> &current = versionOf(userid);
+    if (current.load() != version)
+    {
+        return;
+    }
+    EnPresence expect = PRESENCE_UNKNOWN;
+    if (update(userid, presence, &expect) && current.load() != version)
+    {
+        // 检查版本号和写入之间状态被重置成了未知，撤销这次回填，下次查询时重新加载
+        update(userid, PRESENCE_UNKNOWN, &presence);
+    }
+}
+
+// 更新用户的状态
+bool PresenceCache::update(int userid, EnPresence presence, const EnPresence *expect)
+{
+    Word *chunk = getChunk(userid, true);
+    if (chunk == nullptr)
+    {
+        return false;
+    }
+    int offset = userid & (kChunkUsers - 1);
+    int shift = offset % kUsersPerWord * 2;
+    Word &word = chunk[offset / kUsersPerWord];
+    uint64_t old = word.load(std::memory_order_relaxed);
+    uint64_t value;
+    do
+    {
+        if (expect != nullptr && static_cast<EnPresence>((old >> shift) & 0x3) != *expect)
+        {
+            return false;
+        }
+        value = (old & ~(uint64_t(0x3) << shift)) | (uint64_t(presence) << shift);
+    } while (!word.compare_exchange_weak(old, value, std::memory_order_relaxed));
+    return true;
+}
+
+// 清空所有用户的状态
+void PresenceCache::clear()
+{
+    bumpAllVersions();
+    for (int i = 0; i < _chunkCount; ++i)
+    {
+        Word *chunk = _chunks[i].load(std::memory_order_acquire);
+        if (chunk == nullptr)
+        {
+            continue;
+        }
+        for (int j = 0; j < kWordsPerChunk; ++j)
+        {
+            chunk[j].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// 把所有离线状态重置成未知
+void PresenceCache::expireOffline()
+{
+    // 每个状态的低位
+    static const uint64_t kLowBits = 0x5555555555555555ULL;
+    bumpAllVersions();
+    for (int i = 0; i < _chunkCount; ++i)
+    {
+        Word *chunk = _chunks[i].load(std::memory_order_acquire);
+        if (chunk == nullptr)
+        {
+            continue;
+        }
+        for (int j = 0; j < kWordsPerChunk; ++j)
+        {
+            uint64_t old = chunk[j].load(std::memory_order_relaxed);
+            uint64_t value;
+            do
+            {
+                // 离线状态的编码是10，找出高位为1、低位为0的状态并清除高位
+                uint64_t offline = (old >> 1) & ~old & kLowBits;
+                if (offline == 0)
+                {
+                    break;
+                }
+                value = old & ~(offline << 1);
+            } while (!chunk[j].compare_exchange_weak(old, value, std::memory_order_relaxed));
+        }
+    }
+}
+
+// 获取缓存的统计信息
+PresenceCacheStats PresenceCache::getStats()
+{
+    PresenceCacheStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    stats.memoryBytes = _allocatedChunks * kWordsPerChunk * sizeof(Word);
+    return stats;
+}
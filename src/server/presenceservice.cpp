@@ -0,0 +1,383 @@
+#include "presenceservice.hpp"
+#include "trace.hpp"
+#include <muduo/base/Logging.h>
+
+// 心跳的过期时间(s)和刷新间隔，刷新间隔远小于过期时间，偶尔一次刷新失败不会被误判为宕机
+static const int kHeartbeatTtl = 15;
+static const std::chrono::seconds kHeartbeatInterval(5);
+// 其它服务器存活状态的本地缓存时间
+static const std::chrono::milliseconds kNodeCheckInterval(2000);
+// 缓存的离线状态的有效期，离线通知和其它服务器上的上线通知乱序到达时，错误的离线状态最多保留这么久
+static const std::chrono::seconds kOfflineTtl(60);
+
+PresenceService::PresenceService(Redis &redis, const std::string &nodeId)
+    : _redis(redis), _nodeId(nodeId), _running(false)
+{
+}
+
+PresenceService::~PresenceService()
+{
+    stopHeartbeat();
+}
+
+// 停止心跳线程
+void PresenceService::stopHeartbeat()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_running)
+        {
+            return;
+        }
+        _running = false;
+    }
+    _cv.notify_one();
+    _thread.join();
+}
+
+// 集群内广播用户在线状态变更的控制通道
+const char *PresenceService::channel()
+{
+    return "presence";
+}
+
+// 刷新本服务器的心跳并启动心跳线程
+void PresenceService::start()
+{
+    // 先同步刷新一次，其它服务器在本服务器接受登录之前就能看到心跳
+    _redis.set_heartbeat(_nodeId, kHeartbeatTtl);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_running)
+    {
+        _running = true;
+        _thread = std::thread(std::bind(&PresenceService::heartbeatTask, this));
+    }
+}
+
+// 心跳线程，定期刷新本服务器的心跳
+void PresenceService::heartbeatTask()
+{
+    std::chrono::steady_clock::time_point lastExpire = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_running)
+    {
+        _cv.wait_for(lock, kHeartbeatInterval, [this]
+                     { return !_running; });
+        if (!_running)
+        {
+            break;
+        }
+        lock.unlock();
+        if (!_redis.set_heartbeat(_nodeId, kHeartbeatTtl))
+        {
+            LOG_ERROR << "refresh heartbeat failed, node:" << _nodeId;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - lastExpire >= kOfflineTtl)
+        {
+            _presenceCache.expireOffline();
+            lastExpire = now;
+        }
+        lock.lock();
+    }
+}
+
+// 用户在本服务器登录
+bool PresenceService::login(int userid)
+{
+    TRACE_SPAN("claim_presence");
+    std::string owner;
+    if (!_redis.claim_location(userid, _nodeId, owner))
+    {
+        // redis不可用时无法判断其它服务器上的登录，只按本服务器的连接表判断，放行登录
+        LOG_ERROR << "claim location failed, userid:" << userid;
+    }
+    else if (!owner.empty())
+    {
+        return false;
+    }
+    publish(userid, PRESENCE_ONLINE);
+    return true;
+}
+
+// 用户在本服务器下线
+void PresenceService::logout(int userid)
+{
+    // 从位置目录中删除，只删除登记在本服务器上的记录
+    bool removed = false;
+    _redis.remove_location(userid, _nodeId, &removed);
+    if (removed)
+    {
+        publish(userid, PRESENCE_OFFLINE);
+        return;
+    }
+    // 记录不在本服务器上，用户可能已经在其它服务器上重新登录，不发送下线通知，缓存重置成未知后重新查询
+    _locationCache.erase(userid);
+    _presenceCache.set(userid, PRESENCE_UNKNOWN);
+}
+
+// 更新本地缓存，并通知集群中的其它服务器
+void PresenceService::publish(int userid, EnPresence presence)
+{
+    TRACE_SPAN("update_presence");
+    _presenceCache.set(userid, presence);
+    if (presence == PRESENCE_ONLINE)
+    {
+        _locationCache.set(userid, _nodeId);
+        _redis.publish(channel(), std::to_string(userid) + ":1:" + _nodeId);
+    }
+    else
+    {
+        _locationCache.erase(userid);
+        _redis.publish(channel(), std::to_string(userid) + ":0:" + _nodeId);
+    }
+}
+
+// 服务器是否存活
+bool PresenceService::isNodeAlive(const std::string &node)
+{
+    if (node == _nodeId)
+    {
+        return true;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(_nodeMutex);
+        auto it = _nodes.find(node);
+        if (it != _nodes.end() && now - it->second.second < kNodeCheckInterval)
+        {
+            return it->second.first;
+        }
+    }
+    bool alive = false;
+    if (!_redis.get_heartbeat(node, alive))
+    {
+        // redis出错时按存活处理，真正宕机的服务器由路由通道的重发超时兜底
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(_nodeMutex);
+    _nodes[node] = std::make_pair(alive, now);
+    return alive;
+}
+
+// 服务器已经宕机，丢弃缓存的用户位置，并从位置目录删除
+void PresenceService::dropStale(int userid, const std::string &node)
+{
+    // 用户可能同时在其它服务器上重新登录，只删除登记在宕机服务器上的记录，缓存重置成未知后重新查询
+    _redis.remove_location(userid, node);
+    _locationCache.erase(userid);
+    _presenceCache.set(userid, PRESENCE_UNKNOWN);
+}
+
+// 查询用户登录所在的服务器
+std::string PresenceService::findUserNode(int userid)
+{
+    TRACE_SPAN("find_user_node");
+    std::string node;
+    if (_presenceCache.get(userid) == PRESENCE_OFFLINE)
+    {
+        return node;
+    }
+    if (!_locationCache.get(userid, node))
+    {
+        // 缓存未命中，从redis位置目录加载并回填缓存
+        long long locationVersion = _locationCache.version(userid);
+        long long presenceVersion = _presenceCache.version(userid);
+        if (_redis.get_location(userid, node))
+        {
+            if (!node.empty())
+            {
+                _locationCache.put(userid, node, locationVersion);
+            }
+            _presenceCache.fill(userid, node.empty() ? PRESENCE_OFFLINE : PRESENCE_ONLINE, presenceVersion);
+        }
+    }
+    if (!node.empty() && !isNodeAlive(node))
+    {
+        dropStale(userid, node);
+        node.clear();
+    }
+    return node;
+}
+
+// 批量查询用户登录所在的服务器
+void PresenceService::findUserNodes(const std::vector<int> &userids,
+                                    std::unordered_map<std::string, std::vector<int>> &byNode,
+                                    std::vector<int> &offline)
+{
+    TRACE_SPAN("find_user_nodes");
+    std::unordered_map<std::string, std::vector<int>> found;
+    std::vector<int> missing;
+    std::string node;
+    for (int userid : userids)
+    {
+        if (_presenceCache.get(userid) == PRESENCE_OFFLINE)
+        {
+            offline.push_back(userid);
+        }
+        else if (_locationCache.get(userid, node))
+        {
+            found[node].push_back(userid);
+        }
+        else
+        {
+            missing.push_back(userid);
+        }
+    }
+
+    // 缓存未命中的用户一次从redis位置目录加载并回填缓存
+    if (!missing.empty())
+    {
+        // 每个用户分别记录加载前的版本号，只放弃加载期间发生过变更的用户
+        std::vector<long long> locationVersions;
+        std::vector<long long> presenceVersions;
+        locationVersions.reserve(missing.size());
+        presenceVersions.reserve(missing.size());
+        for (int userid : missing)
+        {
+            locationVersions.push_back(_locationCache.version(userid));
+            presenceVersions.push_back(_presenceCache.version(userid));
+        }
+        std::vector<std::string> nodes;
+        if (_redis.get_locations(missing, nodes))
+        {
+            for (size_t i = 0; i < missing.size(); ++i)
+            {
+                if (nodes[i].empty())
+                {
+                    _presenceCache.fill(missing[i], PRESENCE_OFFLINE, presenceVersions[i]);
+                    offline.push_back(missing[i]);
+                }
+                else
+                {
+                    _locationCache.put(missing[i], nodes[i], locationVersions[i]);
+                    _presenceCache.fill(missing[i], PRESENCE_ONLINE, presenceVersions[i]);
+                    found[nodes[i]].push_back(missing[i]);
+                }
+            }
+        }
+        else
+        {
+            offline.insert(offline.end(), missing.begin(), missing.end());
+        }
+    }
+
+    // 服务器的数量很少，每个服务器只检查一次心跳
+    for (auto &item : found)
+    {
+        if (isNodeAlive(item.first))
+        {
+            std::vector<int> &users = byNode[item.first];
+            users.insert(users.end(), item.second.begin(), item.second.end());
+            continue;
+        }
+        for (int userid : item.second)
+        {
+            dropStale(userid, item.first);
+        }
+        offline.insert(offline.end(), item.second.begin(), item.second.end());
+    }
+}
+
+// 查询userids中在线的用户
+std::unordered_set<int> PresenceService::onlineUsers(const std::vector<int> &userids)
+{
+    std::unordered_map<std::string, std::vector<int>> byNode;
+    std::vector<int> offline;
+    findUserNodes(userids, byNode, offline);
+    std::unordered_set<int> online;
+    for (const auto &item : byNode)
+    {
+        online.insert(item.second.begin(), item.second.end());
+    }
+    return online;
+}
+
+// 处理控制通道上其它服务器发来的在线状态通知
+void PresenceService::handleControlMessage(const std::string &msg)
+{
+    // 消息格式为 userid:1:服务器名 上线、userid:0:服务器名 下线，* 表示丢弃所有缓存
+    if (msg == "*")
+    {
+        _presenceCache.clear();
+        _locationCache.clear();
+        std::lock_guard<std::mutex> lock(_nodeMutex);
+        _nodes.clear();
+        return;
+    }
+    size_t idx = msg.find(':');
+    if (idx == std::string::npos)
+    {
+        LOG_ERROR << "invalid presence message:" << msg;
+        return;
+    }
+    int userid = atoi(msg.substr(0, idx).c_str());
+    size_t nodeIdx = msg.find(':', idx + 1);
+    std::string node = nodeIdx == std::string::npos ? std::string() : msg.substr(nodeIdx + 1);
+    if (msg.compare(idx + 1, 1, "1") == 0 && !node.empty())
+    {
+        _presenceCache.set(userid, PRESENCE_ONLINE);
+        _locationCache.set(userid, node);
+        // 刚刚有用户在该服务器上登录，服务器一定存活
+        std::lock_guard<std::mutex> lock(_nodeMutex);
+        _nodes[node] = std::make_pair(true, std::chrono::steady_clock::now());
+    }
+    else
+    {
+        // 下线通知可能晚于用户在其它服务器上的上线通知到达，缓存的位置不是发出通知的服务器时忽略
+        std::string cached;
+        if (!node.empty() && _locationCache.get(userid, cached) && cached != node)
+        {
+            return;
+        }
+        _presenceCache.set(userid, PRESENCE_OFFLINE);
+        _locationCache.erase(userid);
+    }
+}
+
+// redis订阅连接重连后丢弃缓存，重新登记本服务器上的用户
+void PresenceService::resync(const std::vector<int> &localUsers)
+{
+    // 断开期间可能错过了在线状态的变更通知
+    _presenceCache.clear();
+    _locationCache.clear();
+    {
+        std::lock_guard<std::mutex> lock(_nodeMutex);
+        _nodes.clear();
+    }
+
+    // redis可能已经重启，心跳和位置目录都需要重新登记
+    _redis.set_heartbeat(_nodeId, kHeartbeatTtl);
+    for (int userid : localUsers)
+    {
+        _redis.set_location(userid, _nodeId);
+    }
+}
+
+// 服务器退出
+void PresenceService::shutdown(const std::vector<int> &localUsers)
+{
+    // 先停止并删除心跳，其它服务器不再把消息转发到本服务器
+    stopHeartbeat();
+    _redis.remove_heartbeat(_nodeId);
+    for (int userid : localUsers)
+    {
+        _redis.remove_location(userid, _nodeId);
+    }
+    _presenceCache.clear();
+    _locationCache.clear();
+    // 退出时发送线程已经停止，在命令连接上同步发布
+    _redis.publish_now(channel(), "*");
+}
+
+// 获取在线状态缓存的统计信息
+PresenceCacheStats PresenceService::getPresenceCacheStats()
+{
+    return _presenceCache.getStats();
+}
+
+// 获取位置缓存的统计信息
+LocationCacheStats PresenceService::getLocationCacheStats()
+{
+    return _locationCache.getStats();
+}
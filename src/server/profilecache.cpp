@@ -0,0 +1,52 @@
+#include "profilecache.hpp"
+
+ProfileCache::ProfileCache(size_t maxUsers)
+    : _maxUsers(maxUsers), _hits(0), _misses(0)
+{
+}
+
+// 批量查询用户名
+void ProfileCache::get(const std::vector<int> &userids, std::vector<std::string> &names, std::vector<int> &missing)
+{
+    names.assign(userids.size(), std::string());
+    long long hits = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < userids.size(); ++i)
+        {
+            auto it = _names.find(userids[i]);
+            if (it == _names.end())
+            {
+                missing.push_back(userids[i]);
+                continue;
+            }
+            names[i] = it->second;
+            ++hits;
+        }
+    }
+    _hits += hits;
+    _misses += userids.size() - hits;
+}
+
+// 放入从数据库加载的用户名
+void ProfileCache::put(int userid, const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_names.size() >= _maxUsers && _names.find(userid) == _names.end() && !_names.empty())
+    {
+        // 超过容量上限，淘汰一个用户，下次使用时重新从数据库加载
+        _names.erase(_names.begin());
+    }
+    _names[userid] = name;
+}
+
+// 获取缓存的统计信息
+ProfileCacheStats ProfileCache::getStats()
+{
+    ProfileCacheStats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    std::lock_guard<std::mutex> lock(_mutex);
+    stats.users = _names.size();
+    return stats;
+}
@@ -1,14 +1,78 @@
 #include "redis.hpp"
+#include "trace.hpp"
 #include <string>
 #include <iostream>
 #include <thread>
+#include <cstring>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+#include <cstdio>
+
+// redis服务器地址
+static const char *kRedisHost = "127.0.0.1";
+static const int kRedisPort = 6379;
+
+// 发送队列中命令数的上限，超过后拒绝发布，反压到业务线程
+static const size_t kMaxPendingPublish = 100000;
+// 一次流水线写出的命令数上限，限制hiredis输出缓冲区的大小
+static const size_t kMaxPipelineCommands = 1024;
+// 流水线缓冲区保留的最大容量
+static const size_t kMaxRetainedBuffer = 4 * 1024 * 1024;
+// 没有送达的路由通道消息的重发间隔和最长重发时间
+static const int kRetryIntervalMs = 100;
+static const int kRetryWindowMs = 5000;
+// 订阅连接重连的退避间隔
+static const int kMinBackoffMs = 100;
+static const int kMaxBackoffMs = 5000;
+
+// 服务器路由通道名的前缀，通道名为 node:服务器名
+static const std::string kNodeChannelPrefix = "node:";
+// 位置目录，hash结构 userid => 服务器名
+static const char *kLocationKey = "chat:location";
+// 只在用户仍然记录在指定服务器上时删除
+static const char *kRemoveLocationScript =
+    "if redis.call('hget', KEYS[1], ARGV[1]) == ARGV[2] then "
+    "return redis.call('hdel', KEYS[1], ARGV[1]) end return 0";
+
+// 服务器心跳的key前缀，完整的key是 前缀+服务器名
+static const char *kHeartbeatKeyPrefix = "chat:node:";
+// 用户没有登记，或者登记的服务器心跳已经过期时登记到新的服务器，否则返回登记的服务器
+static const char *kClaimLocationScript =
+    "local cur = redis.call('hget', KEYS[1], ARGV[1]) "
+    "if cur and cur ~= ARGV[2] and redis.call('exists', ARGV[3] .. cur) == 1 then return cur end "
+    "redis.call('hset', KEYS[1], ARGV[1], ARGV[2]) return ''";
+
+// 是否是服务器的路由通道
+static bool isNodeChannel(const char *channel)
+{
+    return strncmp(channel, kNodeChannelPrefix.data(), kNodeChannelPrefix.size()) == 0;
+}
+
 Redis::Redis()
-    : _publish_context(nullptr), _subscribe_context(nullptr)
+    : _publish_context(nullptr), _running(false),
+      _published(0), _failed(0), _rejected(0), _retried(0), _undelivered(0), _batches(0),
+      _totalLatencyUs(0), _maxLatencyUs(0), _subscribe_context(nullptr), _stopping(false),
+      _messages(0), _confirmations(0), _reconnects(0), _totalGapMs(0), _maxGapMs(0),
+      _subscribed(false), _command_context(nullptr)
 {
+    Metrics *metrics = Metrics::instance();
+    _publishLatency = metrics->histogram("chat_redis_publish_latency_us", "Time from enqueueing a publish to its reply.");
+    _notifyLatency = metrics->histogram("chat_redis_notify_latency_us", "Time spent handling a routed channel message.");
+    const char *help = "Location directory command time including the wait for the command connection.";
+    _setLocationLatency = metrics->histogram("chat_redis_command_latency_us", help, "command=\"set_location\"");
+    _removeLocationLatency = metrics->histogram("chat_redis_command_latency_us", help, "command=\"remove_location\"");
+    _getLocationLatency = metrics->histogram("chat_redis_command_latency_us", help, "command=\"get_location\"");
+    _getLocationsLatency = metrics->histogram("chat_redis_command_latency_us", help, "command=\"get_locations\"");
+    _claimLocationLatency = metrics->histogram("chat_redis_command_latency_us", help, "command=\"claim_location\"");
+    _heartbeatLatency = metrics->histogram("chat_redis_command_latency_us", help, "command=\"heartbeat\"");
 }
 
 Redis::~Redis()
 {
+    stop();
     if (_publish_context != nullptr)
     {
         redisFree(_publish_context);
@@ -17,57 +81,392 @@ Redis::~Redis()
     {
         redisFree(_subscribe_context);
     }
+    if (_command_context != nullptr)
+    {
+        redisFree(_command_context);
+    }
+}
+
+// 停止订阅线程和发送线程
+void Redis::stop()
+{
+    if (_subscribe_thread.joinable())
+    {
+        {
+            // 关闭订阅连接的读写，阻塞在读取上的订阅线程返回错误后退出
+            std::lock_guard<std::mutex> lock(_subscribe_mutex);
+            _stopping = true;
+            if (_subscribe_context != nullptr)
+            {
+                ::shutdown(_subscribe_context->fd, SHUT_RDWR);
+            }
+        }
+        _subscribe_cv.notify_all();
+        _subscribe_thread.join();
+    }
+    if (_publish_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_publish_mutex);
+            _running = false;
+        }
+        _publish_cv.notify_one();
+        // 发送线程退出前会把队列中剩余的命令发完
+        _publish_thread.join();
+    }
 }
 
 // 连接服务器
 bool Redis::connect()
 {
     // 负责publish发布消息上下文连接
-    _publish_context = redisConnect("127.0.0.1", 6379);
+    _publish_context = redisConnect(kRedisHost, kRedisPort);
     if (_publish_context == nullptr || _publish_context->err)
     {
-        std::cerr << "connect redis failed!" << _publish_context->errstr << std::endl;
+        std::cerr << "connect redis failed!" << std::endl;
         return false;
     }
     // 负责subscribe订阅消息的上下文连接
-    _subscribe_context = redisConnect("127.0.0.1", 6379);
+    _subscribe_context = redisConnect(kRedisHost, kRedisPort);
     if (_subscribe_context == nullptr || _subscribe_context->err)
     {
-        std::cerr << "connect redis failed!" << _subscribe_context->errstr << std::endl;
+        std::cerr << "connect redis failed!" << std::endl;
+        return false;
+    }
+
+    // 负责位置目录读写的上下文连接
+    _command_context = redisConnect(kRedisHost, kRedisPort);
+    if (_command_context == nullptr || _command_context->err)
+    {
+        std::cerr << "connect redis failed!" << std::endl;
         return false;
     }
+    _subscribed = true;
 
     // 在单独的线程中，监听通道上的事件，有消息给业务层进行上报
-    std::thread t([&]()
-                  { observer_channel_message(); });
-    t.detach();
+    _subscribe_thread = std::thread([this]()
+                                    { observer_channel_message(); });
+
+    // 在单独的线程中发送publish命令
+    _running = true;
+    _publish_thread = std::thread([this]()
+                                  { publishTask(); });
 
     std::cout << "connect redis-server success!" << std::endl;
 
     return true;
 };
 
-// 向redis指定通道channel发布消息
-bool Redis::publish(int channel, std::string message)
+// 向指定服务器的路由通道发布消息
+bool Redis::publish_node(const std::string &node, std::string header, std::shared_ptr<const std::string> payload)
+{
+    return enqueue(kNodeChannelPrefix + node, std::move(header), std::move(payload));
+}
+
+// 向集群内部的控制通道发布消息
+bool Redis::publish(const std::string &channel, const std::string &message)
 {
-    redisReply *reply = (redisReply *)redisCommand(_publish_context, "PUBLISH %d %s",
-                                                   channel, message.c_str());
+    return enqueue(channel, std::string(), std::make_shared<const std::string>(message));
+}
+
+// 在命令连接上同步发布控制通道消息
+bool Redis::publish_now(const std::string &channel, const std::string &message)
+{
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "PUBLISH %b %b",
+                                                   channel.data(), channel.size(), message.data(), message.size());
     if (reply == nullptr)
     {
-        std::cerr << "publish command failed!" << std::endl;
+        std::cerr << "publish command failed! " << _command_context->errstr << std::endl;
         return false;
     }
+    bool success = reply->type != REDIS_REPLY_ERROR;
     freeReplyObject(reply);
+    return success;
+}
+
+// 放入发送队列
+bool Redis::enqueue(std::string channel, std::string header, std::shared_ptr<const std::string> payload)
+{
+    {
+        std::lock_guard<std::mutex> lock(_publish_mutex);
+        if (!_running || _publish_queue.size() >= kMaxPendingPublish)
+        {
+            ++_rejected;
+            return false;
+        }
+        _publish_queue.push_back(PublishItem{std::move(channel), std::move(header), std::move(payload),
+                                             std::chrono::steady_clock::now()});
+        // 发送线程正在发送上一批时不需要唤醒，发完之后会再检查队列
+        if (_publish_queue.size() > 1)
+        {
+            return true;
+        }
+    }
+    _publish_cv.notify_one();
     return true;
-};
+}
+
+// 发送线程
+void Redis::publishTask()
+{
+    std::vector<PublishItem> batch;
+    for (;;)
+    {
+        bool running = true;
+        {
+            std::unique_lock<std::mutex> lock(_publish_mutex);
+            auto ready = [this]() -> bool
+            { return !_publish_queue.empty() || !_running; };
+            if (_retry_queue.empty())
+            {
+                _publish_cv.wait(lock, ready);
+            }
+            else
+            {
+                // 有等待重发的命令，最多等待一个重发间隔
+                _publish_cv.wait_for(lock, std::chrono::milliseconds(kRetryIntervalMs), ready);
+            }
+            running = _running;
+            if (!running && _publish_queue.empty() && _retry_queue.empty())
+            {
+                // 停止并且队列中没有命令了
+                break;
+            }
+            batch.swap(_publish_queue);
+        }
+
+        // 重发的命令排在新命令前面，同一个通道上的消息基本保持提交的顺序
+        if (!_retry_queue.empty())
+        {
+            if (!running)
+            {
+                // 停止时不再等待重发，直接交给业务层
+                for (const PublishItem &item : _retry_queue)
+                {
+                    ++_undelivered;
+                    if (_undelivered_handler)
+                    {
+                        _undelivered_handler(item.header, item.payload);
+                    }
+                }
+                _retry_queue.clear();
+            }
+            batch.insert(batch.begin(), std::make_move_iterator(_retry_queue.begin()),
+                         std::make_move_iterator(_retry_queue.end()));
+            _retry_queue.clear();
+        }
+
+        // 发布连接断开后重连，重连失败的命令等待下一次重发
+        if (_publish_context == nullptr || _publish_context->err)
+        {
+            if (_publish_context != nullptr)
+            {
+                redisFree(_publish_context);
+            }
+            _publish_context = redisConnect(kRedisHost, kRedisPort);
+            if (_publish_context == nullptr || _publish_context->err)
+            {
+                std::cerr << "reconnect redis publish context failed!" << std::endl;
+                for (const PublishItem &item : batch)
+                {
+                    retryLater(item);
+                }
+                batch.clear();
+                continue;
+            }
+        }
+
+        for (size_t begin = 0; begin < batch.size(); begin += kMaxPipelineCommands)
+        {
+            pipeline(batch, begin, std::min(batch.size(), begin + kMaxPipelineCommands));
+        }
+        batch.clear();
+    }
+}
+
+// 把一条PUBLISH命令在消息内容之前的部分按redis协议格式追加到cmd
+void Redis::formatPublishPrefix(std::string &cmd, const PublishItem &item)
+{
+    // *3\r\n$7\r\nPUBLISH\r\n$通道长度\r\n通道\r\n$消息长度\r\n头部+消息内容\r\n
+    // 长度前缀的参数是二进制安全的，共享的消息内容紧接着头部单独写出，不需要先合并成一个字符串
+    cmd += "*3\r\n$7\r\nPUBLISH\r\n$";
+    cmd += std::to_string(item.channel.size());
+    cmd += "\r\n";
+    cmd += item.channel;
+    cmd += "\r\n$";
+    cmd += std::to_string(item.header.size() + item.payload->size());
+    cmd += "\r\n";
+    cmd += item.header;
+}
+
+// 阻塞写出iov中的全部数据，处理部分写入和信号中断
+static bool writeFully(int fd, std::vector<struct iovec> &iov)
+{
+    size_t index = 0;
+    while (index < iov.size())
+    {
+        int count = static_cast<int>(std::min(iov.size() - index, static_cast<size_t>(IOV_MAX)));
+        ssize_t n = ::writev(fd, &iov[index], count);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        // 跳过已经写完的部分，写了一半的调整起始位置
+        size_t written = static_cast<size_t>(n);
+        while (index < iov.size() && written >= iov[index].iov_len)
+        {
+            written -= iov[index].iov_len;
+            ++index;
+        }
+        if (written > 0)
+        {
+            iov[index].iov_base = static_cast<char *>(iov[index].iov_base) + written;
+            iov[index].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// 流水线发送batch中[begin, end)的命令
+void Redis::pipeline(const std::vector<PublishItem> &batch, size_t begin, size_t end)
+{
+    // 每条命令在消息内容之前的部分格式化到一块复用的缓冲区，上一条命令结尾的\r\n放在下一段的开头
+    // 共享的消息内容不拷贝，和缓冲区中的各段交替组成iovec，用writev直接写到连接上，再依次读取响应
+    _pipeline_buffer.clear();
+    _pipeline_offsets.clear();
+    for (size_t i = begin; i < end; ++i)
+    {
+        _pipeline_offsets.push_back(_pipeline_buffer.size());
+        if (i != begin)
+        {
+            _pipeline_buffer += "\r\n";
+        }
+        formatPublishPrefix(_pipeline_buffer, batch[i]);
+    }
+    _pipeline_offsets.push_back(_pipeline_buffer.size());
+    _pipeline_buffer += "\r\n";
+
+    // 缓冲区格式化完成后不再扩容，可以取各段的地址
+    char *base = &_pipeline_buffer[0];
+    _pipeline_iov.clear();
+    for (size_t i = begin; i < end; ++i)
+    {
+        size_t from = _pipeline_offsets[i - begin];
+        size_t to = _pipeline_offsets[i - begin + 1];
+        _pipeline_iov.push_back(iovec{base + from, to - from});
+        const std::string &payload = *batch[i].payload;
+        _pipeline_iov.push_back(iovec{const_cast<char *>(payload.data()), payload.size()});
+    }
+    size_t last = _pipeline_offsets[end - begin];
+    _pipeline_iov.push_back(iovec{base + last, _pipeline_buffer.size() - last});
+
+    size_t appended = end;
+    if (!writeFully(_publish_context->fd, _pipeline_iov))
+    {
+        // 可能只写出了一部分命令，连接上的协议流已经不完整，标记连接出错，重发时重新连接
+        _publish_context->err = REDIS_ERR_IO;
+        snprintf(_publish_context->errstr, sizeof(_publish_context->errstr), "%s", strerror(errno));
+        appended = begin;
+    }
+    if (_pipeline_buffer.capacity() > kMaxRetainedBuffer)
+    {
+        // 偶尔出现的大批量命令不长期占用内存
+        std::string().swap(_pipeline_buffer);
+    }
+    ++_batches;
+
+    size_t replied = begin;
+    for (; replied < appended; ++replied)
+    {
+        redisReply *reply = nullptr;
+        if (REDIS_OK != redisGetReply(_publish_context, (void **)&reply) || reply == nullptr)
+        {
+            break;
+        }
+        const PublishItem &item = batch[replied];
+        if (reply->type == REDIS_REPLY_ERROR)
+        {
+            ++_failed;
+        }
+        else if (reply->type == REDIS_REPLY_INTEGER && reply->integer == 0 && isNodeChannel(item.channel.c_str()))
+        {
+            // 目标服务器的订阅连接正在重连，没有收到消息
+            retryLater(item);
+        }
+        else
+        {
+            ++_published;
+            long long latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                                      std::chrono::steady_clock::now() - item.enqueueTime)
+                                      .count();
+            _totalLatencyUs += latencyUs;
+            _publishLatency->observe(latencyUs);
+            long long maxLatencyUs = _maxLatencyUs;
+            while (latencyUs > maxLatencyUs && !_maxLatencyUs.compare_exchange_weak(maxLatencyUs, latencyUs))
+            {
+            }
+        }
+        freeReplyObject(reply);
+    }
+
+    if (replied < end)
+    {
+        // 连接断开，没有收到响应的命令可能已经发布，重发时目标服务器可能收到重复的消息
+        std::cerr << "publish command failed! " << _publish_context->errstr << std::endl;
+        for (size_t i = replied; i < end; ++i)
+        {
+            retryLater(batch[i]);
+        }
+    }
+}
+
+// 没有送达的命令放入重发列表
+void Redis::retryLater(const PublishItem &item)
+{
+    if (std::chrono::steady_clock::now() - item.enqueueTime < std::chrono::milliseconds(kRetryWindowMs))
+    {
+        ++_retried;
+        _retry_queue.push_back(item);
+        return;
+    }
+    if (!isNodeChannel(item.channel.c_str()))
+    {
+        // 控制通道的通知过期后丢弃，其它服务器重连后会重新同步
+        ++_failed;
+        return;
+    }
+    ++_undelivered;
+    if (_undelivered_handler)
+    {
+        _undelivered_handler(item.header, item.payload);
+    }
+}
 
-// 向redis指定的通道subscribe订阅消息
-bool Redis::subscribe(int channel)
+// 订阅本服务器的路由通道
+bool Redis::subscribe_node(const std::string &node)
+{
+    return subscribe(kNodeChannelPrefix + node);
+}
+
+// 订阅集群内部的控制通道
+bool Redis::subscribe(const std::string &channel)
 {
     // SUBSCRIBE命令本身会造成线程阻塞等待通道里面发生消息，这里只做订阅通道，不接受通道消息
     // 通道消息的接收专门在observer_channel_message函数中的独立线程中进行
     // 只负责发送命令，不阻塞接收redis server响应消息，否则和notifyMsg线程抢占响应资源
-    if (REDIS_ERR == redisAppendCommand(this->_subscribe_context, "SUBSCRIBE %d", channel))
+    std::lock_guard<std::mutex> lock(_subscribe_mutex);
+    // 记录订阅的通道，订阅连接重连后重新订阅
+    _channels.push_back(channel);
+    if (REDIS_ERR == redisAppendCommand(this->_subscribe_context, "SUBSCRIBE %b", channel.data(), channel.size()))
     {
         std::cerr << "subscribe command failed! " << this->_subscribe_context->errstr << std::endl;
         return false;
@@ -83,51 +482,464 @@ bool Redis::subscribe(int channel)
             return false;
         }
     }
-
     return true;
-};
+}
 
-// 想redis指定的通道unsubscribe取消订阅消息
-bool Redis::unsubscribe(int channel)
+// 独立线程中接收订阅通道中的消息
+void Redis::observer_channel_message()
 {
-    if (REDIS_ERR == redisAppendCommand(this->_subscribe_context, "UNSUBSCRIBE %d", channel))
+    for (;;)
     {
-        std::cerr << "unsubscribe command failed! " << this->_subscribe_context->errstr << std::endl;
-        return false;
+        redisReply *reply = nullptr;
+        if (REDIS_OK == redisGetReply(this->_subscribe_context, (void **)&reply))
+        {
+            if (reply != nullptr)
+            {
+                dispatch(reply);
+                freeReplyObject(reply);
+            }
+            continue;
+        }
+
+        // 服务器退出，订阅连接已经关闭
+        {
+            std::lock_guard<std::mutex> lock(_subscribe_mutex);
+            if (_stopping)
+            {
+                _subscribed = false;
+                return;
+            }
+        }
+
+        // 订阅连接断开，重连期间发给本服务器的路由通道消息由发送方重发
+        std::cerr << "subscribe connection lost! " << this->_subscribe_context->errstr << std::endl;
+        _subscribed = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!resubscribe())
+        {
+            return;
+        }
+        long long gapMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+        ++_reconnects;
+        _totalGapMs += gapMs;
+        if (gapMs > _maxGapMs)
+        {
+            _maxGapMs = gapMs;
+        }
+        _subscribed = true;
+        std::cerr << "subscribe connection restored after " << gapMs << "ms" << std::endl;
+
+        // 断开期间错过的控制通道消息由业务层重新同步
+        if (_reconnect_handler)
+        {
+            _reconnect_handler();
+        }
     }
+}
 
-    // redisBufferWrite可以循环发送缓冲区，直到缓冲区数据发送完毕(done被置为1)
-    int done = 0;
-    while (!done)
+// 处理订阅连接上收到的一个响应
+void Redis::dispatch(redisReply *reply)
+{
+    // 订阅连接上的响应都是三元素的数组: 类型、通道、消息内容或者订阅的通道数
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+        reply->element[0]->type != REDIS_REPLY_STRING || reply->element[1]->type != REDIS_REPLY_STRING)
     {
-        if (REDIS_ERR == redisBufferWrite(this->_subscribe_context, &done))
+        std::cerr << "unexpected subscribe reply! type:" << reply->type << std::endl;
+        return;
+    }
+
+    const char *kind = reply->element[0]->str;
+    if (strcmp(kind, "message") != 0)
+    {
+        // subscribe和unsubscribe的确认
+        ++_confirmations;
+        return;
+    }
+    redisReply *data = reply->element[2];
+    if (data->type != REDIS_REPLY_STRING)
+    {
+        return;
+    }
+    ++_messages;
+
+    // 路由通道上是转发给本服务器用户的消息，其它的是集群内部的控制通道
+    const char *channel = reply->element[1]->str;
+    if (isNodeChannel(channel))
+    {
+        //给业务层上报通道上发生的消息
+        if (_notify_message_handler)
+        {
+            ScopedLatency latency(_notifyLatency);
+            _notify_message_handler(std::string_view(data->str, data->len));
+        }
+    }
+    else if (_control_message_handler)
+    {
+        _control_message_handler(channel, std::string(data->str, data->len));
+    }
+}
+
+// 订阅连接断开后按退避间隔重连，并重新订阅所有通道
+bool Redis::resubscribe()
+{
+    int backoffMs = kMinBackoffMs;
+    for (;;)
+    {
+        redisContext *context = redisConnect(kRedisHost, kRedisPort);
+        if (context != nullptr && !context->err)
+        {
+            std::lock_guard<std::mutex> lock(_subscribe_mutex);
+            if (_stopping)
+            {
+                redisFree(context);
+                return false;
+            }
+            bool success = true;
+            for (const std::string &channel : _channels)
+            {
+                if (REDIS_ERR == redisAppendCommand(context, "SUBSCRIBE %b", channel.data(), channel.size()))
+                {
+                    success = false;
+                    break;
+                }
+            }
+            int done = 0;
+            while (success && !done)
+            {
+                if (REDIS_ERR == redisBufferWrite(context, &done))
+                {
+                    success = false;
+                }
+            }
+            if (success)
+            {
+                redisFree(_subscribe_context);
+                _subscribe_context = context;
+                return true;
+            }
+        }
+
+        std::cerr << "reconnect redis subscribe context failed! retry after " << backoffMs << "ms" << std::endl;
+        if (context != nullptr)
+        {
+            redisFree(context);
+        }
+        std::unique_lock<std::mutex> lock(_subscribe_mutex);
+        if (_subscribe_cv.wait_for(lock, std::chrono::milliseconds(backoffMs), [this]
+                                   { return _stopping; }))
         {
-            std::cerr << "unsubscribe command failed!" << std::endl;
             return false;
         }
+        lock.unlock();
+        backoffMs = std::min(backoffMs * 2, kMaxBackoffMs);
+    }
+}
+
+// 检查命令连接，出错后重连
+bool Redis::ensureCommandContext()
+{
+    if (_command_context != nullptr && !_command_context->err)
+    {
+        return true;
+    }
+    if (_command_context != nullptr)
+    {
+        redisFree(_command_context);
+    }
+    _command_context = redisConnect(kRedisHost, kRedisPort);
+    if (_command_context == nullptr || _command_context->err)
+    {
+        std::cerr << "reconnect redis command context failed!" << std::endl;
+        return false;
     }
     return true;
-};
+}
 
-// 独立线程中接收订阅通道中的消息
-void Redis::observer_channel_message()
+// 在位置目录中记录用户登录在node服务器上
+bool Redis::set_location(int userid, const std::string &node)
+{
+    ScopedLatency latency(_setLocationLatency);
+    TRACE_SPAN("redis:set_location");
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "HSET %s %d %b",
+                                                   kLocationKey, userid, node.data(), node.size());
+    if (reply == nullptr)
+    {
+        std::cerr << "hset command failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type != REDIS_REPLY_ERROR;
+    freeReplyObject(reply);
+    return success;
+}
+
+// 在位置目录中登记用户，用户已经登记在其它存活的服务器上时返回该服务器
+bool Redis::claim_location(int userid, const std::string &node, std::string &owner)
+{
+    ScopedLatency latency(_claimLocationLatency);
+    TRACE_SPAN("redis:claim_location");
+    owner.clear();
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    std::string field = std::to_string(userid);
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "EVAL %s 1 %s %b %b %s",
+                                                   kClaimLocationScript, kLocationKey,
+                                                   field.data(), field.size(), node.data(), node.size(),
+                                                   kHeartbeatKeyPrefix);
+    if (reply == nullptr)
+    {
+        std::cerr << "claim location failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type == REDIS_REPLY_STRING;
+    if (success)
+    {
+        owner.assign(reply->str, reply->len);
+    }
+    freeReplyObject(reply);
+    return success;
+}
+
+// 从位置目录中删除用户
+bool Redis::remove_location(int userid, const std::string &node, bool *removed)
+{
+    if (removed != nullptr)
+    {
+        *removed = false;
+    }
+    ScopedLatency latency(_removeLocationLatency);
+    TRACE_SPAN("redis:remove_location");
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    std::string field = std::to_string(userid);
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "EVAL %s 1 %s %b %b",
+                                                   kRemoveLocationScript, kLocationKey,
+                                                   field.data(), field.size(), node.data(), node.size());
+    if (reply == nullptr)
+    {
+        std::cerr << "remove location failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type != REDIS_REPLY_ERROR;
+    if (removed != nullptr)
+    {
+        *removed = reply->type == REDIS_REPLY_INTEGER && reply->integer > 0;
+    }
+    freeReplyObject(reply);
+    return success;
+}
+
+// 查询用户所在的服务器
+bool Redis::get_location(int userid, std::string &node)
 {
-    redisReply *reply = nullptr;
-    while (REDIS_OK == redisGetReply(this->_subscribe_context, (void **)&reply))
+    ScopedLatency latency(_getLocationLatency);
+    TRACE_SPAN("redis:get_location");
+    node.clear();
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
     {
-        // 订阅收到的消息是一个带三元素的数组
-        if (reply != nullptr && reply->element[2] != nullptr && reply->element[2]->str != nullptr)
+        return false;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "HGET %s %d", kLocationKey, userid);
+    if (reply == nullptr)
+    {
+        std::cerr << "hget command failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type != REDIS_REPLY_ERROR;
+    if (reply->type == REDIS_REPLY_STRING)
+    {
+        node.assign(reply->str, reply->len);
+    }
+    freeReplyObject(reply);
+    return success;
+}
+
+// 刷新node服务器的心跳
+bool Redis::set_heartbeat(const std::string &node, int ttl)
+{
+    ScopedLatency latency(_heartbeatLatency);
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "SET %s%b 1 EX %d",
+                                                   kHeartbeatKeyPrefix, node.data(), node.size(), ttl);
+    if (reply == nullptr)
+    {
+        std::cerr << "set heartbeat failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type != REDIS_REPLY_ERROR;
+    freeReplyObject(reply);
+    return success;
+}
+
+// 删除node服务器的心跳
+bool Redis::remove_heartbeat(const std::string &node)
+{
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "DEL %s%b",
+                                                   kHeartbeatKeyPrefix, node.data(), node.size());
+    if (reply == nullptr)
+    {
+        std::cerr << "del heartbeat failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type != REDIS_REPLY_ERROR;
+    freeReplyObject(reply);
+    return success;
+}
+
+// 查询node服务器的心跳是否存在
+bool Redis::get_heartbeat(const std::string &node, bool &alive)
+{
+    TRACE_SPAN("redis:get_heartbeat");
+    alive = false;
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    redisReply *reply = (redisReply *)redisCommand(_command_context, "EXISTS %s%b",
+                                                   kHeartbeatKeyPrefix, node.data(), node.size());
+    if (reply == nullptr)
+    {
+        std::cerr << "exists command failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type == REDIS_REPLY_INTEGER;
+    alive = success && reply->integer == 1;
+    freeReplyObject(reply);
+    return success;
+}
+
+// 批量查询用户所在的服务器
+bool Redis::get_locations(const std::vector<int> &userids, std::vector<std::string> &nodes)
+{
+    ScopedLatency latency(_getLocationsLatency);
+    TRACE_SPAN("redis:get_locations");
+    nodes.assign(userids.size(), std::string());
+    if (userids.empty())
+    {
+        return true;
+    }
+
+    // HMGET key field1 field2 ...，参数按长度传递
+    std::vector<std::string> fields;
+    fields.reserve(userids.size());
+    for (int userid : userids)
+    {
+        fields.push_back(std::to_string(userid));
+    }
+    std::vector<const char *> argv;
+    std::vector<size_t> argvlen;
+    argv.reserve(fields.size() + 2);
+    argvlen.reserve(fields.size() + 2);
+    argv.push_back("HMGET");
+    argvlen.push_back(5);
+    argv.push_back(kLocationKey);
+    argvlen.push_back(strlen(kLocationKey));
+    for (const std::string &field : fields)
+    {
+        argv.push_back(field.data());
+        argvlen.push_back(field.size());
+    }
+
+    std::lock_guard<std::mutex> lock(_command_mutex);
+    if (!ensureCommandContext())
+    {
+        return false;
+    }
+    redisReply *reply = (redisReply *)redisCommandArgv(_command_context, argv.size(), argv.data(), argvlen.data());
+    if (reply == nullptr)
+    {
+        std::cerr << "hmget command failed! " << _command_context->errstr << std::endl;
+        return false;
+    }
+    bool success = reply->type == REDIS_REPLY_ARRAY && reply->elements == userids.size();
+    if (success)
+    {
+        for (size_t i = 0; i < reply->elements; ++i)
         {
-            //给业务层上报通道上发生的消息
-            _notify_message_handler(atoi(reply->element[1]->str), reply->element[2]->str);
+            redisReply *element = reply->element[i];
+            if (element->type == REDIS_REPLY_STRING)
+            {
+                nodes[i].assign(element->str, element->len);
+            }
         }
-        freeReplyObject(reply);
     }
-    std::cerr << " >>>>>>>>>>>>>>>>>>>>> observer_channel_message quit <<<<<<<<<<<<<<<<<<<<" << std::endl;
-};
+    freeReplyObject(reply);
+    return success;
+}
 
-// 初始化向业务上报通道消息的回调对象
-void Redis::init_notify_handler(std::function<void(int, std::string)> fun) 
+// 初始化向业务上报路由通道消息的回调对象
+void Redis::init_notify_handler(std::function<void(std::string_view)> fun) 
 {
     this->_notify_message_handler = fun;
 };
+
+// 初始化向业务上报控制通道消息的回调对象
+void Redis::init_control_handler(std::function<void(std::string, std::string)> fun)
+{
+    this->_control_message_handler = fun;
+};
+
+// 初始化订阅连接重连成功的回调对象
+void Redis::init_reconnect_handler(std::function<void()> fun)
+{
+    this->_reconnect_handler = fun;
+}
+
+// 初始化路由通道消息无法送达的回调对象
+void Redis::init_undelivered_handler(std::function<void(const std::string &, std::shared_ptr<const std::string>)> fun)
+{
+    this->_undelivered_handler = fun;
+}
+
+// 获取发布的统计信息
+RedisPublishStats Redis::getPublishStats()
+{
+    RedisPublishStats stats;
+    stats.published = _published;
+    stats.failed = _failed;
+    stats.rejected = _rejected;
+    stats.retried = _retried;
+    stats.undelivered = _undelivered;
+    stats.batches = _batches;
+    stats.totalLatencyUs = _totalLatencyUs;
+    stats.maxLatencyUs = _maxLatencyUs;
+    std::lock_guard<std::mutex> lock(_publish_mutex);
+    stats.pending = _publish_queue.size();
+    return stats;
+}
+
+// 获取订阅的统计信息
+RedisSubscriberStats Redis::getSubscriberStats()
+{
+    RedisSubscriberStats stats;
+    stats.messages = _messages;
+    stats.confirmations = _confirmations;
+    stats.reconnects = _reconnects;
+    stats.totalGapMs = _totalGapMs;
+    stats.maxGapMs = _maxGapMs;
+    stats.connected = _subscribed;
+    return stats;
+}
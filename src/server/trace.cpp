@@ -0,0 +1,197 @@
+#include "trace.hpp"
+#include "metrics.hpp"
+#include <muduo/base/Logging.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <unordered_set>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 一次请求最多记录的阶段数，超过后覆盖最早的阶段
+static const int kMaxSpans = 64;
+// 每秒最多输出的慢请求数，避免服务器过载时日志本身成为负担
+static const int kMaxDumpsPerSecond = 10;
+
+// 一个阶段的记录
+struct SpanRecord
+{
+    const char *name;
+    uint64_t begin;
+    uint64_t end; // 为0表示阶段还没有结束
+    int depth;
+};
+
+// 线程局部的追踪状态，只在所属线程中访问
+struct ThreadTrace
+{
+    bool active = false;
+    int msgid = 0;
+    uint64_t begin = 0;
+    int depth = 0;
+    int count = 0; // 本次请求开始的阶段数，环形缓冲区中保留最近的kMaxSpans个
+    SpanRecord spans[kMaxSpans];
+};
+
+static thread_local ThreadTrace t_trace;
+
+static std::atomic<long long> g_slowThresholdUs{50 * 1000};
+// 慢请求阈值换算成的时间戳计数
+static std::atomic<uint64_t> g_slowThresholdTicks{0};
+
+// 慢请求输出的限流窗口
+static std::atomic<long long> g_dumpSecond{0};
+static std::atomic<int> g_dumpsInSecond{0};
+
+// 设置慢请求的阈值
+void Trace::setSlowThresholdUs(long long us)
+{
+    g_slowThresholdUs = us;
+    g_slowThresholdTicks = static_cast<uint64_t>(us * ticksPerUs());
+}
+
+long long Trace::slowThresholdUs()
+{
+    return g_slowThresholdUs;
+}
+
+// 读取时间戳计数器，没有rdtsc的平台使用单调时钟的纳秒数
+uint64_t Trace::now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+// 时间戳计数器每微秒的计数，第一次调用时对照单调时钟校准
+double Trace::ticksPerUs()
+{
+    static const double ticks = []()
+    {
+        auto clockBegin = std::chrono::steady_clock::now();
+        uint64_t tickBegin = now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t tickEnd = now();
+        long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - clockBegin)
+                           .count();
+        return us > 0 ? static_cast<double>(tickEnd - tickBegin) / us : 1000.0;
+    }();
+    return ticks;
+}
+
+// 保存阶段名字
+const char *Trace::intern(const std::string &name)
+{
+    static std::mutex mutex;
+    static std::unordered_set<std::string> names;
+    std::lock_guard<std::mutex> lock(mutex);
+    return names.insert(name).first->c_str();
+}
+
+// 开始当前线程上的一次请求追踪
+void Trace::beginRequest(int msgid)
+{
+    if (g_slowThresholdUs <= 0)
+    {
+        return;
+    }
+    t_trace.active = true;
+    t_trace.msgid = msgid;
+    t_trace.depth = 0;
+    t_trace.count = 0;
+    t_trace.begin = now();
+}
+
+// 是否允许输出一条慢请求
+static bool allowDump()
+{
+    long long second = std::chrono::duration_cast<std::chrono::seconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+    long long current = g_dumpSecond;
+    if (current != second && g_dumpSecond.compare_exchange_strong(current, second))
+    {
+        g_dumpsInSecond = 0;
+    }
+    return ++g_dumpsInSecond <= kMaxDumpsPerSecond;
+}
+
+// 结束当前线程上的一次请求追踪，超过阈值时输出阶段分解
+void Trace::endRequest()
+{
+    if (!t_trace.active)
+    {
+        return;
+    }
+    t_trace.active = false;
+    uint64_t end = now();
+    if (end - t_trace.begin < g_slowThresholdTicks)
+    {
+        return;
+    }
+
+    static Counter *slowRequests = Metrics::instance()->counter(
+        "chat_slow_requests_total", "Requests slower than the trace threshold.");
+    slowRequests->add();
+    if (!allowDump())
+    {
+        return;
+    }
+
+    // 每个阶段一行: 相对请求开始的时间 阶段耗时 按嵌套层次缩进的名字
+    double perUs = ticksPerUs();
+    int first = t_trace.count > kMaxSpans ? t_trace.count - kMaxSpans : 0;
+    std::string detail;
+    char line[256];
+    for (int i = first; i < t_trace.count; ++i)
+    {
+        const SpanRecord &span = t_trace.spans[i % kMaxSpans];
+        uint64_t spanEnd = span.end != 0 ? span.end : end;
+        snprintf(line, sizeof line, "\n  +%10.1fus %10.1fus %*s%s",
+                 (span.begin - t_trace.begin) / perUs, (spanEnd - span.begin) / perUs,
+                 span.depth * 2, "", span.name);
+        detail += line;
+    }
+    LOG_WARN << "slow request msgid:" << t_trace.msgid
+             << " totalUs:" << static_cast<long long>((end - t_trace.begin) / perUs)
+             << " spans:" << t_trace.count
+             << (first > 0 ? " (earliest spans dropped)" : "") << detail;
+}
+
+// 开始一个阶段，返回阶段的序号
+int Trace::beginSpan(const char *name)
+{
+    if (!t_trace.active)
+    {
+        return -1;
+    }
+    int index = t_trace.count++;
+    SpanRecord &span = t_trace.spans[index % kMaxSpans];
+    span.name = name;
+    span.depth = t_trace.depth++;
+    span.end = 0;
+    span.begin = now();
+    return index;
+}
+
+// 结束一个阶段，记录已经被覆盖时只恢复嵌套层次
+void Trace::endSpan(int index)
+{
+    if (index < 0 || !t_trace.active)
+    {
+        return;
+    }
+    --t_trace.depth;
+    if (index + kMaxSpans >= t_trace.count)
+    {
+        t_trace.spans[index % kMaxSpans].end = now();
+    }
+}
@@ -0,0 +1,144 @@
+#include "workerpool.hpp"
+#include <muduo/base/Logging.h>
+
+// 计算from到now之间经过的微秒数
+static long long elapsedUs(std::chrono::steady_clock::time_point from)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - from)
+        .count();
+}
+
+// 原子变量更新最大值
+static void updateMax(std::atomic<long long> &target, long long value)
+{
+    long long prev = target.load();
+    while (value > prev && !target.compare_exchange_weak(prev, value))
+    {
+    }
+}
+
+WorkerPool::WorkerPool(const std::string &name)
+    : _name(name), _running(false),
+      _queueDepth(0), _maxQueueDepth(0), _tasks(0),
+      _totalQueueUs(0), _totalHandleUs(0), _maxHandleUs(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+// 启动业务线程
+void WorkerPool::start(int threadNum)
+{
+    _running = true;
+    for (int i = 0; i < threadNum; ++i)
+    {
+        _workers.emplace_back(new Worker());
+        Worker *worker = _workers.back().get();
+        worker->thread = std::thread(std::bind(&WorkerPool::runInThread, this, worker));
+    }
+    LOG_INFO << _name << " start " << threadNum << " worker threads";
+}
+
+// 停止所有业务线程
+void WorkerPool::stop()
+{
+    if (!_running.exchange(false))
+    {
+        return;
+    }
+    for (auto &worker : _workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+        }
+        worker->cv.notify_all();
+    }
+    for (auto &worker : _workers)
+    {
+        if (worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+}
+
+// 按key投递任务
+void WorkerPool::dispatch(size_t key, Task task)
+{
+    if (_workers.empty())
+    {
+        runTask(task);
+        return;
+    }
+
+    Worker *worker = _workers[key % _workers.size()].get();
+    updateMax(_maxQueueDepth, ++_queueDepth);
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->tasks.emplace_back(std::move(task), std::chrono::steady_clock::now());
+    }
+    worker->cv.notify_one();
+}
+
+// 业务线程的执行函数
+void WorkerPool::runInThread(Worker *worker)
+{
+    for (;;)
+    {
+        std::deque<std::pair<Task, std::chrono::steady_clock::time_point>> tasks;
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->cv.wait(lock, [&]() -> bool
+                            { return !worker->tasks.empty() || !_running; });
+            if (worker->tasks.empty())
+            {
+                // 线程池停止，并且没有待执行的任务了
+                return;
+            }
+            // 一次取走所有任务，减少和投递线程的锁竞争
+            tasks.swap(worker->tasks);
+        }
+
+        for (auto &item : tasks)
+        {
+            --_queueDepth;
+            _totalQueueUs += elapsedUs(item.second);
+            runTask(item.first);
+        }
+    }
+}
+
+// 执行一个任务并统计耗时
+void WorkerPool::runTask(const Task &task)
+{
+    auto begin = std::chrono::steady_clock::now();
+    try
+    {
+        task();
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR << _name << " task exception:" << e.what();
+    }
+    long long us = elapsedUs(begin);
+    ++_tasks;
+    _totalHandleUs += us;
+    updateMax(_maxHandleUs, us);
+}
+
+// 获取线程池的统计信息
+WorkerPoolStats WorkerPool::getStats()
+{
+    WorkerPoolStats stats;
+    stats.queueDepth = _queueDepth;
+    stats.maxQueueDepth = _maxQueueDepth;
+    stats.tasks = _tasks;
+    stats.totalQueueUs = _totalQueueUs;
+    stats.totalHandleUs = _totalHandleUs;
+    stats.maxHandleUs = _maxHandleUs;
+    return stats;
+}